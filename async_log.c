@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "async_log.h"
+
+// The ring is Vyukov's bounded queue: each slot's sequence number tells a
+// producer whether the slot is free for its ticket and tells the writer
+// whether the slot holds a published line.
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') return fallback;
+    char *end;
+    long v = strtol(value, &end, 10);
+    return (*end == '\0' && v >= 0) ? (int)v : fallback;
+}
+
+int async_log_init(struct async_log *log) {
+    memset(log, 0, sizeof(*log));
+    log->slots = calloc(ASYNC_LOG_SLOTS, sizeof(*log->slots));
+    if (!log->slots) return -1;
+    for (size_t i = 0; i < ASYNC_LOG_SLOTS; ++i) atomic_init(&log->slots[i].seq, i);
+    atomic_init(&log->head, 0);
+    atomic_init(&log->sleeping, 0);
+    atomic_init(&log->stop, 0);
+    atomic_init(&log->dropped, 0);
+    log->flush_ms = env_int(ASYNC_LOG_FLUSH_ENV, ASYNC_LOG_FLUSH_MS);
+    log->fsync_on_flush = env_int(ASYNC_LOG_FSYNC_ENV, ASYNC_LOG_FSYNC) != 0;
+    log->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (log->wake_fd < 0) {
+        free(log->slots);
+        return -1;
+    }
+    return 0;
+}
+
+int async_log_open(struct async_log *log, int index, const char *path) {
+    if (index < 0 || index >= ASYNC_LOG_MAX_FILES) return -1;
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    log->files[index] = fp;
+    return 0;
+}
+
+// Claims a slot for one entry; returns NULL when the ring is full
+static struct async_log_slot *claim_slot(struct async_log *log, size_t *ticket) {
+    size_t pos = atomic_load_explicit(&log->head, memory_order_relaxed);
+    while (1) {
+        struct async_log_slot *slot = &log->slots[pos & (ASYNC_LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&log->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *ticket = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&log->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Makes the slot visible to the writer and wakes it if it is asleep
+static void publish_slot(struct async_log *log, struct async_log_slot *slot, size_t ticket) {
+    atomic_store_explicit(&slot->seq, ticket + 1, memory_order_release);
+    // Pairs with the fence in writer_thread: either it sees this slot or we see it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&log->sleeping, 0)) {
+        uint64_t one = 1;
+        if (write(log->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("async_log wake");
+    }
+}
+
+int async_log_write(struct async_log *log, int index, const char *text, size_t len) {
+    if (index < 0 || index >= ASYNC_LOG_MAX_FILES) return -1;
+    size_t ticket;
+    struct async_log_slot *slot = claim_slot(log, &ticket);
+    if (!slot) {
+        atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+    if (len > ASYNC_LOG_LINE - 1) len = ASYNC_LOG_LINE - 1;
+    memcpy(slot->text, text, len);
+    slot->text[len] = '\n';
+    slot->len = len + 1;
+    slot->file = index;
+    slot->truncate = 0;
+    publish_slot(log, slot, ticket);
+    return 0;
+}
+
+int async_log_truncate(struct async_log *log, int index) {
+    if (index < 0 || index >= ASYNC_LOG_MAX_FILES) return -1;
+    size_t ticket;
+    struct async_log_slot *slot;
+    // Truncates are rare and the lines after one assume it happened, so wait
+    // for the writer to free a slot instead of dropping it
+    while (!(slot = claim_slot(log, &ticket))) {
+        if (!log->started) {
+            atomic_fetch_add_explicit(&log->dropped, 1, memory_order_relaxed);
+            return -1;
+        }
+        sched_yield();
+    }
+    slot->file = index;
+    slot->truncate = 1;
+    slot->len = 0;
+    publish_slot(log, slot, ticket);
+    return 0;
+}
+
+static void apply_slot(struct async_log *log, const struct async_log_slot *slot) {
+    FILE *fp = log->files[slot->file];
+    if (!fp) return;
+    if (slot->truncate) {
+        fflush(fp);
+        if (ftruncate(fileno(fp), 0) < 0) perror("async_log truncate");
+        rewind(fp);
+        return;
+    }
+    fwrite(slot->text, 1, slot->len, fp);
+}
+
+// Consumes every published slot; returns how many were written
+static size_t drain(struct async_log *log) {
+    size_t n = 0;
+    while (1) {
+        struct async_log_slot *slot = &log->slots[log->tail & (ASYNC_LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != log->tail + 1) return n;
+        apply_slot(log, slot);
+        atomic_store_explicit(&slot->seq, log->tail + ASYNC_LOG_SLOTS, memory_order_release);
+        log->tail++;
+        n++;
+    }
+}
+
+static void flush_files(struct async_log *log) {
+    for (int i = 0; i < ASYNC_LOG_MAX_FILES; ++i) {
+        if (!log->files[i]) continue;
+        fflush(log->files[i]);
+        if (log->fsync_on_flush) fsync(fileno(log->files[i]));
+    }
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Sleeps on the eventfd while the ring is empty and flushes at most once
+// per flush interval while lines keep arriving
+static void *writer_thread(void *arg) {
+    struct async_log *log = arg;
+    int dirty = 0;
+    long long last_flush = now_ms();
+    while (!atomic_load(&log->stop)) {
+        if (drain(log) > 0) dirty = 1;
+        long long waited = now_ms() - last_flush;
+        if (dirty && waited >= log->flush_ms) {
+            flush_files(log);
+            dirty = 0;
+            last_flush = now_ms();
+            waited = 0;
+        }
+
+        atomic_store(&log->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (drain(log) > 0) {
+            // A producer published after our drain; don't sleep on it
+            atomic_store(&log->sleeping, 0);
+            dirty = 1;
+            continue;
+        }
+        struct pollfd pfd = { .fd = log->wake_fd, .events = POLLIN };
+        int timeout = dirty ? (int)(log->flush_ms - waited) : -1;
+        if (poll(&pfd, 1, timeout) > 0) {
+            uint64_t count;
+            if (read(log->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("async_log read");
+        }
+        atomic_store(&log->sleeping, 0);
+    }
+    drain(log);
+    flush_files(log);
+    return NULL;
+}
+
+int async_log_start(struct async_log *log) {
+    if (pthread_create(&log->thread, NULL, writer_thread, log) != 0) return -1;
+    log->started = 1;
+    return 0;
+}
+
+void async_log_stop(struct async_log *log) {
+    if (log->started) {
+        atomic_store(&log->stop, 1);
+        uint64_t one = 1;
+        if (write(log->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("async_log wake");
+        pthread_join(log->thread, NULL);
+        log->started = 0;
+    }
+    unsigned long dropped = atomic_load(&log->dropped);
+    if (dropped) fprintf(stderr, "async_log: dropped %lu lines (ring full)\n", dropped);
+    for (int i = 0; i < ASYNC_LOG_MAX_FILES; ++i) {
+        if (log->files[i]) fclose(log->files[i]);
+        log->files[i] = NULL;
+    }
+    close(log->wake_fd);
+    free(log->slots);
+    log->slots = NULL;
+}
@@ -0,0 +1,62 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Asynchronous line logger: producers copy a line into a bounded lock-free
+// ring and return; a writer thread batches the lines into stdio buffers and
+// flushes them every ASYNC_LOG_FLUSH_MS (or fsyncs, if configured).
+
+#define ASYNC_LOG_SLOTS 4096        // power of two
+#define ASYNC_LOG_LINE 1024
+#define ASYNC_LOG_MAX_FILES 4
+#define ASYNC_LOG_FLUSH_MS 200
+#define ASYNC_LOG_FSYNC 0           // 1 = fsync after every flush
+
+// Environment overrides for the two policies above
+#define ASYNC_LOG_FLUSH_ENV "CHAT_LOG_FLUSH_MS"
+#define ASYNC_LOG_FSYNC_ENV "CHAT_LOG_FSYNC"
+
+struct async_log_slot {
+    atomic_size_t seq;
+    int file;
+    int truncate;                   // truncate <file> instead of writing
+    size_t len;
+    char text[ASYNC_LOG_LINE];
+};
+
+struct async_log {
+    struct async_log_slot *slots;
+    atomic_size_t head;             // next slot producers claim
+    size_t tail;                    // next slot the writer reads
+    FILE *files[ASYNC_LOG_MAX_FILES];
+    int flush_ms;
+    int fsync_on_flush;
+    int wake_fd;                    // eventfd the writer sleeps on
+    atomic_int sleeping;
+    atomic_int stop;
+    atomic_ulong dropped;           // lines lost because the ring was full
+    pthread_t thread;
+    int started;
+};
+
+int async_log_init(struct async_log *log);
+// Truncates <path> and attaches it as file <index>. Call before async_log_start.
+int async_log_open(struct async_log *log, int index, const char *path);
+int async_log_start(struct async_log *log);
+
+// Queues one line (a newline is appended). Never blocks; returns -1 and
+// counts a drop if the ring is full.
+int async_log_write(struct async_log *log, int index, const char *text, size_t len);
+// Queues a truncate of file <index>, ordered with the lines around it. Waits
+// for a free slot while the writer runs; before that a full ring counts a drop.
+int async_log_truncate(struct async_log *log, int index);
+
+// Drains the ring, flushes, and closes every file (safe after a failed start)
+void async_log_stop(struct async_log *log);
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,686 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "udp.h"
+#include "chat_server.h"
+#include "fanout.h"
+
+// Microbenchmarks for the server's core data structures. Every result is
+// reported as ns/op plus cache misses/op when the PMU is accessible.
+
+#define BENCH_MIN_SIZE 1000
+#define BENCH_MAX_SIZE 1000000
+#define BENCH_ROOM_MAX 100000    // a chat_room is ~15 KiB (replay queue inline)
+#define BENCH_CLIENT_MAX 100000  // the pre-split layout costs ~1.2 KiB per client
+#define BENCH_THREADS 4
+#define BENCH_TOPIC_GROUPS 64
+#define BENCH_TOPIC_ROUNDS 2000
+#define BENCH_FANOUT_SENDS 200000  // datagrams per fan-out row
+
+struct bench_ctx {
+    int perf_fd;                 // -1 when cache-miss counting is unavailable
+    int threads;
+};
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Fisher-Yates shuffle so lookups and removals hit memory in random order
+static void shuffle(size_t *idx, size_t n, uint64_t seed) {
+    for (size_t i = 0; i < n; ++i) idx[i] = i;
+    for (size_t i = n; i > 1; --i) {
+        size_t j = (size_t)(rng_next(&seed) % i);
+        size_t tmp = idx[i - 1];
+        idx[i - 1] = idx[j];
+        idx[j] = tmp;
+    }
+}
+
+// Counts last-level cache misses for this thread (user space only)
+static int perf_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+struct bench_sample {
+    uint64_t start_ns;
+};
+
+static void sample_begin(struct bench_ctx *ctx, struct bench_sample *s) {
+    if (ctx->perf_fd >= 0) {
+        ioctl(ctx->perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(ctx->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    s->start_ns = bench_now_ns();
+}
+
+static void sample_end(struct bench_ctx *ctx, struct bench_sample *s, const char *structure,
+                       const char *op, size_t size, int threads, size_t ops) {
+    uint64_t elapsed = bench_now_ns() - s->start_ns;
+    char misses[32] = "n/a";
+    if (ctx->perf_fd >= 0) {
+        ioctl(ctx->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if (read(ctx->perf_fd, &count, sizeof(count)) == sizeof(count) && threads == 1)
+            snprintf(misses, sizeof(misses), "%.2f", (double)count / (double)ops);
+    }
+    double ns = (double)elapsed / (double)ops;
+    printf("%-10s %-10s %9zu %7d %10.1f %10.2f %12s\n", structure, op, size, threads,
+           ns, ns > 0 ? 1000.0 / ns : 0.0, misses);
+    fflush(stdout);
+}
+
+// ---------------- activity_heap ----------------
+
+static void bench_heap(struct bench_ctx *ctx, size_t n) {
+    struct client_node *clients = calloc(n, sizeof(*clients));
+    size_t *order = malloc(n * sizeof(*order));
+    if (!clients || !order) {
+        fprintf(stderr, "bench: out of memory for heap size %zu\n", n);
+        free(clients);
+        free(order);
+        return;
+    }
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < n; ++i) {
+        clients[i].last_active = (time_t)(rng_next(&seed) % 1000000);
+        clients[i].heap_index = -1;
+    }
+    struct activity_heap heap;
+    activity_heap_init(&heap);
+    struct bench_sample s;
+
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) activity_heap_push(&heap, &clients[i]);
+    sample_end(ctx, &s, "heap", "push", n, 1, n);
+
+    volatile time_t sink = 0;
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) sink += activity_heap_peek(&heap)->last_active;
+    sample_end(ctx, &s, "heap", "peek", n, 1, n);
+    (void)sink;
+
+    // Typical update: a client becomes active and moves to the bottom
+    shuffle(order, n, 1);
+    time_t now = 1000000;
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) {
+        struct client_node *c = &clients[order[i]];
+        c->last_active = now++;
+        activity_heap_update(&heap, c);
+    }
+    sample_end(ctx, &s, "heap", "update", n, 1, n);
+
+    shuffle(order, n, 2);
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) activity_heap_remove(&heap, &clients[order[i]]);
+    sample_end(ctx, &s, "heap", "remove", n, 1, n);
+
+    activity_heap_destroy(&heap);
+    free(order);
+    free(clients);
+}
+
+// ---------------- message_queue ----------------
+
+static void bench_queue(struct bench_ctx *ctx, size_t n) {
+    message_queue *q = malloc(sizeof(*q));
+    if (!q) return;
+    queue_init(q);
+    char msg[128];
+    snprintf(msg, sizeof(msg), "[bench] a typical chat line of moderate length, about sixty bytes");
+    struct bench_sample s;
+
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) enqueue(q, msg);
+    sample_end(ctx, &s, "queue", "enqueue", n, 1, n);
+
+    // One replay walks the whole ring the way conn$ does
+    char out[BUFFER];
+    volatile size_t sink = 0;
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) {
+        int idx = q->head;
+        for (int j = 0; j < q->size; ++j) {
+            size_t len = strnlen(q->messages[idx], BUFFER - 1);
+            memcpy(out, q->messages[idx], len);
+            sink += len;
+            idx = (idx + 1) % max_messages;
+        }
+    }
+    sample_end(ctx, &s, "queue", "replay", n, 1, n);
+    (void)sink;
+    free(q);
+}
+
+// ---------------- room_table ----------------
+
+static void room_name(char *out, size_t cap, size_t i) {
+    snprintf(out, cap, "room-%zu", i);
+}
+
+// Interns room-0 .. room-<n-1>; the server does this once per request
+static const char **intern_rooms(struct bench_ctx *ctx, size_t n) {
+    const char **names = malloc(n * sizeof(*names));
+    if (!names) return NULL;
+    char name[MAX_NAME_LEN];
+    struct bench_sample s;
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) {
+        room_name(name, sizeof(name), i);
+        names[i] = intern(name);
+    }
+    sample_end(ctx, &s, "names", "intern", n, 1, n);
+    return names;
+}
+
+static void release_rooms(const char **names, size_t n) {
+    if (!names) return;
+    for (size_t i = 0; i < n; ++i) intern_release(names[i]);
+    free(names);
+}
+
+static void bench_rooms(struct bench_ctx *ctx, size_t n) {
+    size_t *order = malloc(n * sizeof(*order));
+    const char **names = intern_rooms(ctx, n);
+    if (!order || !names) {
+        free(order);
+        release_rooms(names, n);
+        return;
+    }
+    struct room_table table;
+    room_table_init(&table);
+    struct bench_sample s;
+
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) room_table_insert(&table, names[i]);
+    sample_end(ctx, &s, "rooms", "insert", n, 1, n);
+
+    shuffle(order, n, 3);
+    size_t found = 0;
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) found += room_table_find(&table, names[order[i]]) != NULL;
+    sample_end(ctx, &s, "rooms", "find", n, 1, n);
+    if (found != n) fprintf(stderr, "bench: room find missed %zu entries\n", n - found);
+
+    shuffle(order, n, 4);
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) room_table_remove(&table, names[order[i]]);
+    sample_end(ctx, &s, "rooms", "remove", n, 1, n);
+
+    room_table_destroy(&table);
+    release_rooms(names, n);
+    free(order);
+}
+
+// ---------------- client table ----------------
+
+// client_node as it was before the hot/cold split: one list node per
+// client with the name and mute list inline
+struct legacy_client {
+    char name[MAX_NAME_LEN];
+    struct sockaddr_in addr;
+    char muted[MAX_MUTED][MAX_NAME_LEN];
+    int muted_count;
+    time_t last_active;
+    time_t last_ping_sent;
+    uint64_t ping_sent_ns;
+    int waiting_ping;
+    int heap_index;
+    struct chat_room *room;
+    struct legacy_client *next;
+};
+
+static int legacy_muted(const struct legacy_client *c, const char *sender) {
+    for (int i = 0; i < c->muted_count; ++i)
+        if (strncmp(c->muted[i], sender, MAX_NAME_LEN) == 0) return 1;
+    return 0;
+}
+
+// Same check as the server's is_muted_for_receiver (not linked into bench)
+static int table_muted(const struct client_node *c, const char *sender) {
+    for (int i = 0; i < c->muted_count; ++i)
+        if (c->cold->muted[i] == sender) return 1;
+    return 0;
+}
+
+// One op is one recipient of a say$ broadcast: the mute check plus
+// reading the address sendto would use
+static void bench_clients(struct bench_ctx *ctx, size_t n) {
+    struct legacy_client *head = NULL;
+    struct client_table table;
+    client_table_init(&table);
+    char name[MAX_NAME_LEN];
+    for (size_t i = 0; i < n; ++i) {
+        struct legacy_client *c = calloc(1, sizeof(*c));
+        struct client_node *node = client_table_alloc(&table);
+        if (!c || !node) {
+            fprintf(stderr, "bench: out of memory for client size %zu\n", n);
+            free(c);
+            break;
+        }
+        snprintf(c->name, sizeof(c->name), "user-%zu", i);
+        snprintf(name, sizeof(name), "user-%zu", i);
+        const char *handle = intern(name);
+        client_table_set_name(&table, node, handle);
+        intern_release(handle);
+        c->addr.sin_port = node->addr.sin_port = (in_port_t)i;
+        c->next = head;
+        head = c;
+    }
+    const size_t rounds = BENCH_CLIENT_MAX * 10 / n;
+    volatile uint32_t sink = 0;
+    const char *sender = intern("user-0");
+    struct bench_sample s;
+
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) {
+        for (struct legacy_client *c = head; c; c = c->next)
+            if (!legacy_muted(c, "user-0")) sink += c->addr.sin_port;
+    }
+    sample_end(ctx, &s, "clients", "bcast-old", n, 1, rounds * n);
+
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < table.high; ++i) {
+            struct client_node *c = client_table_at(&table, i);
+            if (c->live && !table_muted(c, sender)) sink += c->addr.sin_port;
+        }
+    }
+    sample_end(ctx, &s, "clients", "broadcast", n, 1, rounds * n);
+    (void)sink;
+    intern_release(sender);
+
+    while (head) {
+        struct legacy_client *next = head->next;
+        free(head);
+        head = next;
+    }
+    client_table_destroy(&table);
+}
+
+// ---------------- topics ----------------
+
+// <n> subscribers: one in eight on the catch-all "feed.*.price", the rest
+// spread over "feed.<g>.*". Each publish to "feed.<g>.price" matches two
+// patterns, so an uncached resolve merges and de-duplicates both lists.
+static void bench_topics(struct bench_ctx *ctx, size_t n) {
+    struct client_table table;
+    struct topic_tree *tree = malloc(sizeof(*tree));
+    if (!tree) return;
+    client_table_init(&table);
+    topic_tree_init(tree);
+    const char *topics[BENCH_TOPIC_GROUPS];
+    char name[MAX_NAME_LEN];
+    for (size_t g = 0; g < BENCH_TOPIC_GROUPS; ++g) {
+        snprintf(name, sizeof(name), "feed.%zu.price", g);
+        topics[g] = intern(name);
+    }
+    struct bench_sample s;
+
+    sample_begin(ctx, &s);
+    for (size_t i = 0; i < n; ++i) {
+        struct client_node *c = client_table_alloc(&table);
+        if (!c) break;
+        if (i % 8 == 0) snprintf(name, sizeof(name), "feed.*.price");
+        else snprintf(name, sizeof(name), "feed.%zu.*", i % BENCH_TOPIC_GROUPS);
+        const char *pattern = intern(name);
+        topic_subscribe(tree, c, pattern);
+        intern_release(pattern);
+    }
+    sample_end(ctx, &s, "topics", "subscribe", n, 1, n);
+
+    const size_t rounds = BENCH_TOPIC_ROUNDS;
+    volatile uint32_t sink = 0;
+    uint32_t count;
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) {
+        tree->generation++;      // as if a subscription had just changed
+        topic_resolve(tree, topics[r % BENCH_TOPIC_GROUPS], &count);
+        sink += count;
+    }
+    sample_end(ctx, &s, "topics", "resolve", n, 1, rounds);
+
+    for (size_t g = 0; g < BENCH_TOPIC_GROUPS; ++g) topic_resolve(tree, topics[g], &count);
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) {
+        topic_resolve(tree, topics[r % BENCH_TOPIC_GROUPS], &count);
+        sink += count;
+    }
+    sample_end(ctx, &s, "topics", "cached", n, 1, rounds);
+    (void)sink;
+
+    for (size_t i = 0; i < table.high; ++i) {
+        struct client_node *c = client_table_at(&table, i);
+        if (c->live) topic_unsubscribe_all(tree, c);
+    }
+    for (size_t g = 0; g < BENCH_TOPIC_GROUPS; ++g) intern_release(topics[g]);
+    client_table_destroy(&table);
+    topic_tree_destroy(tree);
+    free(tree);
+}
+
+// ---------------- fan-out ----------------
+
+// A say$ broadcast to <n> clients over loopback into a socket nobody
+// reads (the kernel drops what does not fit). One op is one complete
+// broadcast: per-recipient sendto, sendmmsg batches, and sendmmsg batches
+// split across --threads threads claiming chunks as the server does.
+struct fanout_bench {
+    int sd;
+    int use_sendto;
+    struct client_table *clients;
+    const char *sender;
+    char record[BUFFER_SIZE];
+    size_t len;
+};
+
+static uint64_t fanout_bench_chunk(void *ctx, size_t begin, size_t end) {
+    struct fanout_bench *fb = ctx;
+    struct fanout_batch batch;
+    fanout_batch_init(&batch, fb->sd, fb->record, fb->len);
+    uint64_t sent = 0;
+    for (size_t i = begin; i < end; ++i) {
+        struct client_node *c = client_table_at(fb->clients, i);
+        if (!c->live || table_muted(c, fb->sender)) continue;
+        if (fb->use_sendto) sendto(fb->sd, fb->record, fb->len, 0, (struct sockaddr *)&c->addr, sizeof(c->addr));
+        else fanout_batch_add(&batch, &c->addr);
+        sent++;
+    }
+    fanout_batch_flush(&batch);
+    return sent;
+}
+
+// Stand-ins for idle workers: each posted job is offered to every helper
+struct fanout_helpers {
+    pthread_mutex_t lock;
+    pthread_cond_t posted;
+    struct fanout_job *job;          // cleared by the owner before it lets go
+    uint64_t seq;
+    int stop;
+};
+
+static void *fanout_helper(void *arg) {
+    struct fanout_helpers *h = arg;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&h->lock);
+    for (;;) {
+        while (h->seq == seen && !h->stop) pthread_cond_wait(&h->posted, &h->lock);
+        if (h->stop) break;
+        seen = h->seq;
+        if (!h->job) continue;
+        struct fanout_job *job = fanout_job_ref(h->job);
+        pthread_mutex_unlock(&h->lock);
+        fanout_run(job);
+        fanout_job_release(job);
+        pthread_mutex_lock(&h->lock);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+}
+
+static uint64_t fanout_parallel(struct fanout_helpers *h, struct fanout_bench *fb, size_t total) {
+    struct fanout_job *job = fanout_job_create(fanout_bench_chunk, fb, total, FANOUT_CHUNK);
+    if (!job) return fanout_bench_chunk(fb, 0, total);
+    pthread_mutex_lock(&h->lock);
+    h->job = job;
+    h->seq++;
+    pthread_cond_broadcast(&h->posted);
+    pthread_mutex_unlock(&h->lock);
+    uint64_t sent = fanout_wait(job);
+    pthread_mutex_lock(&h->lock);
+    h->job = NULL;
+    pthread_mutex_unlock(&h->lock);
+    fanout_job_release(job);
+    return sent;
+}
+
+static void bench_fanout(struct bench_ctx *ctx, size_t n) {
+    int sink = socket(AF_INET, SOCK_DGRAM, 0);
+    struct fanout_bench fb = { .sd = socket(AF_INET, SOCK_DGRAM, 0), .sender = NULL };
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    set_socket_addr(&addr, "127.0.0.1", 0);
+    if (sink < 0 || fb.sd < 0 || bind(sink, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(sink, (struct sockaddr *)&addr, &addr_len) != 0) {
+        fprintf(stderr, "bench: no loopback socket for fan-out\n");
+        if (sink >= 0) close(sink);
+        if (fb.sd >= 0) close(fb.sd);
+        return;
+    }
+    struct client_table table;
+    client_table_init(&table);
+    for (size_t i = 0; i < n; ++i) {
+        struct client_node *c = client_table_alloc(&table);
+        if (!c) break;
+        c->addr = addr;
+    }
+    fb.clients = &table;
+    fb.len = (size_t)snprintf(fb.record, sizeof(fb.record), "%c[user-0] %s\n", 0,
+                              "a typical chat line of about sixty bytes, give or take");
+
+    struct fanout_helpers h = { .seq = 0, .stop = 0, .job = NULL };
+    pthread_mutex_init(&h.lock, NULL);
+    pthread_cond_init(&h.posted, NULL);
+    pthread_t threads[64];
+    int helpers = 0;
+    while (helpers < ctx->threads - 1 && pthread_create(&threads[helpers], NULL, fanout_helper, &h) == 0)
+        helpers++;
+
+    size_t rounds = BENCH_FANOUT_SENDS / n ? BENCH_FANOUT_SENDS / n : 1;
+    volatile uint64_t sink_count = 0;
+    struct bench_sample s;
+
+    fb.use_sendto = 1;
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) sink_count += fanout_bench_chunk(&fb, 0, table.high);
+    sample_end(ctx, &s, "fanout", "sendto", n, 1, rounds);
+
+    fb.use_sendto = 0;
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) sink_count += fanout_bench_chunk(&fb, 0, table.high);
+    sample_end(ctx, &s, "fanout", "sendmmsg", n, 1, rounds);
+
+    sample_begin(ctx, &s);
+    for (size_t r = 0; r < rounds; ++r) sink_count += fanout_parallel(&h, &fb, table.high);
+    sample_end(ctx, &s, "fanout", "parallel", n, helpers + 1, rounds);
+    (void)sink_count;
+
+    pthread_mutex_lock(&h.lock);
+    h.stop = 1;
+    pthread_cond_broadcast(&h.posted);
+    pthread_mutex_unlock(&h.lock);
+    for (int i = 0; i < helpers; ++i) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&h.lock);
+    pthread_cond_destroy(&h.posted);
+    client_table_destroy(&table);
+    close(fb.sd);
+    close(sink);
+}
+
+// ---------------- multi-threaded ----------------
+
+// Threads share one structure and take the same locks the server does:
+// the heap and replay queue sit behind server_state's rwlock, the room
+// table behind its own mutex.
+struct mt_shared {
+    pthread_rwlock_t rwlock;
+    struct activity_heap heap;
+    struct client_node *clients;
+    message_queue *queue;
+    struct room_table rooms;
+    size_t n;
+    int threads;
+    pthread_barrier_t barrier;
+};
+
+struct mt_worker {
+    struct mt_shared *shared;
+    int id;
+    int kind;
+};
+
+enum { MT_HEAP_UPDATE, MT_QUEUE_ENQUEUE, MT_ROOM_FIND };
+
+static void *mt_worker_main(void *arg) {
+    struct mt_worker *w = arg;
+    struct mt_shared *sh = w->shared;
+    size_t per = sh->n / (size_t)sh->threads;
+    size_t base = per * (size_t)w->id;
+    uint64_t seed = 0x2545f4914f6cdd1dull + (uint64_t)w->id;
+    char name[MAX_NAME_LEN];
+    pthread_barrier_wait(&sh->barrier);
+    for (size_t i = 0; i < per; ++i) {
+        switch (w->kind) {
+        case MT_HEAP_UPDATE: {
+            struct client_node *c = &sh->clients[base + rng_next(&seed) % per];
+            pthread_rwlock_wrlock(&sh->rwlock);
+            c->last_active++;
+            activity_heap_update(&sh->heap, c);
+            pthread_rwlock_unlock(&sh->rwlock);
+            break;
+        }
+        case MT_QUEUE_ENQUEUE:
+            pthread_rwlock_wrlock(&sh->rwlock);
+            enqueue(sh->queue, "[bench] concurrent message");
+            pthread_rwlock_unlock(&sh->rwlock);
+            break;
+        default: {
+            // As a request does: intern the argument once, then look up by handle
+            room_name(name, sizeof(name), (size_t)(rng_next(&seed) % sh->n));
+            const char *handle = intern_find(name);
+            room_table_find(&sh->rooms, handle);
+            intern_release(handle);
+            break;
+        }
+        }
+    }
+    return NULL;
+}
+
+static void mt_run(struct bench_ctx *ctx, struct mt_shared *sh, int kind,
+                   const char *structure, const char *op) {
+    pthread_t tids[64];
+    struct mt_worker workers[64];
+    pthread_barrier_init(&sh->barrier, NULL, (unsigned)sh->threads + 1);
+    for (int t = 0; t < sh->threads; ++t) {
+        workers[t] = (struct mt_worker){ .shared = sh, .id = t, .kind = kind };
+        pthread_create(&tids[t], NULL, mt_worker_main, &workers[t]);
+    }
+    struct bench_sample s;
+    sample_begin(ctx, &s);
+    pthread_barrier_wait(&sh->barrier);
+    for (int t = 0; t < sh->threads; ++t) pthread_join(tids[t], NULL);
+    size_t ops = sh->n / (size_t)sh->threads * (size_t)sh->threads;
+    sample_end(ctx, &s, structure, op, sh->n, sh->threads, ops);
+    pthread_barrier_destroy(&sh->barrier);
+}
+
+static void bench_threads(struct bench_ctx *ctx, size_t n, size_t rooms) {
+    struct mt_shared sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.n = n;
+    sh.threads = ctx->threads;
+    pthread_rwlock_init(&sh.rwlock, NULL);
+    activity_heap_init(&sh.heap);
+    room_table_init(&sh.rooms);
+    sh.clients = calloc(n, sizeof(*sh.clients));
+    sh.queue = malloc(sizeof(*sh.queue));
+    if (sh.clients && sh.queue) {
+        queue_init(sh.queue);
+        for (size_t i = 0; i < n; ++i) {
+            sh.clients[i].last_active = (time_t)i;
+            sh.clients[i].heap_index = -1;
+            activity_heap_push(&sh.heap, &sh.clients[i]);
+        }
+        mt_run(ctx, &sh, MT_HEAP_UPDATE, "heap", "update");
+        mt_run(ctx, &sh, MT_QUEUE_ENQUEUE, "queue", "enqueue");
+        if (n <= rooms) {
+            char name[MAX_NAME_LEN];
+            for (size_t i = 0; i < n; ++i) {
+                room_name(name, sizeof(name), i);
+                const char *handle = intern(name);
+                room_table_insert(&sh.rooms, handle);
+                intern_release(handle);
+            }
+            mt_run(ctx, &sh, MT_ROOM_FIND, "rooms", "find");
+        }
+    }
+    room_table_destroy(&sh.rooms);
+    activity_heap_destroy(&sh.heap);
+    free(sh.queue);
+    free(sh.clients);
+    pthread_rwlock_destroy(&sh.rwlock);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--max N] [--room-max N] [--threads N] [--only heap|queue|rooms|clients|topics|fanout|threads]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    size_t max = BENCH_MAX_SIZE;
+    size_t room_max = BENCH_ROOM_MAX;
+    const char *only = NULL;
+    struct bench_ctx ctx = { .perf_fd = -1, .threads = BENCH_THREADS };
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            max = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--room-max") == 0 && i + 1 < argc) {
+            room_max = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            ctx.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (max < BENCH_MIN_SIZE || ctx.threads < 1 || ctx.threads > 64) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ctx.perf_fd = perf_open();
+    if (ctx.perf_fd < 0) fprintf(stderr, "bench: cache-miss counter unavailable, reporting n/a\n");
+
+    printf("%-10s %-10s %9s %7s %10s %10s %12s\n",
+           "structure", "op", "size", "threads", "ns/op", "Mops/s", "misses/op");
+    for (size_t n = BENCH_MIN_SIZE; n <= max; n *= 10) {
+        if (!only || strcmp(only, "heap") == 0) bench_heap(&ctx, n);
+        if (!only || strcmp(only, "queue") == 0) bench_queue(&ctx, n);
+        if ((!only || strcmp(only, "rooms") == 0) && n <= room_max) bench_rooms(&ctx, n);
+        if ((!only || strcmp(only, "clients") == 0) && n <= BENCH_CLIENT_MAX) bench_clients(&ctx, n);
+        if ((!only || strcmp(only, "topics") == 0) && n <= BENCH_CLIENT_MAX) bench_topics(&ctx, n);
+        if ((!only || strcmp(only, "fanout") == 0) && n <= BENCH_CLIENT_MAX) bench_fanout(&ctx, n);
+        if ((!only || strcmp(only, "threads") == 0) && ctx.threads > 1) bench_threads(&ctx, n, room_max);
+    }
+    if (ctx.perf_fd >= 0) close(ctx.perf_fd);
+    return 0;
+}
@@ -5,64 +5,64 @@
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
-#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <gtk/gtk.h>
 #include "udp.h"
+#include "chat_proto.h"
+#include "async_log.h"
 
 #define GLOBAL_LOG_FILE "logs/global.txt"
 #define ROOM_LOG_FILE "logs/room.txt"
 #define PRIV_LOG_FILE "logs/priv.txt"
-#define MSG_GLOBAL 0x00
-#define MSG_ROOM   0x01
-#define MSG_PRIV   0x02
+
+// File slots in the async logger
+enum { LOG_GLOBAL, LOG_ROOM, LOG_PRIV };
+#define UI_FLUSH_INTERVAL_MS 16   // ~60 Hz cap on pane redraws
+#define PANE_MAX_LINES 5000        // older lines are trimmed from the front
+#define PANE_MAX_CHARS (1 << 20)
+#define PANE_TRIM_PERCENT 75       // trim down to this share of the cap
+
+// Text received for a pane waits in <pending> until the next UI flush.
+// <pending>/<clear> are shared with worker threads under ui_context.pending_lock;
+// <spare> is only touched on the GTK thread.
+struct ui_pane {
+    GtkWidget *view;
+    GtkTextBuffer *buffer;
+    GString *pending;
+    GString *spare;
+    gboolean clear;
+};
 
 struct ui_context {
     GtkWidget *window;
     GtkWidget *input;
-    GtkWidget *global_view;
-    GtkWidget *room_view;
-    GtkWidget *priv_view;
-    GtkTextBuffer *global_buffer;
-    GtkTextBuffer *room_buffer;
-    GtkTextBuffer *priv_buffer;
+    struct ui_pane global;
+    struct ui_pane room;
+    struct ui_pane priv;
+    GMutex pending_lock;
+    guint flush_source;        // armed timer, 0 when nothing is pending
 };
 
 struct client_context {
-    int sd;
-    struct sockaddr_in server_addr;
-    FILE *global_log_fd;
-    FILE *room_log_fd;
-    FILE *priv_log_fd;
+    struct chat_conn conn;
+    struct async_log logs;     // written by its own thread, never on the receive path
     struct ui_context ui;
+    int wake_fd;               // eventfd: commands are waiting in send_queue
+    int rooms;                 // rooms the server says we are in (I/O thread only)
     volatile sig_atomic_t running;
-    volatile sig_atomic_t sender_active;
+    volatile sig_atomic_t io_active;
 };
 
-static GAsyncQueue *send_queue; // queue of tokens to send to sender_thread (inputs, close token and disconn$)
+static GAsyncQueue *send_queue; // queue of tokens to send to io_thread (inputs, close token and disconn$)
 static gpointer queue_quit_token = GINT_TO_POINTER(1); // closes gkt properly
 
-struct append_request {
-    GtkTextBuffer *buffer;
-    GtkWidget *view;
-    char *text;
-};
-
-// Resets the log on disk and reopens it in append mode for the requested channel.
-static int initialise_log_file(const char *path, FILE **fp, const char *label) {
-    FILE *file = fopen(path, "w");
-    if (!file) {
-        fprintf(stderr, "Failed to reset %s log (%s): %s\n", label, path, strerror(errno));
-        return -1;
-    }
-    fclose(file);
-
-    file = fopen(path, "a");
-    if (!file) {
+// Resets the log on disk and attaches it to the async logger for the requested channel.
+static int initialise_log_file(struct async_log *logs, int index, const char *path, const char *label) {
+    if (async_log_open(logs, index, path) < 0) {
         fprintf(stderr, "Failed to open %s log (%s): %s\n", label, path, strerror(errno));
         return -1;
     }
-
-    *fp = file;
     return 0;
 }
 
@@ -74,36 +74,86 @@ static void trim_newline(char *line) {
     }
 }
 
-// Identifies the disconnect command so the sender can shut down.
-static int request_is_disconnect(const char *req) {
-    return strncmp(req, "disconn$", 8) == 0;
+// Drops whole lines from the front once a pane exceeds its line or char cap.
+// Trimming goes well below the cap so the delete (and the relayout it
+// causes) happens once per many flushes rather than on every message.
+static void trim_pane(struct ui_pane *pane) {
+    gint lines = gtk_text_buffer_get_line_count(pane->buffer);
+    gint chars = gtk_text_buffer_get_char_count(pane->buffer);
+    if (lines <= PANE_MAX_LINES && chars <= PANE_MAX_CHARS) return;
+
+    GtkTextIter start, cut;
+    gtk_text_buffer_get_start_iter(pane->buffer, &start);
+    if (lines > PANE_MAX_LINES)
+        gtk_text_buffer_get_iter_at_line(pane->buffer, &cut, lines - PANE_MAX_LINES * PANE_TRIM_PERCENT / 100);
+    else
+        gtk_text_buffer_get_start_iter(pane->buffer, &cut);
+    gint drop_chars = chars - PANE_MAX_CHARS / 100 * PANE_TRIM_PERCENT;
+    if (chars > PANE_MAX_CHARS && gtk_text_iter_get_offset(&cut) < drop_chars) {
+        gtk_text_iter_set_offset(&cut, drop_chars);
+        if (!gtk_text_iter_starts_line(&cut))
+            gtk_text_iter_forward_line(&cut);
+    }
+    gtk_text_buffer_delete(pane->buffer, &start, &cut);
+}
+
+// Moves a pane's pending text into the buffer with one insert and one scroll.
+static void flush_pane(struct ui_context *ui, struct ui_pane *pane) {
+    g_mutex_lock(&ui->pending_lock);
+    GString *batch = pane->pending;
+    pane->pending = pane->spare;
+    gboolean clear = pane->clear;
+    pane->clear = FALSE;
+    g_mutex_unlock(&ui->pending_lock);
+
+    if (clear)
+        gtk_text_buffer_set_text(pane->buffer, "", -1);
+    if (batch->len > 0) {
+        GtkTextIter iter;
+        gtk_text_buffer_get_end_iter(pane->buffer, &iter);
+        gtk_text_buffer_insert(pane->buffer, &iter, batch->str, (gint)batch->len);
+        trim_pane(pane);
+        gtk_text_buffer_get_end_iter(pane->buffer, &iter);
+        gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(pane->view), &iter, 0.0, FALSE, 0.0, 0.0);
+    }
+    g_string_truncate(batch, 0);
+    pane->spare = batch;
 }
 
-// Runs inside the GTK main loop to append received text to a buffer.
-static gboolean append_dispatch(gpointer data) {
-    struct append_request *req = data;
-    GtkTextIter iter;
-    gtk_text_buffer_get_end_iter(req->buffer, &iter);
-    gtk_text_buffer_insert(req->buffer, &iter, req->text, -1);
-    gtk_text_buffer_get_end_iter(req->buffer, &iter);
-    gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(req->view), &iter, 0.0, FALSE, 0.0, 0.0);
-    g_free(req->text);
-    g_free(req);
+// Timer callback on the GTK main loop: drains every pane once per frame.
+static gboolean flush_panes(gpointer data) {
+    struct ui_context *ui = data;
+    g_mutex_lock(&ui->pending_lock);
+    ui->flush_source = 0;
+    g_mutex_unlock(&ui->pending_lock);
+    flush_pane(ui, &ui->global);
+    flush_pane(ui, &ui->room);
+    flush_pane(ui, &ui->priv);
     return G_SOURCE_REMOVE;
 }
 
-// Queues a text insert into the UI from worker threads using g_idle_add.
-static void schedule_append(struct ui_context *ui, GtkWidget *view, GtkTextBuffer *buffer, const char *msg) {
-    if (!ui || !view || !buffer || !msg) return;
-    struct append_request *req = g_new0(struct append_request, 1);
-    req->buffer = buffer;
-    req->view = view;
+// Arms the flush timer unless one is already pending. Caller holds pending_lock.
+static void arm_flush_locked(struct ui_context *ui) {
+    if (ui->flush_source == 0)
+        ui->flush_source = g_timeout_add(UI_FLUSH_INTERVAL_MS, flush_panes, ui);
+}
+
+// Queues text for a pane from worker threads; the next flush inserts it.
+static void schedule_append(struct ui_context *ui, struct ui_pane *pane, const char *msg) {
+    if (!ui || !pane || !msg) return;
     size_t len = strlen(msg);
+    g_mutex_lock(&ui->pending_lock);
+    g_string_append_len(pane->pending, msg, (gssize)len);
     if (len == 0 || msg[len - 1] != '\n')
-        req->text = g_strdup_printf("%s\n", msg);
-    else
-        req->text = g_strdup(msg);
-    g_idle_add(append_dispatch, req);
+        g_string_append_c(pane->pending, '\n');
+    // If the UI stalls, keep only the newest text that could be shown anyway
+    if (pane->pending->len > PANE_MAX_CHARS) {
+        const char *cut = memchr(pane->pending->str + pane->pending->len - PANE_MAX_CHARS, '\n', PANE_MAX_CHARS);
+        gsize drop = cut ? (gsize)(cut - pane->pending->str) + 1 : pane->pending->len - PANE_MAX_CHARS;
+        g_string_erase(pane->pending, 0, (gssize)drop);
+    }
+    arm_flush_locked(ui);
+    g_mutex_unlock(&ui->pending_lock);
 }
 
 // Stops the GTK main loop when scheduled from worker threads.
@@ -113,34 +163,23 @@ static gboolean quit_idle(gpointer data) {
     return G_SOURCE_REMOVE;
 }
 
-// Clears the on-disk room log (logs/room.txt) but keeps the FILE* open so
-// subsequent room messages continue appending in the same session.
+// Clears the on-disk room log (logs/room.txt); the writer applies it in order
+// with the lines around it and keeps appending in the same session.
 static int truncate_room_log(struct client_context *ctx) {
-    if (!ctx || !ctx->room_log_fd) return -1;
-    fflush(ctx->room_log_fd);
-    int fd = fileno(ctx->room_log_fd);
-    if (fd < 0) return -1;
-    if (ftruncate(fd, 0) < 0) {
-        perror("ftruncate room log");
-        return -1;
-    }
-    lseek(fd, 0, SEEK_SET);
-    return 0;
-}
-
-static gboolean clear_buffer_idle(gpointer data) {
-    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(data);
-    gtk_text_buffer_set_text(buffer, "", -1);
-    g_object_unref(buffer);
-    return G_SOURCE_REMOVE;
+    if (!ctx) return -1;
+    return async_log_truncate(&ctx->logs, LOG_ROOM);
 }
 
 // Schedules the GTK room text buffer to be cleared on the UI thread so it
-// matches the truncated log file before joining/leaving a room.
+// matches the truncated log file once the last room is left. Text still
+// pending for that room is dropped with it.
 static void schedule_clear_room_buffer(struct ui_context *ui) {
-    if (!ui || !ui->room_buffer) return;
-    g_object_ref(ui->room_buffer);
-    g_idle_add(clear_buffer_idle, ui->room_buffer);
+    if (!ui || !ui->room.buffer) return;
+    g_mutex_lock(&ui->pending_lock);
+    g_string_truncate(ui->room.pending, 0);
+    ui->room.clear = TRUE;
+    arm_flush_locked(ui);
+    g_mutex_unlock(&ui->pending_lock);
 }
 
 // Schedules gtk_main_quit to run on the UI thread.
@@ -148,6 +187,14 @@ static void schedule_quit(void) {
     g_idle_add(quit_idle, NULL);
 }
 
+// Hands a command (or the quit token) to the I/O thread and wakes its poll.
+static void queue_command(struct client_context *ctx, gpointer item) {
+    g_async_queue_push(send_queue, item);
+    uint64_t one = 1;
+    if (write(ctx->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("client: wake I/O thread");
+}
+
 // Enqueues a disconnect request so the sender thread notifies the server.
 static void notify_server_disconnect(struct client_context *ctx) {
     if (!ctx || !send_queue) return;
@@ -156,14 +203,14 @@ static void notify_server_disconnect(struct client_context *ctx) {
         fprintf(stderr, "client: failed to allocate disconnect request\n");
         return;
     }
-    g_async_queue_push(send_queue, msg);
+    queue_command(ctx, msg);
 }
 
 // Initiates a graceful shutdown when the user closes the GTK window.
 static void on_window_destroy(GtkWidget *widget, gpointer user_data) {
     (void)widget;
     struct client_context *ctx = user_data;
-    if (ctx && ctx->sender_active)
+    if (ctx && ctx->io_active)
         notify_server_disconnect(ctx);
     ctx->running = 0;
     gtk_main_quit();
@@ -214,7 +261,7 @@ static void on_entry_activate(GtkEntry *entry, gpointer user_data) {
     char *copy = g_strdup(text);
     g_strstrip(copy);
     if (copy[0] != '\0' && ctx && ctx->running) {
-        g_async_queue_push(send_queue, copy);
+        queue_command(ctx, copy);
     } else {
         g_free(copy);
     }
@@ -224,6 +271,12 @@ static void on_entry_activate(GtkEntry *entry, gpointer user_data) {
 // Creates all GTK widgets, hooks up callbacks, and shows the main window.
 static void setup_ui(struct ui_context *ui, struct client_context *ctx) {
     memset(ui, 0, sizeof(*ui));
+    g_mutex_init(&ui->pending_lock);
+    struct ui_pane *panes[] = { &ui->global, &ui->room, &ui->priv };
+    for (size_t i = 0; i < G_N_ELEMENTS(panes); ++i) {
+        panes[i]->pending = g_string_new(NULL);
+        panes[i]->spare = g_string_new(NULL);
+    }
     GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "UDP Chat Client");
     gtk_window_set_default_size(GTK_WINDOW(window), 960, 600);
@@ -250,7 +303,7 @@ static void setup_ui(struct ui_context *ui, struct client_context *ctx) {
     gtk_style_context_add_class(gtk_widget_get_style_context(content_box), "main-bg");
     gtk_box_pack_start(GTK_BOX(main_box), content_box, TRUE, TRUE, 0);
 
-    GtkWidget *global_section = create_log_section("Global", &ui->global_view, &ui->global_buffer);
+    GtkWidget *global_section = create_log_section("Global", &ui->global.view, &ui->global.buffer);
     gtk_box_pack_start(GTK_BOX(content_box), global_section, TRUE, TRUE, 0);
 
     GtkWidget *right_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 12);
@@ -258,10 +311,10 @@ static void setup_ui(struct ui_context *ui, struct client_context *ctx) {
     gtk_style_context_add_class(gtk_widget_get_style_context(right_box), "main-bg");
     gtk_box_pack_start(GTK_BOX(content_box), right_box, TRUE, TRUE, 0);
 
-    GtkWidget *room_section = create_log_section("Room", &ui->room_view, &ui->room_buffer);
+    GtkWidget *room_section = create_log_section("Room", &ui->room.view, &ui->room.buffer);
     gtk_box_pack_start(GTK_BOX(right_box), room_section, TRUE, TRUE, 0);
 
-    GtkWidget *priv_section = create_log_section("Private", &ui->priv_view, &ui->priv_buffer);
+    GtkWidget *priv_section = create_log_section("Private", &ui->priv.view, &ui->priv.buffer);
     gtk_box_pack_start(GTK_BOX(right_box), priv_section, TRUE, TRUE, 0);
 
     ui->input = gtk_entry_new();
@@ -277,140 +330,132 @@ static void setup_ui(struct ui_context *ui, struct client_context *ctx) {
 }
 
 
-// Receives UDP packets from the server, logs them, and updates the Global view.
-static void *listener_thread(void *arg) {
-    struct client_context *ctx = (struct client_context *)arg;
-    char buffer[BUFFER_SIZE];
-    struct sockaddr_in responder;
-
-    while (ctx->running) {
-        int rc = udp_socket_read(ctx->sd, &responder, buffer, BUFFER_SIZE - 1);
-
-        if (rc < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                usleep(10000);
-                continue;
-            }
-            if (errno == EINTR) continue;
+static int starts_with(const char *text, const char *prefix) {
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
 
-            fprintf(stderr, "listener: recv failed (%s)\n", strerror(errno));
-            perror("udp_socket_read");
-            ctx->running = 0;
-            schedule_quit();
-            break;
+// Follows the server's room notices. The room pane interleaves every room
+// the user is in, so it and its log are only cleared when the last one is left.
+static void track_rooms(struct client_context *ctx, const char *text, size_t len) {
+    const char *joined = "; you joined it";
+    if (starts_with(text, "[Server] Joined room <") ||
+        (starts_with(text, "[Server] Room <") && len > strlen(joined) &&
+         strcmp(text + len - strlen(joined), joined) == 0)) {
+        ctx->rooms++;
+    } else if (starts_with(text, "[Server] You left room <") ||
+               starts_with(text, "[Server] You have been removed from room <")) {
+        // Rooms kept from before a restart were never counted: treat as the last
+        if (--ctx->rooms <= 0) {
+            ctx->rooms = 0;
+            truncate_room_log(ctx);
+            schedule_clear_room_buffer(&ctx->ui);
         }
+    }
+}
 
-        buffer[rc] = '\0';
-
-        if (strncmp(buffer, "ping$", strlen("ping$")) != 0) {
-
-            unsigned char prefix = buffer[0] & 0x03;  
-            const char *payload = buffer + 1;
-            if (*payload == '\0')
-                continue;
-
-            FILE *target_log = NULL;
-            GtkWidget *target_view = NULL;
-            GtkTextBuffer *target_buffer = NULL;
-
-            switch (prefix) {
-                case MSG_GLOBAL:  // 00
-                    target_log = ctx->global_log_fd;
-                    target_view = ctx->ui.global_view;
-                    target_buffer = ctx->ui.global_buffer;
-                    break;
-
-                case MSG_ROOM:    // 01
-                    target_log = ctx->room_log_fd;
-                    target_view = ctx->ui.room_view;
-                    target_buffer = ctx->ui.room_buffer;
-                    break;
+// Routes a single record to its pane and log (pings are answered by chat_proto).
+static void on_chat_message(void *user, enum chat_channel channel, const char *text, size_t len) {
+    struct client_context *ctx = user;
+    int target_log = LOG_GLOBAL;
+    struct ui_pane *target_pane = NULL;
 
-                case MSG_PRIV:    // 10
-                    target_log = ctx->priv_log_fd;
-                    target_view = ctx->ui.priv_view;
-                    target_buffer = ctx->ui.priv_buffer;
-                    break;
+    switch (channel) {
+        case CHAT_ROOM:
+            target_log = LOG_ROOM;
+            target_pane = &ctx->ui.room;
+            break;
 
-                default:
-                    target_log = ctx->global_log_fd;
-                    target_view = ctx->ui.global_view;
-                    target_buffer = ctx->ui.global_buffer;
-                    break;
-            }
+        case CHAT_PRIV:
+            target_log = LOG_PRIV;
+            target_pane = &ctx->ui.priv;
+            break;
 
-            fprintf(target_log, "%s\n", payload);
-            fflush(target_log);
+        default:
+            target_pane = &ctx->ui.global;
+            track_rooms(ctx, text, len);
+            break;
+    }
 
-            schedule_append(&ctx->ui, target_view, target_buffer, payload);
+    async_log_write(&ctx->logs, target_log, text, len);
 
-        } else {
-            char *msg = g_strdup("re-ping$");
-            if (!msg) {
-                fprintf(stderr, "client: failed to allocate re-ping\n");
-                break;
-            }
-            g_async_queue_push(send_queue, msg);
-        }
+    schedule_append(&ctx->ui, target_pane, text);
+}
 
+// Sends one queued command, reacting locally first where needed.
+// Returns 1 when the client should stop (disconnect or send failure).
+static int send_command(struct client_context *ctx, char *request) {
+    trim_newline(request);
+    if (request[0] == '\0')
+        return 0;
+
+    enum chat_command kind = chat_command_kind(request);
+    if (chat_send(&ctx->conn, request) < 0) {
+        fprintf(stderr, "sender: send failed (%s)\n", strerror(errno));
+        return 1;
     }
-
-    return NULL;
+    return kind == CHAT_CMD_DISCONN;
 }
 
-// Pulls commands from the async queue and sends them to the server over UDP.
-static void *sender_thread(void *arg) {
+// Single I/O loop: blocks in poll() on the socket and the wake eventfd, then
+// sends every queued command and drains every queued datagram (recvmmsg).
+static void *io_thread(void *arg) {
     struct client_context *ctx = (struct client_context *)arg;
+    struct pollfd pfds[2] = {
+        { .fd = chat_fd(&ctx->conn), .events = POLLIN },
+        { .fd = ctx->wake_fd, .events = POLLIN },
+    };
+    int stop = 0;
 
-    while (1) {
-        gpointer item = g_async_queue_pop(send_queue);
-        if (item == queue_quit_token)
+    while (!stop) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
             break;
-
-        char *request = item;
-
-        trim_newline(request);
-        if (request[0] == '\0') {
-            g_free(request);
-            continue;
         }
 
-        char cmd_buf[64];
-        const char *cmd_start = request;
-        const char *dollar = strchr(request, '$');
-        size_t cmd_len = dollar ? (size_t)(dollar - cmd_start) : strlen(cmd_start);
-        if (cmd_len >= sizeof(cmd_buf)) cmd_len = sizeof(cmd_buf) - 1;
-        memcpy(cmd_buf, cmd_start, cmd_len);
-        cmd_buf[cmd_len] = '\0';
-        if (strcmp(cmd_buf, "joinroom") == 0 || strcmp(cmd_buf, "leaveroom") == 0) {
-            truncate_room_log(ctx);
-            schedule_clear_room_buffer(&ctx->ui);
-        }
-
-        int rc = udp_socket_write(ctx->sd, &ctx->server_addr, request, (int)strlen(request) + 1);
-        if (rc < 0) {
-            fprintf(stderr, "sender: send failed (%s)\n", strerror(errno));
-            perror("udp_socket_write");
-            g_free(request);
-            ctx->running = 0;
-            schedule_quit();
-            break;
+        if (pfds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(ctx->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                perror("client: read wake");
+            gpointer item;
+            while (!stop && (item = g_async_queue_try_pop(send_queue)) != NULL) {
+                if (item == queue_quit_token) {
+                    stop = 1;
+                    break;
+                }
+                if (send_command(ctx, item)) {
+                    ctx->running = 0;
+                    schedule_quit();
+                    stop = 1;
+                }
+                g_free(item);
+            }
         }
 
-        if (request_is_disconnect(request)) {
-            g_free(request);
+        if (!stop && (pfds[0].revents & (POLLIN | POLLERR)) && chat_poll(&ctx->conn) < 0) {
+            fprintf(stderr, "listener: recv failed (%s)\n", strerror(errno));
             ctx->running = 0;
             schedule_quit();
-            break;
+            stop = 1;
         }
-
-        g_free(request);
     }
 
-    ctx->sender_active = 0;
+    ctx->io_active = 0;
     return NULL;
 }
 
+// Drops the flush timer and pending text once the worker threads are gone.
+static void teardown_ui(struct ui_context *ui) {
+    if (ui->flush_source)
+        g_source_remove(ui->flush_source);
+    struct ui_pane *panes[] = { &ui->global, &ui->room, &ui->priv };
+    for (size_t i = 0; i < G_N_ELEMENTS(panes); ++i) {
+        g_string_free(panes[i]->pending, TRUE);
+        g_string_free(panes[i]->spare, TRUE);
+    }
+    g_mutex_clear(&ui->pending_lock);
+}
+
 // Program entry: starts GTK + worker threads, and runs the loop.
 int main(int argc, char *argv[])
 {
@@ -430,78 +475,66 @@ int main(int argc, char *argv[])
         }
     }
 
-    int sd = udp_socket_open(client_port);
-    if (sd < 0) {
-        fprintf(stderr, "Failed to open UDP socket on port %d\n", client_port);
-        perror("udp_socket_open");
-        return EXIT_FAILURE;
-    }
-
-    fcntl(sd, F_SETFL, O_NONBLOCK);
-
-    struct sockaddr_in server_addr;
-    if (set_socket_addr(&server_addr, server_ip, SERVER_PORT) < 0) {
-        fprintf(stderr, "Invalid server IP address: %s\n", server_ip);
-        close(sd);
+    struct client_context ctx = {
+        .running = 1,
+        .io_active = 1
+    };
+    const struct chat_callbacks callbacks = { .on_message = on_chat_message };
+    // "local" attaches to a server on this host over shared memory
+    if (strcmp(server_ip, "local") == 0) {
+        if (chat_open_local(&ctx.conn, SERVER_PORT, &callbacks, &ctx) < 0) {
+            fprintf(stderr, "Failed to attach to a local server (is it running with --shm?)\n");
+            return EXIT_FAILURE;
+        }
+    } else if (chat_open(&ctx.conn, server_ip, SERVER_PORT, client_port, &callbacks, &ctx) < 0) {
+        fprintf(stderr, "Failed to open UDP socket on port %d to server %s\n", client_port, server_ip);
         return EXIT_FAILURE;
     }
 
-    FILE *global_log_fd = NULL;
-    FILE *room_log_fd = NULL;
-    FILE *priv_log_fd = NULL;
-
-    if (initialise_log_file(GLOBAL_LOG_FILE, &global_log_fd, "global") < 0) {
-        close(sd);
+    if (async_log_init(&ctx.logs) < 0) {
+        fprintf(stderr, "Failed to set up the log writer\n");
+        chat_close(&ctx.conn);
         return EXIT_FAILURE;
     }
-
-    if (initialise_log_file(ROOM_LOG_FILE, &room_log_fd, "room") < 0) {
-        fclose(global_log_fd);
-        close(sd);
+    if (initialise_log_file(&ctx.logs, LOG_GLOBAL, GLOBAL_LOG_FILE, "global") < 0 ||
+        initialise_log_file(&ctx.logs, LOG_ROOM, ROOM_LOG_FILE, "room") < 0 ||
+        initialise_log_file(&ctx.logs, LOG_PRIV, PRIV_LOG_FILE, "private") < 0 ||
+        async_log_start(&ctx.logs) < 0) {
+        async_log_stop(&ctx.logs);
+        chat_close(&ctx.conn);
         return EXIT_FAILURE;
     }
 
-    if (initialise_log_file(PRIV_LOG_FILE, &priv_log_fd, "private") < 0) {
-        fclose(global_log_fd);
-        fclose(room_log_fd);
-        close(sd);
+    ctx.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (ctx.wake_fd < 0) {
+        perror("eventfd");
+        async_log_stop(&ctx.logs);
+        chat_close(&ctx.conn);
         return EXIT_FAILURE;
     }
 
-    struct client_context ctx = {
-        .sd = sd,
-        .server_addr = server_addr,
-        .global_log_fd = global_log_fd,
-        .room_log_fd = room_log_fd,
-        .priv_log_fd = priv_log_fd,
-        .running = 1,
-        .sender_active = 1
-    };
-
     send_queue = g_async_queue_new();
     setup_ui(&ctx.ui, &ctx);
 
-    pthread_t listener, sender;
-    pthread_create(&listener, NULL, listener_thread, &ctx);
-    pthread_create(&sender, NULL, sender_thread, &ctx);
+    pthread_t io;
+    pthread_create(&io, NULL, io_thread, &ctx);
 
     gtk_main(); // enter GTK event loop until gtk_main_quit() is called
 
     ctx.running = 0;
-    if (send_queue && ctx.sender_active)
-        g_async_queue_push(send_queue, queue_quit_token);
+    if (send_queue && ctx.io_active)
+        queue_command(&ctx, queue_quit_token);
 
-    pthread_join(sender, NULL);
-    pthread_join(listener, NULL);
+    pthread_join(io, NULL);
+    teardown_ui(&ctx.ui);
 
     if (send_queue) {
         g_async_queue_unref(send_queue);
         send_queue = NULL;
     }
 
-    fclose(global_log_fd);
-    fclose(room_log_fd);
-    fclose(priv_log_fd);
-    close(sd);
+    async_log_stop(&ctx.logs);
+    close(ctx.wake_fd);
+    chat_close(&ctx.conn);
     return 0;
 }
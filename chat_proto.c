@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include "udp.h"
+#include "shm.h"
+#include "chat_proto.h"
+
+int chat_open(struct chat_conn *c, const char *server_ip, int server_port, int local_port,
+              const struct chat_callbacks *cb, void *user) {
+    if (!c) return -1;
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    if (set_socket_addr(&c->server, server_ip, server_port) < 0) return -1;
+    c->fd = udp_socket_open(local_port);
+    if (c->fd < 0) return -1;
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+    if (cb) c->cb = *cb;
+    c->user = user;
+    return 0;
+}
+
+// The epoll fd stands in for the socket: it turns readable on a wakeup
+// from the server and when the server hangs up
+int chat_open_local(struct chat_conn *c, int server_port, const struct chat_callbacks *cb, void *user) {
+    if (!c) return -1;
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    char path[108];
+    shm_socket_path(path, sizeof(path), server_port);
+    struct shm_chan *ch = malloc(sizeof(*ch));
+    if (!ch) return -1;
+    if (shm_chan_attach(ch, path) != 0) {
+        free(ch);
+        return -1;
+    }
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event wake = { .events = EPOLLIN };
+    struct epoll_event hup = { .events = EPOLLIN | EPOLLRDHUP };
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, ch->rx_fd, &wake) != 0 ||
+        epoll_ctl(ep, EPOLL_CTL_ADD, ch->sock, &hup) != 0) {
+        if (ep >= 0) close(ep);
+        shm_chan_close(ch);
+        free(ch);
+        return -1;
+    }
+    shm_chan_arm(ch);
+    c->fd = ep;
+    c->local = ch;
+    if (cb) c->cb = *cb;
+    c->user = user;
+    return 0;
+}
+
+void chat_close(struct chat_conn *c) {
+    if (!c || c->fd < 0) return;
+    close(c->fd);
+    c->fd = -1;
+    if (c->local) {
+        shm_chan_close(c->local);
+        free(c->local);
+        c->local = NULL;
+    }
+}
+
+int chat_fd(const struct chat_conn *c) {
+    return c ? c->fd : -1;
+}
+
+// Handles one "<prefix><text>" record
+static void chat_record(struct chat_conn *c, const char *rec, size_t len) {
+    enum chat_channel channel = CHAT_GLOBAL;
+    if (len > 0 && (unsigned char)rec[0] <= CHAT_PRIV) {
+        channel = (enum chat_channel)rec[0];
+        rec++;
+        len--;
+    }
+    if (len == 0) return;
+    char text[BUFFER_SIZE];
+    if (len >= sizeof(text)) len = sizeof(text) - 1;
+    memcpy(text, rec, len);
+    text[len] = '\0';
+
+    if (strcmp(text, "ping$") == 0) {
+        chat_send(c, "re-ping$");
+        if (c->cb.on_ping) c->cb.on_ping(c->user);
+        return;
+    }
+    if (c->cb.on_message) c->cb.on_message(c->user, channel, text, len);
+}
+
+// A datagram carries one or more records separated by '\n'
+void chat_feed(struct chat_conn *c, const char *buf, size_t len) {
+    const char *p = buf;
+    const char *end = buf + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *stop = nl ? nl : end;
+        // Tolerate a trailing NUL from senders that include the terminator
+        size_t rec_len = (size_t)(stop - p);
+        while (rec_len > 1 && p[rec_len - 1] == '\0') rec_len--;
+        chat_record(c, p, rec_len);
+        p = stop + 1;
+    }
+}
+
+// Drains the ring, then re-arms the wakeup and drains again if the server
+// slipped a datagram in meanwhile
+static int chat_poll_local(struct chat_conn *c) {
+    struct shm_chan *ch = c->local;
+    char probe;
+    if (recv(ch->sock, &probe, 1, MSG_DONTWAIT | MSG_PEEK) == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    shm_chan_ack(ch);
+    char buf[BUFFER_SIZE];
+    int handled = 0;
+    do {
+        int len;
+        while ((len = shm_chan_recv(ch, buf)) >= 0) {
+            chat_feed(c, buf, (size_t)len);
+            handled++;
+        }
+    } while (!shm_chan_arm(ch));
+    return handled;
+}
+
+int chat_poll(struct chat_conn *c) {
+    if (c->local) return chat_poll_local(c);
+    char bufs[CHAT_RECV_BATCH][BUFFER_SIZE];
+    struct iovec iov[CHAT_RECV_BATCH];
+    struct mmsghdr msgs[CHAT_RECV_BATCH];
+    for (int i = 0; i < CHAT_RECV_BATCH; ++i) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = BUFFER_SIZE;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int handled = 0;
+    while (1) {
+        int n = recvmmsg(c->fd, msgs, CHAT_RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return handled;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        for (int i = 0; i < n; ++i) chat_feed(c, bufs[i], msgs[i].msg_len);
+        handled += n;
+        if (n < CHAT_RECV_BATCH) return handled;
+    }
+}
+
+int chat_send(struct chat_conn *c, const char *line) {
+    if (!c || c->fd < 0 || !line) return -1;
+    size_t len = strnlen(line, BUFFER_SIZE - 1);
+    if (len > 0 && line[len - 1] == '\n') len--;
+    if (len == 0) return 0;
+    if (c->local) return shm_chan_send(c->local, line, len);
+    ssize_t rc = sendto(c->fd, line, len, 0, (struct sockaddr *)&c->server, sizeof(c->server));
+    return rc < 0 ? -1 : 0;
+}
+
+void chat_command_name(const char *line, char *out, size_t cap) {
+    if (!out || cap == 0) return;
+    size_t n = 0;
+    if (line) {
+        while (*line == ' ' || *line == '\t') line++;
+        while (line[n] && line[n] != '$' && n + 1 < cap) {
+            out[n] = line[n];
+            n++;
+        }
+    }
+    out[n] = '\0';
+}
+
+enum chat_command chat_command_kind(const char *line) {
+    char cmd[32];
+    chat_command_name(line, cmd, sizeof(cmd));
+    if (strcmp(cmd, "conn") == 0) return CHAT_CMD_CONN;
+    if (strcmp(cmd, "joinroom") == 0) return CHAT_CMD_JOINROOM;
+    if (strcmp(cmd, "leaveroom") == 0) return CHAT_CMD_LEAVEROOM;
+    if (strcmp(cmd, "createroom") == 0) return CHAT_CMD_CREATEROOM;
+    if (strcmp(cmd, "disconn") == 0) return CHAT_CMD_DISCONN;
+    return CHAT_CMD_OTHER;
+}
@@ -0,0 +1,74 @@
+#ifndef CHAT_PROTO_H
+#define CHAT_PROTO_H
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+// Client side of the chat protocol, independent of any UI. A connection is
+// a non-blocking UDP socket: callers wait for chat_fd() to become readable
+// (poll/epoll/GLib watch) and call chat_poll(), which dispatches every
+// received record through the callbacks and answers keepalive pings itself.
+// A client on the server's host may attach over shared memory instead
+// (chat_open_local, shm.h); chat_fd() and chat_poll() work the same way.
+
+#define CHAT_RECV_BATCH 16   // datagrams per recvmmsg call
+
+enum chat_channel {
+    CHAT_GLOBAL = 0x00,
+    CHAT_ROOM   = 0x01,
+    CHAT_PRIV   = 0x02
+};
+
+// Commands a client may need to react to locally before they are sent
+enum chat_command {
+    CHAT_CMD_OTHER,
+    CHAT_CMD_CONN,
+    CHAT_CMD_JOINROOM,
+    CHAT_CMD_LEAVEROOM,
+    CHAT_CMD_CREATEROOM,
+    CHAT_CMD_DISCONN
+};
+
+struct chat_callbacks {
+    // One record, without prefix or trailing newline; <text> is NUL-terminated
+    void (*on_message)(void *user, enum chat_channel channel, const char *text, size_t len);
+    // Optional: a ping$ arrived (re-ping$ has already been sent)
+    void (*on_ping)(void *user);
+};
+
+struct shm_chan;
+
+struct chat_conn {
+    int fd;                          // UDP socket, or an epoll fd over the local session
+    struct sockaddr_in server;
+    struct shm_chan *local;          // NULL for UDP
+    struct chat_callbacks cb;
+    void *user;
+};
+
+// Opens a non-blocking socket bound to <local_port> (0 = any) that talks to
+// <server_ip>:<server_port>. Returns 0, or -1 on a bad address or socket error.
+int chat_open(struct chat_conn *c, const char *server_ip, int server_port, int local_port,
+              const struct chat_callbacks *cb, void *user);
+// Attaches to the server on <server_port> of this host over shared memory.
+// Returns 0, or -1 when the server is not running with --shm.
+int chat_open_local(struct chat_conn *c, int server_port, const struct chat_callbacks *cb, void *user);
+void chat_close(struct chat_conn *c);
+int chat_fd(const struct chat_conn *c);
+
+// Drains every queued datagram. Returns the number of datagrams handled, or
+// -1 on a socket error or when a local server hung up (errno set). Never blocks.
+int chat_poll(struct chat_conn *c);
+
+// Splits one datagram into records and dispatches them; chat_poll uses this
+// and callers with their own receive path can too.
+void chat_feed(struct chat_conn *c, const char *buf, size_t len);
+
+// Sends one command line (a trailing newline is dropped). Returns 0 or -1.
+int chat_send(struct chat_conn *c, const char *line);
+
+// Command inspection: copies the word before '$' into <out>, and classifies it
+void chat_command_name(const char *line, char *out, size_t cap);
+enum chat_command chat_command_kind(const char *line);
+
+#endif // CHAT_PROTO_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "udp.h"
 #include "chat_server.h"
 #include <stdio.h>
@@ -8,7 +9,27 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
 #include "circular_queue.h"
+#include "snapshot.h"
+#include "handoff.h"
+#include "federation.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "workqueue.h"
+#include "uring_io.h"
+#include "mailbox.h"
+#include "pool.h"
+#include "intern.h"
+#include "fanout.h"
+#include "coalesce.h"
+#include "shm.h"
 
 #define MSG_GLOBAL 0x00
 #define MSG_ROOM   0x01
@@ -18,98 +39,268 @@
 #define PING_TIMEOUT 10
 #define PING_MONITOR_SLEEP_USEC 500000
 
+// Admission control: the listener sheds by class as the request queue fills
+// or as requests start waiting too long for a worker
+#define WORKERS_PER_CPU 2
+#define MIN_WORKERS 4
+#define BUSY_DEPTH_PERCENT 50        // shed chat, refuse new conn$
+#define OVERLOAD_DEPTH_PERCENT 85    // admit control traffic only
+#define OVERLOAD_WAIT_NS 100000000ull
+#define OVERLOAD_MIN_DEPTH 64        // queue wait alone never sheds a short queue
+#define OVERLOAD_RETRY_SEC 5
+
+#define REACTOR_BATCH 32             // datagrams per recvmmsg / mailbox drain
+
 struct listener_args {
     int sd;
     struct server_state *state;
+    pthread_t listener;
+    int wake_fd[2];      // written to stop a listener blocked in poll()
+    atomic_int stop;
+};
+
+// Reactor mode: each shard owns the clients that hash to it, with its own
+// socket, server_state, rate limiter, name table, snapshot and thread.
+// Shards only talk through mailboxes.
+struct shard {
+    int index;
+    int sd;
+    struct server_state state;
+    struct federation fed;           // in-process federation with the other shards
+    struct mailbox inbox;
+    struct listener_args args;       // for the shard's ping monitor
+    struct ratelimit limiter;
+    struct intern_table names;
+    char snapshot_path[64];
+    struct snapshot_args snapshot;
+    pthread_t thread;
 };
 
+
+static struct shard *shards;
+static int shard_count;
+
+static atomic_int inflight_requests;
+static struct ratelimit limiter;
+static __thread struct ratelimit *shard_limiter;    // set on reactor threads
+static struct work_queue request_queue;
+static int use_uring = 0;
+static __thread struct uring_send *send_batch;  // set on workers in io_uring mode
+static int ratelimit_enabled = 1;
+static size_t fanout_threshold = FANOUT_THRESHOLD;  // --fanout-threshold; 0 never splits
+static int worker_count;             // fan-out helpers exist only with a worker pool
+static int use_shm = 0;              // --shm: serve local clients over shared memory
+static struct shm_server shm_server;
+static __thread uint64_t lock_acquired_ns;
+
+// rwlock wrappers feeding the lock wait/hold histograms
+static void state_rdlock(struct server_state *s) {
+    uint64_t start = metrics_now_ns();
+    pthread_rwlock_rdlock(&s->rwlock);
+    lock_acquired_ns = metrics_now_ns();
+    metrics_record(METRIC_LOCK_WAIT, lock_acquired_ns - start);
+}
+
+static void state_wrlock(struct server_state *s) {
+    uint64_t start = metrics_now_ns();
+    pthread_rwlock_wrlock(&s->rwlock);
+    lock_acquired_ns = metrics_now_ns();
+    metrics_record(METRIC_LOCK_WAIT, lock_acquired_ns - start);
+}
+
+static void state_unlock(struct server_state *s) {
+    metrics_record(METRIC_LOCK_HOLD, metrics_now_ns() - lock_acquired_ns);
+    pthread_rwlock_unlock(&s->rwlock);
+}
+
+// Linear scan over the client table; caller holds the state lock
+static struct client_node *lookup_client_addr(struct server_state *s, const struct sockaddr_in *addr) {
+    for (size_t i = 0; i < s->clients.high; ++i) {
+        struct client_node *cur = client_table_at(&s->clients, i);
+        if (cur->live && cur->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            cur->addr.sin_port == addr->sin_port)
+            return cur;
+    }
+    return NULL;
+}
+
 static void update_client_activity(struct server_state *state, const struct sockaddr_in *addr) {
     if (!state || !addr) return;
-    pthread_rwlock_wrlock(&state->rwlock);
-    struct client_node *cur = state->head;
-    while (cur) {
-        if (cur->addr.sin_addr.s_addr == addr->sin_addr.s_addr && cur->addr.sin_port == addr->sin_port) {
-            cur->last_active = time(NULL);
-            cur->waiting_ping = 0;
-            activity_heap_update(&state->activity, cur);
-            break;
-        }
-        cur = cur->next;
+    state_wrlock(state);
+    struct client_node *cur = lookup_client_addr(state, addr);
+    if (cur) {
+        cur->last_active = time(NULL);
+        if (cur->waiting_ping) metrics_record(METRIC_KEEPALIVE, metrics_now_ns() - cur->ping_sent_ns);
+        cur->waiting_ping = 0;
+        activity_heap_update(&state->activity, cur);
     }
-    pthread_rwlock_unlock(&state->rwlock);
+    state_unlock(state);
 }
 
-static int room_add_member(struct chat_room *room, struct client_node *client) {
-    if (!room || !client) return -1;
-    struct room_member *cur = room->members;
-    while (cur) {
-        if (cur->client == client) return 0;
-        cur = cur->next;
+// Leaves <room>, dropping the room once its last local member is gone;
+// caller holds the write lock
+static void leave_room(struct server_state *state, struct client_node *client,
+                       struct chat_room *room) {
+    if (room_leave(room, client) != 0 || room->member_count > 0) return;
+    if (state->fed) fed_local_room(state->fed, room->name, 0);
+    room_table_remove(&state->rooms, room->name);
+}
+
+static void leave_all_rooms(struct server_state *state, struct client_node *client) {
+    while (client->rooms) leave_room(state, client, client->rooms->room);
+}
+
+// Writes one datagram to a client and accounts for it
+// Submits the calling worker's queued sends with a single io_uring_enter
+static void flush_send_batch(void) {
+    if (!send_batch) return;
+    uint64_t bytes;
+    int sent = uring_send_flush(send_batch, &bytes);
+    if (sent < 0) {
+        // In-flight slots may still be read by the kernel: abandon the batch
+        perror("io_uring send");
+        send_batch = NULL;
+        return;
     }
-    struct room_member *node = malloc(sizeof(*node));
-    if (!node) return -1;
-    node->client = client;
-    node->next = room->members;
-    room->members = node;
-    client->room = room;
-    return 0;
+    metrics_count(METRIC_PACKETS_OUT, (uint64_t)sent);
+    metrics_count(METRIC_BYTES_OUT, bytes);
 }
 
-static void room_remove_member(struct chat_room *room, struct client_node *client) {
-    if (!room || !client) return;
-    struct room_member **ind = &room->members;
-    while (*ind) {
-        if ((*ind)->client == client) {
-            struct room_member *del = *ind;
-            *ind = del->next;
-            free(del);
-            break;
+// Local clients (shm.h) have rings instead of a UDP address; a full ring
+// drops the datagram, as a full socket buffer would
+static void send_local(const struct sockaddr_in *addr, const char *buf, size_t len) {
+    if (use_shm && shm_server_send(&shm_server, addr, buf, len) == 0) {
+        metrics_count(METRIC_PACKETS_OUT, 1);
+        metrics_count(METRIC_BYTES_OUT, len);
+    }
+}
+
+static void send_datagram(int sd, const struct sockaddr_in *addr, char *buf, size_t len) {
+    if (shm_addr_is_local(addr)) {
+        send_local(addr, buf, len);
+        return;
+    }
+    if (send_batch) {
+        if (uring_send_queue(send_batch, sd, addr, buf, len) != 0) {
+            flush_send_batch();
+            if (send_batch) uring_send_queue(send_batch, sd, addr, buf, len);
         }
-        ind = &(*ind)->next;
+        if (send_batch) return;
+    }
+    if (udp_socket_write(sd, (struct sockaddr_in *)addr, buf, (int)len) >= 0) {
+        metrics_count(METRIC_PACKETS_OUT, 1);
+        metrics_count(METRIC_BYTES_OUT, len);
     }
 }
 
-static void detach_client_from_room(struct server_state *state, struct client_node *client) {
-    if (!state || !client || !client->room) return;
-    struct chat_room *room = client->room;
-    room_remove_member(room, client);
-    client->room = NULL;
-    if (!room->members) {
-        room_table_remove(&state->rooms, room->name);
+// Bypasses the io_uring batch: the coalescer sends under a per-client lock
+// and must not let a later datagram overtake one still sitting in a batch
+static void send_now(int sd, const struct sockaddr_in *addr, char *buf, size_t len) {
+    if (shm_addr_is_local(addr)) {
+        send_local(addr, buf, len);
+        return;
+    }
+    if (udp_socket_write(sd, (struct sockaddr_in *)addr, buf, (int)len) >= 0) {
+        metrics_count(METRIC_PACKETS_OUT, 1);
+        metrics_count(METRIC_BYTES_OUT, len);
     }
 }
 
-static void send_global(int sd, const struct sockaddr_in *addr, const char *msg) {
+// Formats one <prefix><msg>\n record into <out>; returns its length. Long
+// messages are cut so the prefix, '\n' and NUL still fit.
+static size_t make_record(char out[BUFFER_SIZE], char prefix, const char *msg) {
+    out[0] = prefix;
+    size_t len = strlen(msg);
+    if (len > BUFFER_SIZE-3) len = BUFFER_SIZE-3;
+    memcpy(out+1, msg, len);
+    out[len+1] = '\n';
+    out[len+2] = '\0';
+    return len+2;
+}
+
+// Direct sends flush the recipient's coalescing buffer first, so a reply
+// never overtakes records buffered before it
+static void send_prefixed(int sd, const struct sockaddr_in *addr, char prefix, const char *msg) {
     if (!addr || !msg) return;
     char prefixed[BUFFER_SIZE];
-    prefixed[0] = MSG_GLOBAL;
-    size_t len = strnlen(msg, BUFFER_SIZE-2);
-    memcpy(prefixed+1, msg, len);
-    prefixed[len+1] = '\n';
-    prefixed[len+2] = '\0';
-    udp_socket_write(sd, (struct sockaddr_in*)addr, prefixed, (int)(len+2));
+    size_t len = make_record(prefixed, prefix, msg);
+    coalesce_flush_addr(addr);
+    send_datagram(sd, addr, prefixed, len);
+}
+
+static void send_global(int sd, const struct sockaddr_in *addr, const char *msg) {
+    send_prefixed(sd, addr, MSG_GLOBAL, msg);
 }
 
 static void send_room(int sd, const struct sockaddr_in *addr, const char *msg) {
-    if (!addr || !msg) return;
-    char prefixed[BUFFER_SIZE];
-    prefixed[0] = MSG_ROOM;
-    size_t len = strnlen(msg, BUFFER_SIZE-2);
-    memcpy(prefixed+1, msg, len);
-    prefixed[len+1] = '\n';
-    prefixed[len+2] = '\0';
-    udp_socket_write(sd, (struct sockaddr_in*)addr, prefixed, (int)(len+2));
+    send_prefixed(sd, addr, MSG_ROOM, msg);
 }
 
 static void send_private(int sd, const struct sockaddr_in *addr, const char *msg) {
-    if (!addr || !msg) return;
-    char prefixed[BUFFER_SIZE];
-    prefixed[0] = MSG_PRIV;
-    size_t len = strnlen(msg, BUFFER_SIZE-2);
-    memcpy(prefixed+1, msg, len);
-    prefixed[len+1] = '\n';
-    prefixed[len+2] = '\0';
-    udp_socket_write(sd, (struct sockaddr_in*)addr, prefixed, (int)(len+2));
+    send_prefixed(sd, addr, MSG_PRIV, msg);
+}
+
+// One record going to many clients: either <list> or, when it is NULL,
+// every live client in <clients>
+struct broadcast {
+    int sd;
+    const char *sender_name;         // whose mutes apply; NULL for server notices
+    struct client_node **list;
+    struct client_table *clients;
+    char record[BUFFER_SIZE];
+    size_t len;
+};
+
+// fanout_visit_fn: sends to recipients [begin, end), batched with io_uring
+// or sendmmsg. Runs on the broadcasting thread and on fan-out helpers.
+static uint64_t broadcast_chunk(void *ctx, size_t begin, size_t end) {
+    struct broadcast *b = ctx;
+    struct fanout_batch batch;
+    if (!send_batch) fanout_batch_init(&batch, b->sd, b->record, b->len);
+    uint64_t sent = 0;
+    for (size_t i = begin; i < end; ++i) {
+        struct client_node *c = b->list ? b->list[i] : client_table_at(b->clients, i);
+        if (!c->live || is_muted_for_receiver(c, b->sender_name)) continue;
+        if (c->coalescing) coalesce_add(c->cold->coalesce, b->sd, b->record, b->len);
+        else if (send_batch || shm_addr_is_local(&c->addr)) send_datagram(b->sd, &c->addr, b->record, b->len);
+        else fanout_batch_add(&batch, &c->addr);
+        sent++;
+    }
+    if (!send_batch) {
+        fanout_batch_flush(&batch);
+        metrics_count(METRIC_PACKETS_OUT, batch.packets);
+        metrics_count(METRIC_BYTES_OUT, batch.packets * b->len);
+    }
+    return sent;
+}
+
+static uint64_t fan_out(fanout_visit_fn visit, void *ctx, size_t total);
+
+// Sends <b> to its first <total> recipients, split across workers when
+// large; caller holds the state lock until this returns
+static void broadcast(struct broadcast *b, size_t total) {
+    metrics_record(METRIC_FANOUT, fan_out(broadcast_chunk, b, total));
+}
+
+// Records a room message and sends it to local members; caller holds the write lock
+static void deliver_room(int sd, struct chat_room *room,
+                         const char *sender_name, const char *formatted) {
+    enqueue(&room->history, formatted);
+    history_append(&room->log, formatted);
+    struct broadcast b = { .sd = sd, .sender_name = sender_name, .list = room->members };
+    b.len = make_record(b.record, MSG_ROOM, formatted);
+    broadcast(&b, room->member_count);
+}
+
+// Sends a publication to local subscribers of <topic> (an interned
+// handle); caller holds the write lock, which also guards the fan-out cache
+static void deliver_topic(struct server_state *state, int sd, const char *topic,
+                          const char *sender_name, const char *formatted) {
+    uint32_t count;
+    struct client_node **subscribers = topic_resolve(&state->topics, topic, &count);
+    struct broadcast b = { .sd = sd, .sender_name = sender_name, .list = subscribers };
+    b.len = make_record(b.record, MSG_ROOM, formatted);
+    broadcast(&b, count);
 }
 
 static void *ping_monitor_thread(void *arg) {
@@ -123,29 +314,27 @@ static void *ping_monitor_thread(void *arg) {
         char target_name[MAX_NAME_LEN] = {0};
         useconds_t sleep_us = PING_MONITOR_SLEEP_USEC;
 
-        pthread_rwlock_wrlock(&state->rwlock);
+        state_wrlock(state);
         struct client_node *oldest = activity_heap_peek(&state->activity);
         if (oldest) {
             time_t now = time(NULL);
             time_t idle = now - oldest->last_active;
             if (idle >= INACTIVITY_THRESHOLD) {
+                uint64_t pinged_ns = metrics_now_ns() - oldest->ping_sent_ns;
                 if (!oldest->waiting_ping) {
                     oldest->waiting_ping = 1;
-                    oldest->last_ping_sent = now;
+                    oldest->ping_sent_ns = metrics_now_ns();
                     target_addr = oldest->addr;
                     action = 1;
                     sleep_us = PING_MONITOR_SLEEP_USEC;
-                } else if (now - oldest->last_ping_sent >= PING_TIMEOUT) {
+                } else if (pinged_ns >= PING_TIMEOUT * 1000000000ull) {
                     target_addr = oldest->addr;
-                    strncpy(target_name, oldest->name, MAX_NAME_LEN);
+                    strncpy(target_name, oldest->cold->name, MAX_NAME_LEN);
                     target_name[MAX_NAME_LEN - 1] = '\0';
                     action = 2;
                     sleep_us = PING_MONITOR_SLEEP_USEC;
                 } else {
-                    time_t wait = (oldest->last_ping_sent + PING_TIMEOUT) - now;
-                    if (wait > 0) {
-                        sleep_us = (useconds_t)(wait * 1000000L);
-                    }
+                    sleep_us = (useconds_t)((PING_TIMEOUT * 1000000000ull - pinged_ns) / 1000);
                 }
             } else {
                 time_t wait = INACTIVITY_THRESHOLD - idle;
@@ -159,7 +348,7 @@ static void *ping_monitor_thread(void *arg) {
         } else {
             sleep_us = PING_MONITOR_SLEEP_USEC;
         }
-        pthread_rwlock_unlock(&state->rwlock);
+        state_unlock(state);
 
         if (action == 1) {
             send_global(sd, &target_addr, "ping$");
@@ -180,196 +369,141 @@ static void *ping_monitor_thread(void *arg) {
 }
 
 void init_server_state(struct server_state *s) {
-    s->head = NULL;
+    client_table_init(&s->clients);
+    s->fed = NULL;
     queue_init(&s->msg_queue);
+    history_init(&s->global_log);
     pthread_rwlock_init(&s->rwlock, NULL);
     activity_heap_init(&s->activity);
     room_table_init(&s->rooms);
+    topic_tree_init(&s->topics);
 }
 
 void destroy_server_state(struct server_state *s) {
-    pthread_rwlock_wrlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        struct client_node *next = cur->next;
-        free(cur);
-        cur = next;
-    }
-    s->head = NULL;
-    pthread_rwlock_unlock(&s->rwlock);
+    state_wrlock(s);
+    client_table_destroy(&s->clients);
+    state_unlock(s);
     pthread_rwlock_destroy(&s->rwlock);
     activity_heap_destroy(&s->activity);
     room_table_destroy(&s->rooms);
+    topic_tree_destroy(&s->topics);
+    history_destroy(&s->global_log);
 }
 
 struct client_node *find_client_by_name(struct server_state *s, const char *name) {
-    struct client_node *result = NULL;
-    pthread_rwlock_rdlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (strncmp(cur->name, name, MAX_NAME_LEN) == 0) {
-            result = cur;
-            break;
-        }
-        cur = cur->next;
-    }
-    pthread_rwlock_unlock(&s->rwlock);
+    state_rdlock(s);
+    struct client_node *result = client_table_find(&s->clients, name);
+    state_unlock(s);
     return result;
 }
 
 struct client_node *find_client_by_addr(struct server_state *s, const struct sockaddr_in *addr){
-    struct client_node *result = NULL;
-    pthread_rwlock_rdlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (cur->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
-            cur->addr.sin_port == addr->sin_port) {
-            result = cur;
-            break;
-        }
-        cur = cur->next;
-    }
-    pthread_rwlock_unlock(&s->rwlock);
+    state_rdlock(s);
+    struct client_node *result = lookup_client_addr(s, addr);
+    state_unlock(s);
     return result;
 }
 
+// Name of the client at <addr>, referenced while the state is locked so the
+// handle keeps naming that client after the lock is dropped even if it is
+// evicted meanwhile. NULL when <addr> is not connected; release it after use.
+static const char *sender_name_ref(struct server_state *s, const struct sockaddr_in *addr) {
+    state_rdlock(s);
+    struct client_node *c = lookup_client_addr(s, addr);
+    const char *name = c ? intern_ref(c->cold->name) : NULL;
+    state_unlock(s);
+    return name;
+}
+
 int add_client(struct server_state *s, const struct sockaddr_in *addr, const char *name) {
-    if (!name || name[0] == '\0') return -1;
-    pthread_rwlock_wrlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (strncmp(cur->name, name, MAX_NAME_LEN) == 0) {
-            pthread_rwlock_unlock(&s->rwlock);
-            return -1;
-        }
-        cur = cur->next;
+    if (!name) return -1;
+    if (s->fed && fed_dir_get(&s->fed->users, name, NULL) == 0) return -1;
+    state_wrlock(s);
+    if (client_table_find(&s->clients, name)) {
+        state_unlock(s);
+        return -1;
     }
-    struct client_node *node = calloc(1, sizeof(*node));
+    struct client_node *node = client_table_alloc(&s->clients);
     if (!node) {
-        pthread_rwlock_unlock(&s->rwlock);
+        state_unlock(s);
         return -1;
     }
-    strncpy(node->name, name, MAX_NAME_LEN - 1);
-    node->name[MAX_NAME_LEN - 1] = '\0';
     memcpy(&node->addr, addr, sizeof(*addr));
-    node->muted_count = 0;
     node->last_active = time(NULL);
-    node->last_ping_sent = 0;
-    node->waiting_ping = 0;
-    node->heap_index = -1;
-    node->room = NULL;
-    node->next = s->head;
-    s->head = node;
-    if (activity_heap_push(&s->activity, node) != 0) {
-        s->head = node->next;
-        free(node);
-        pthread_rwlock_unlock(&s->rwlock);
+    if (client_table_set_name(&s->clients, node, name) != 0 ||
+        activity_heap_push(&s->activity, node) != 0) {
+        client_table_free(&s->clients, node);
+        state_unlock(s);
         return -1;
     }
-    pthread_rwlock_unlock(&s->rwlock);
+    state_unlock(s);
+    if (s->fed) fed_send_all(s->fed, FED_OP_USER_ON, name, NULL, NULL);
     return 0;
 }
 
+// Unlinks <del> from its rooms, topics, the activity heap and the table;
+// caller holds the write lock
+static void drop_client(struct server_state *s, struct client_node *del) {
+    leave_all_rooms(s, del);
+    topic_unsubscribe_all(&s->topics, del);
+    coalesce_close(del->cold->coalesce);
+    activity_heap_remove(&s->activity, del);
+    if (s->fed) fed_send_all(s->fed, FED_OP_USER_OFF, del->cold->name, NULL, NULL);
+    client_table_free(&s->clients, del);
+}
+
 int remove_client_by_name(struct server_state *s, const char *name) {
-    pthread_rwlock_wrlock(&s->rwlock);
-    struct client_node **ind = &s->head;
-    while (*ind) {
-        if (strncmp((*ind)->name, name, MAX_NAME_LEN) == 0) {
-            struct client_node *del = *ind;
-            *ind = del->next;
-            detach_client_from_room(s, del);
-            activity_heap_remove(&s->activity, del);
-            free(del);
-            pthread_rwlock_unlock(&s->rwlock);
-            return 0;
-        }
-        ind = &(*ind)->next;
-    }
-    pthread_rwlock_unlock(&s->rwlock);
-    return -1;
+    state_wrlock(s);
+    struct client_node *del = client_table_find(&s->clients, name);
+    if (del) drop_client(s, del);
+    state_unlock(s);
+    return del ? 0 : -1;
 }
 
 int remove_client_by_addr(struct server_state *s, const struct sockaddr_in *addr) {
     if (!addr) return -1;
-    pthread_rwlock_wrlock(&s->rwlock);
-    struct client_node **ind = &s->head;
-    while (*ind) {
-        if ((*ind)->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
-            (*ind)->addr.sin_port == addr->sin_port)
-        {
-            struct client_node *del = *ind;
-            *ind = del->next;
-            detach_client_from_room(s, del);
-            activity_heap_remove(&s->activity, del);
-            free(del);
-            pthread_rwlock_unlock(&s->rwlock);
-            return 0;
-        }
-        ind = &(*ind)->next;
-    }
-    pthread_rwlock_unlock(&s->rwlock);
-    return -1; 
+    state_wrlock(s);
+    struct client_node *del = lookup_client_addr(s, addr);
+    if (del) drop_client(s, del);
+    state_unlock(s);
+    return del ? 0 : -1;
 }
 
 int rename_client(struct server_state *s, const struct sockaddr_in *addr, const char *newname) {
-    if (!addr || !newname || newname[0] == '\0') return -1;
-    pthread_rwlock_wrlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (strncmp(cur->name, newname, MAX_NAME_LEN) == 0) {
-            pthread_rwlock_unlock(&s->rwlock);
-            return -1;
-        }
-        cur = cur->next;
+    if (!addr || !newname) return -1;
+    if (s->fed && fed_dir_get(&s->fed->users, newname, NULL) == 0) return -1;
+    state_wrlock(s);
+    struct client_node *cur = client_table_find(&s->clients, newname) ? NULL : lookup_client_addr(s, addr);
+    const char *old = cur ? intern_ref(cur->cold->name) : NULL;
+    if (cur && client_table_set_name(&s->clients, cur, newname) != 0) cur = NULL;
+    if (cur && s->fed) {
+        fed_send_all(s->fed, FED_OP_USER_OFF, old, NULL, NULL);
+        fed_send_all(s->fed, FED_OP_USER_ON, newname, NULL, NULL);
     }
-    cur = s->head;
-    while (cur) {
-        if (cur->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
-            cur->addr.sin_port == addr->sin_port)
-        {
-            strncpy(cur->name, newname, MAX_NAME_LEN - 1);
-            cur->name[MAX_NAME_LEN - 1] = '\0';
-            pthread_rwlock_unlock(&s->rwlock);
-            return 0; 
-        }
-        cur = cur->next;
-    }
-    pthread_rwlock_unlock(&s->rwlock);
-    return -1;
+    state_unlock(s);
+    intern_release(old);
+    return cur ? 0 : -1;
 }
 
 int add_muted_for_client(struct server_state *s, const char *requester, const char *muted_name) {
     if (!requester || !muted_name) return -1;
-    pthread_rwlock_wrlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (strncmp(cur->name, requester, MAX_NAME_LEN) == 0) {
-            for (int i = 0; i < cur->muted_count; ++i) {
-                if (strncmp(cur->muted[i], muted_name, MAX_NAME_LEN) == 0) {
-                    pthread_rwlock_unlock(&s->rwlock);
-                    return -1; 
-                }
-            }
-            if (cur->muted_count >= MAX_MUTED) {
-                pthread_rwlock_unlock(&s->rwlock);
-                return -1;
-            }
-            strncpy(cur->muted[cur->muted_count], muted_name, MAX_NAME_LEN - 1);
-            cur->muted[cur->muted_count][MAX_NAME_LEN - 1] = '\0';
-            cur->muted_count++;
-            pthread_rwlock_unlock(&s->rwlock);
-            return 0;
-        }
-        cur = cur->next;
+    state_wrlock(s);
+    struct client_node *cur = client_table_find(&s->clients, requester);
+    if (!cur || cur->muted_count >= MAX_MUTED || is_muted_for_receiver(cur, muted_name)) {
+        state_unlock(s);
+        return -1;
     }
-    pthread_rwlock_unlock(&s->rwlock);
-    return -1; 
+    cur->cold->muted[cur->muted_count++] = intern_ref(muted_name);
+    state_unlock(s);
+    return 0;
 }
 
+// Only clients that muted someone pay for touching their cold record;
+// names are interned, so the check is a pointer comparison
 int is_muted_for_receiver(struct client_node *receiver, const char *sender_name) {
     if (!receiver || !sender_name) return 0;
     for (int i = 0; i < receiver->muted_count; ++i) {
-        if (strncmp(receiver->muted[i], sender_name, MAX_NAME_LEN) == 0) {
+        if (receiver->cold->muted[i] == sender_name) {
             return 1; 
         }
     }
@@ -377,37 +511,27 @@ int is_muted_for_receiver(struct client_node *receiver, const char *sender_name)
 }
 
 void say_message(struct server_state *s, int sd, const char *msg, const char *sender_name) {
-    pthread_rwlock_rdlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (sender_name && is_muted_for_receiver(cur, sender_name)) {
-            cur = cur->next;
-            continue;
-        }
-        send_global(sd, &cur->addr, msg);
-        cur = cur->next;
-    }
-    pthread_rwlock_unlock(&s->rwlock);
+    struct broadcast b = { .sd = sd, .sender_name = sender_name, .clients = &s->clients };
+    b.len = make_record(b.record, MSG_GLOBAL, msg);
+    state_rdlock(s);
+    broadcast(&b, s->clients.high);
+    state_unlock(s);
 }
 
 int say_to(struct server_state*s, int sd, const char *msg, const char *recipient_name, const char *sender_name){
-    if (!recipient_name || !msg || !sender_name) return -1; 
-    pthread_rwlock_rdlock(&s->rwlock);
-    struct client_node *cur = s->head;
-    while (cur) {
-        if (strcmp(cur->name, recipient_name) == 0){
-            if (is_muted_for_receiver(cur, sender_name)) {
-                pthread_rwlock_unlock(&s->rwlock);
-                return 0; 
-            }
+    if (!recipient_name || !msg) return -1; 
+    state_rdlock(s);
+    struct client_node *cur = client_table_find(&s->clients, recipient_name);
+    if (cur && !is_muted_for_receiver(cur, sender_name)) {
+        if (cur->coalescing) {
+            char record[BUFFER_SIZE];
+            coalesce_add(cur->cold->coalesce, sd, record, make_record(record, MSG_PRIV, msg));
+        } else {
             send_private(sd, &cur->addr, msg);
-            pthread_rwlock_unlock(&s->rwlock);
-            return 0;
         }
-        cur=cur->next;
     }
-    pthread_rwlock_unlock(&s->rwlock);
-    return -1;
+    state_unlock(s);
+    return cur ? 0 : -1;
 }
 
 struct request {
@@ -415,9 +539,40 @@ struct request {
     struct sockaddr_in src;
     char buf[BUFFER_SIZE];
     int len;
+    char cmd[16];        // command word, peeked by the listener for admission
     struct server_state *state;
+    struct fanout_job *fanout;   // set on fan-out helper requests only
 };
 
+static struct pool request_pool = POOL_INITIALIZER("request", struct request);
+
+// Splits a broadcast of <total> recipients into chunks once it reaches the
+// threshold and queues helpers on the control lane, so idle workers pick
+// them up ahead of chat; the calling worker claims chunks as well and
+// returns when every chunk has been sent
+static uint64_t fan_out(fanout_visit_fn visit, void *ctx, size_t total) {
+    if (fanout_threshold == 0 || total < fanout_threshold || worker_count < 2)
+        return visit(ctx, 0, total);
+    struct fanout_job *job = fanout_job_create(visit, ctx, total, FANOUT_CHUNK);
+    if (!job) return visit(ctx, 0, total);
+    size_t helpers = (total - 1) / FANOUT_CHUNK;
+    if (helpers > (size_t)worker_count - 1) helpers = (size_t)worker_count - 1;
+    if (helpers > FANOUT_MAX_HELPERS) helpers = FANOUT_MAX_HELPERS;
+    for (size_t i = 0; i < helpers; ++i) {
+        struct request *req = pool_alloc(&request_pool);
+        if (!req) break;
+        req->fanout = fanout_job_ref(job);
+        if (work_queue_push(&request_queue, WORK_LANE_CONTROL, req) != 0) {
+            fanout_job_release(job);
+            pool_free(&request_pool, req);
+            break;
+        }
+    }
+    uint64_t sent = fanout_wait(job);
+    fanout_job_release(job);
+    return sent;
+}
+
 static void ensure_null_terminated(char *buf, int n) {
     if (n < 0) return;
     if (n < BUFFER_SIZE) buf[n] = '\0';
@@ -430,32 +585,228 @@ static char *skip_spaces(char *s){
     return s;
 }
 
-static void handle_request(struct request *req) {
-    ensure_null_terminated(req->buf, req->len);
-    char *p = skip_spaces(req->buf);
-    char *dollar = strchr(p, '$');
-    if (!dollar) return;
-    *dollar = '\0';
-    char *cmd = p;
-    char *args = skip_spaces(dollar + 1);
+// Packs reply records into datagrams of at most BUFFER_SIZE - 1 bytes
+struct reply_stream {
+    int sd;
+    const struct sockaddr_in *addr;
+    char prefix;
+    char buf[BUFFER_SIZE];
+    size_t len;
+    uint64_t first_seq;
+};
+
+static void reply_stream_flush(struct reply_stream *st) {
+    if (st->len == 0) return;
+    coalesce_flush_addr(st->addr);
+    send_datagram(st->sd, st->addr, st->buf, st->len);
+    st->len = 0;
+}
+
+// Appends one "<prefix><text>\n" record, flushing first if it would not fit
+static void reply_stream_add(struct reply_stream *st, const char *text) {
+    char record[BUFFER_SIZE];
+    record[0] = st->prefix;
+    size_t len = strnlen(text, sizeof(record) - 3);
+    memcpy(record + 1, text, len);
+    len++;
+    record[len++] = '\n';
+    if (st->len + len > BUFFER_SIZE - 1) reply_stream_flush(st);
+    memcpy(st->buf + st->len, record, len);
+    st->len += len;
+}
+
+static void history_stream_visit(uint64_t seq, const char *msg, void *user) {
+    struct reply_stream *st = user;
+    char line[BUFFER_SIZE];
+    snprintf(line, sizeof(line), "#%llu %s", (unsigned long long)seq, msg);
+    reply_stream_add(st, line);
+    if (st->first_seq == 0) st->first_seq = seq;
+}
+
+static void stats_stream_emit(const char *line, void *user) {
+    reply_stream_add(user, line);
+}
+
+static void count_state(struct server_state *state, struct metrics_gauges *g) {
+    state_rdlock(state);
+    g->clients += state->clients.count;
+    g->heap_size += state->activity.size;
+    for (int i = 0; i < ROOM_BUCKETS; ++i)
+        for (struct chat_room *r = state->rooms.buckets[i]; r; r = r->next) g->rooms++;
+    state_unlock(state);
+}
+
+// Samples the gauges reported next to the counters (summed over every
+// shard in reactor mode)
+static void collect_gauges(struct server_state *state, struct metrics_gauges *g) {
+    memset(g, 0, sizeof(*g));
+    if (shard_count > 0) {
+        for (int i = 0; i < shard_count; ++i) count_state(&shards[i].state, g);
+        g->shards = shard_count;
+    } else {
+        count_state(state, g);
+    }
+    g->queue_depth = work_queue_depth(&request_queue, WORK_LANE_BULK);
+    g->queue_wait_ewma_ns = work_queue_wait_ewma(&request_queue, WORK_LANE_BULK);
+    g->control_depth = work_queue_depth(&request_queue, WORK_LANE_CONTROL);
+    g->control_wait_ewma_ns = work_queue_wait_ewma(&request_queue, WORK_LANE_CONTROL);
+}
+
+// Announces our users and room views to <node> (-1 = every peer)
+static void federation_sync(struct server_state *state, int node) {
+    struct federation *fed = state->fed;
+    state_rdlock(state);
+    for (size_t i = 0; i < state->clients.high; ++i) {
+        struct client_node *c = client_table_at(&state->clients, i);
+        if (!c->live) continue;
+        if (node < 0) fed_send_all(fed, FED_OP_USER_ON, c->cold->name, NULL, NULL);
+        else fed_send(fed, node, FED_OP_USER_ON, c->cold->name, NULL, NULL);
+    }
+    for (int i = 0; i < ROOM_BUCKETS; ++i) {
+        for (struct chat_room *r = state->rooms.buckets[i]; r; r = r->next) {
+            if (node < 0 || fed_room_owner(fed, r->name) == node)
+                fed_local_room(fed, r->name, 1);
+        }
+    }
+    state_unlock(state);
+    if (node >= 0) fed_announce_rooms(fed, node);
+}
+
+// Applies a batch of forwarded operations from a peer node
+static void handle_federation(struct request *req, char *body) {
+    struct server_state *state = req->state;
+    struct federation *fed = state->fed;
+    if (!fed) return;
+    int node = fed_node_by_addr(fed, &req->src);
+    if (node < 0) return;
+
+    struct fed_msg m;
+    while (fed_next(&body, &m) == 0) {
+        if (m.fields != FED_FIELDS) continue;
+        switch (m.op) {
+        case FED_OP_HELLO:
+            federation_sync(state, node);
+            break;
+        case FED_OP_USER_ON:
+            fed_dir_set(&fed->users, m.a, (uint32_t)node);
+            break;
+        case FED_OP_USER_OFF: {
+            uint32_t home;
+            if (fed_dir_get(&fed->users, m.a, &home) == 0 && home == (uint32_t)node)
+                fed_dir_del(&fed->users, m.a);
+            break;
+        }
+        case FED_OP_SAY: {
+            // A name nobody here holds cannot be muted by anyone here
+            const char *sender = intern_find(m.a);
+            state_wrlock(state);
+            enqueue(&state->msg_queue, m.b);
+            history_append(&state->global_log, m.b);
+            state_unlock(state);
+            say_message(state, req->sd, m.b, sender);
+            intern_release(sender);
+            break;
+        }
+        case FED_OP_SAYTO: {
+            const char *recipient = intern_find(m.a);
+            const char *sender = intern_find(m.b);
+            if (recipient) say_to(state, req->sd, m.c, recipient, sender);
+            intern_release(recipient);
+            intern_release(sender);
+            break;
+        }
+        case FED_OP_PUB: {
+            // Interned even when unknown here: a wildcard may still match
+            const char *topic = intern(m.a);
+            const char *sender = intern_find(m.b);
+            if (topic && topic_valid(topic, 0)) {
+                state_wrlock(state);
+                deliver_topic(state, req->sd, topic, sender, m.c);
+                state_unlock(state);
+            }
+            intern_release(topic);
+            intern_release(sender);
+            break;
+        }
+        case FED_OP_ROOM_ON:
+        case FED_OP_ROOM_OFF:
+            fed_room_interest(fed, m.a, node, m.op == FED_OP_ROOM_ON);
+            break;
+        case FED_OP_ROOM_NEW:
+            fed_dir_set(&fed->remote_rooms, m.a, 1);
+            break;
+        case FED_OP_ROOM_GONE:
+            fed_dir_del(&fed->remote_rooms, m.a);
+            break;
+        case FED_OP_ROOM_SAY:
+        case FED_OP_ROOM_CAST: {
+            const char *room_name = intern_find(m.a);
+            const char *sender = intern_find(m.b);
+            state_wrlock(state);
+            struct chat_room *room = room_table_find(&state->rooms, room_name);
+            if (room) deliver_room(req->sd, room, sender, m.c);
+            if (m.op == FED_OP_ROOM_SAY) fed_room_cast(fed, m.a, m.b, m.c);
+            state_unlock(state);
+            intern_release(room_name);
+            intern_release(sender);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
 
+// Commands whose argument is a client, room or topic name. <first_word> takes
+// the name from the first word only; <create> interns names nobody holds
+// yet, the others only look up existing ones.
+static const struct {
+    const char *cmd;
+    int first_word;
+    int create;
+} name_commands[] = {
+    { "conn", 0, 1 }, { "rename", 0, 1 }, { "mute", 0, 1 }, { "unmute", 0, 0 }, { "kick", 0, 0 },
+    { "createroom", 0, 1 }, { "joinroom", 0, 1 }, { "leaveroom", 0, 0 }, { "kickroom", 0, 0 },
+    { "sayto", 1, 0 }, { "sayroom", 1, 0 }, { "history", 1, 0 },
+    { "sub", 1, 1 }, { "unsub", 1, 0 }, { "pub", 1, 1 },
+};
+
+// Interns the name argument of <cmd>, if it has one: the only place a
+// request's name is hashed. The caller releases the handle. A name too long
+// for MAX_NAME_LEN sets <too_long> rather than being cut, since two long
+// names would otherwise collide.
+static const char *intern_argument(const char *cmd, const char *args, int *too_long) {
+    for (size_t i = 0; i < sizeof(name_commands) / sizeof(name_commands[0]); ++i) {
+        if (strcmp(cmd, name_commands[i].cmd) != 0) continue;
+        size_t len = name_commands[i].first_word ? strcspn(args, " ") : strlen(args);
+        if (len >= MAX_NAME_LEN) {
+            *too_long = 1;
+            return NULL;
+        }
+        return name_commands[i].create ? intern_n(args, len) : intern_find_n(args, len);
+    }
+    return NULL;
+}
+
+// <name> is the interned argument (NULL when absent)
+static void dispatch_request(struct request *req, char *cmd, char *args, const char *name) {
     if (strcmp(cmd, "conn") != 0) {
         update_client_activity(req->state, &req->src);
     }
     if (strcmp(cmd, "conn") == 0) {
-        if (add_client(req->state, &req->src, args) == 0) {
+        if (add_client(req->state, &req->src, name) == 0) {
             char msg[256];
             snprintf(msg, sizeof(msg), "[Server] %s successfully connected", args);
             send_global(req->sd, &req->src, msg);
             
-            pthread_rwlock_rdlock(&req->state->rwlock);
+            state_rdlock(req->state);
             message_queue *q = &req->state->msg_queue;
             int idx = q->head;
             for (int i = 0; i < q->size; i++) {
                 send_global(req->sd, &req->src, q->messages[idx]);
                 idx = (idx + 1) % 15;
             }
-            pthread_rwlock_unlock(&req->state->rwlock);
+            state_unlock(req->state);
         }
         return;
     }
@@ -467,31 +818,34 @@ static void handle_request(struct request *req) {
     if (strcmp(cmd, "createroom") == 0) {
         struct client_node *sender = find_client_by_addr(req->state, &req->src);
         if (!sender) return;
-        if (args[0] == '\0') {
+        if (!name) {
             send_global(req->sd, &req->src, "[Server] Room name required");
             return;
         }
-        pthread_rwlock_wrlock(&req->state->rwlock);
-        if (sender->room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
-            send_global(req->sd, &req->src, "[Server] Leave your current room before creating a new one");
+        state_wrlock(req->state);
+        if (sender->room_count >= MAX_CLIENT_ROOMS) {
+            state_unlock(req->state);
+            send_global(req->sd, &req->src, "[Server] You are in too many rooms; leave one first");
             return;
         }
-        struct chat_room *room = room_table_insert(&req->state->rooms, args);
+        struct chat_room *room = NULL;
+        if (!req->state->fed || fed_dir_get(&req->state->fed->remote_rooms, name, NULL) != 0)
+            room = room_table_insert(&req->state->rooms, name);
         if (!room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
+            state_unlock(req->state);
             send_global(req->sd, &req->src, "[Server] Unable to create room (maybe name already exists)");
             return;
         }
-        if (room_add_member(room, sender) != 0) {
-            room_table_remove(&req->state->rooms, args);
-            pthread_rwlock_unlock(&req->state->rwlock);
+        if (room_join(room, sender) != 0) {
+            room_table_remove(&req->state->rooms, name);
+            state_unlock(req->state);
             send_global(req->sd, &req->src, "[Server] Failed to join new room");
             return;
         }
-        pthread_rwlock_unlock(&req->state->rwlock);
+        if (req->state->fed) fed_local_room(req->state->fed, room->name, 1);
+        state_unlock(req->state);
         char msg[256];
-        snprintf(msg, sizeof(msg), "[Server] Room <%s> created; you joined it", room->name);
+        snprintf(msg, sizeof(msg), "[Server] Room <%s> created; you joined it", name);
         send_global(req->sd, &req->src, msg);
         return;
     }
@@ -499,32 +853,33 @@ static void handle_request(struct request *req) {
     if (strcmp(cmd, "joinroom") == 0) {
         struct client_node *sender = find_client_by_addr(req->state, &req->src);
         if (!sender) return;
-        if (args[0] == '\0') {
+        if (!name) {
             send_global(req->sd, &req->src, "[Server] Room name required");
             return;
         }
-        pthread_rwlock_wrlock(&req->state->rwlock);
-        struct chat_room *room = room_table_find(&req->state->rooms, args);
+        state_wrlock(req->state);
+        struct chat_room *room = room_table_find(&req->state->rooms, name);
+        int new_view = 0;
+        if (!room && req->state->fed &&
+            fed_dir_get(&req->state->fed->remote_rooms, name, NULL) == 0) {
+            // The room lives on other nodes: open a local view of it
+            room = room_table_insert(&req->state->rooms, name);
+            new_view = room != NULL;
+        }
         if (!room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
+            state_unlock(req->state);
             send_global(req->sd, &req->src, "[Server] Room not found");
             return;
         }
-        if (sender->room == room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
-            send_global(req->sd, &req->src, "[Server] You are already in that room");
-            return;
-        }
-        if (sender->room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
-            send_global(req->sd, &req->src, "[Server] Leave your current room before joining another");
-            return;
-        }
-        if (room_add_member(room, sender) != 0) {
-            pthread_rwlock_unlock(&req->state->rwlock);
-            send_global(req->sd, &req->src, "[Server] Failed to join room");
+        int joined = room_join(room, sender);
+        if (joined != 0) {
+            if (new_view) room_table_remove(&req->state->rooms, name);
+            state_unlock(req->state);
+            send_global(req->sd, &req->src, joined > 0 ? "[Server] You are already in that room"
+                        : "[Server] Failed to join room (too many rooms?)");
             return;
         }
+        if (new_view) fed_local_room(req->state->fed, room->name, 1);
 
         message_queue *history = &room->history;
         int idx = history->head;
@@ -532,59 +887,126 @@ static void handle_request(struct request *req) {
             send_room(req->sd, &req->src, history->messages[idx]);
             idx = (idx + 1) % max_messages;
         }
-        pthread_rwlock_unlock(&req->state->rwlock);
+        state_unlock(req->state);
         char msg[256];
-        snprintf(msg, sizeof(msg), "[Server] Joined room <%s>", room->name);
+        snprintf(msg, sizeof(msg), "[Server] Joined room <%s>", name);
         send_global(req->sd, &req->src, msg);
         return;
     }
 
     if (strcmp(cmd, "sayroom") == 0) {
-        struct client_node *sender = find_client_by_addr(req->state, &req->src);
-        if (!sender) return;
-
-        pthread_rwlock_wrlock(&req->state->rwlock);
-        if (!sender->room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
+        state_wrlock(req->state);
+        struct client_node *sender = lookup_client_addr(req->state, &req->src);
+        if (!sender) {
+            state_unlock(req->state);
+            return;
+        }
+        // "sayroom$ <room> <msg>" when the first word names one of the
+        // sender's rooms, otherwise "sayroom$ <msg>" to the latest room joined
+        struct chat_room *room = NULL;
+        const char *text = args;
+        char *space = strchr(args, ' ');
+        if (name && space) {
+            struct chat_room *named = room_table_find(&req->state->rooms, name);
+            if (named && room_membership(named, sender)) {
+                room = named;
+                text = skip_spaces(space + 1);
+            }
+        }
+        if (!room && sender->rooms) room = sender->rooms->room;
+        if (!room) {
+            state_unlock(req->state);
             send_global(req->sd, &req->src, "[Server] You are not in a room");
             return;
         }
-        if (args[0] == '\0') {
-            pthread_rwlock_unlock(&req->state->rwlock);
+        if (text[0] == '\0') {
+            state_unlock(req->state);
             return;
         }
         char formatted[BUFFER_SIZE];
         snprintf(formatted, sizeof(formatted), "[%s|%s] %s",
-                 sender->room->name, sender->name, args);
-
-        enqueue(&sender->room->history, formatted);
-        struct room_member *m = sender->room->members;
-        while (m) {
-            struct client_node *rc = m->client;
-            if (rc && !is_muted_for_receiver(rc, sender->name)) {
-                send_room(req->sd, &rc->addr, formatted);
+                 room->name, sender->cold->name, text);
+
+        struct federation *fed = req->state->fed;
+        int owner = fed ? fed_room_owner(fed, room->name) : -1;
+        if (fed && owner != fed->self) {
+            // The owner sequences room traffic and casts it back to us
+            fed_send(fed, owner, FED_OP_ROOM_SAY, room->name, sender->cold->name, formatted);
+        } else {
+            deliver_room(req->sd, room, sender->cold->name, formatted);
+            if (fed) fed_room_cast(fed, room->name, sender->cold->name, formatted);
+        }
+
+        state_unlock(req->state);
+        return;
+    }
+
+    if (strcmp(cmd, "history") == 0) {
+        struct client_node *sender = find_client_by_addr(req->state, &req->src);
+        if (!sender) return;
+        char channel[MAX_NAME_LEN];
+        unsigned long long before = 0;
+        int count = 0;
+        if (sscanf(args, "%63s %llu %d", channel, &before, &count) != 3 || count <= 0) {
+            send_global(req->sd, &req->src, "[Server] Usage: history$ <global|room> <before-seq> <count>");
+            return;
+        }
+        if (count > HISTORY_MAX_PAGE) count = HISTORY_MAX_PAGE;
+
+        struct reply_stream st = { .sd = req->sd, .addr = &req->src, .len = 0, .first_seq = 0 };
+        const struct history_log *log = NULL;
+        state_rdlock(req->state);
+        if (strcmp(channel, "global") == 0) {
+            log = &req->state->global_log;
+            st.prefix = MSG_GLOBAL;
+        } else {
+            struct chat_room *room = room_table_find(&req->state->rooms, name);
+            if (!room || !room_membership(room, sender)) {
+                state_unlock(req->state);
+                send_global(req->sd, &req->src, "[Server] You are not in that room");
+                return;
             }
-            m = m->next;
+            log = &room->log;
+            st.prefix = MSG_ROOM;
         }
+        int sent = history_page(log, (uint64_t)before, count, history_stream_visit, &st);
+        reply_stream_flush(&st);
+        state_unlock(req->state);
 
-        pthread_rwlock_unlock(&req->state->rwlock);
+        char msg[256];
+        if (sent == 0)
+            snprintf(msg, sizeof(msg), "[Server] No history in <%s> before #%llu", channel, before);
+        else
+            snprintf(msg, sizeof(msg), "[Server] Sent %d messages from <%s>; next page: history$ %s %llu %d",
+                     sent, channel, channel, (unsigned long long)st.first_seq, count);
+        send_global(req->sd, &req->src, msg);
         return;
     }
 
     if (strcmp(cmd, "leaveroom") == 0) {
         struct client_node *sender = find_client_by_addr(req->state, &req->src);
         if (!sender) return;
-        pthread_rwlock_wrlock(&req->state->rwlock);
-        if (!sender->room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
-            send_global(req->sd, &req->src, "[Server] You are not in a room");
+        state_wrlock(req->state);
+        // "leaveroom$ <room>", or the latest room joined when no name is
+        // given; a name nobody holds has no handle and matches no room
+        struct chat_room *room = NULL;
+        if (args[0] != '\0') {
+            room = name ? room_table_find(&req->state->rooms, name) : NULL;
+            if (room && !room_membership(room, sender)) room = NULL;
+        } else if (sender->rooms) {
+            room = sender->rooms->room;
+        }
+        if (!room) {
+            state_unlock(req->state);
+            send_global(req->sd, &req->src, args[0] != '\0' ? "[Server] You are not in that room"
+                        : "[Server] You are not in a room");
             return;
         }
         char room_name[MAX_NAME_LEN];
-        strncpy(room_name, sender->room->name, MAX_NAME_LEN - 1);
+        strncpy(room_name, room->name, MAX_NAME_LEN - 1);
         room_name[MAX_NAME_LEN - 1] = '\0';
-        detach_client_from_room(req->state, sender);
-        pthread_rwlock_unlock(&req->state->rwlock);
+        leave_room(req->state, sender, room);
+        state_unlock(req->state);
         char msg[256];
         snprintf(msg, sizeof(msg), "[Server] You left room <%s>", room_name);
         send_global(req->sd, &req->src, msg);
@@ -600,23 +1022,25 @@ static void handle_request(struct request *req) {
             send_global(req->sd, &req->src, "[Server] Provide a client name to kick");
             return;
         }
-        struct client_node *target = find_client_by_name(req->state, args);
+        struct client_node *target = find_client_by_name(req->state, name);
         if (!target) {
             send_global(req->sd, &req->src, "[Server] Client not found");
             return;
         }
-        pthread_rwlock_wrlock(&req->state->rwlock);
-        if (!target->room) {
-            pthread_rwlock_unlock(&req->state->rwlock);
+        state_wrlock(req->state);
+        if (!target->rooms) {
+            state_unlock(req->state);
             send_global(req->sd, &req->src, "[Server] Target is not in a room");
             return;
         }
+        // Removes the target from the room it joined last
+        struct chat_room *room = target->rooms->room;
         char room_name[MAX_NAME_LEN];
-        strncpy(room_name, target->room->name, MAX_NAME_LEN - 1);
+        strncpy(room_name, room->name, MAX_NAME_LEN - 1);
         room_name[MAX_NAME_LEN - 1] = '\0';
         struct sockaddr_in target_addr = target->addr;
-        detach_client_from_room(req->state, target);
-        pthread_rwlock_unlock(&req->state->rwlock);
+        leave_room(req->state, target, room);
+        state_unlock(req->state);
         char notify[256];
         snprintf(notify, sizeof(notify), "[Server] You have been removed from room <%s>", room_name); 
         send_global(req->sd, &target_addr, notify);
@@ -626,33 +1050,123 @@ static void handle_request(struct request *req) {
         return;
     }
 
-    if (strcmp(cmd, "say") == 0) {
+    if (strcmp(cmd, "sub") == 0 || strcmp(cmd, "unsub") == 0) {
+        struct client_node *sender = find_client_by_addr(req->state, &req->src);
+        if (!sender) return;
+        int subscribe = cmd[0] == 's';
+        if (subscribe && !topic_valid(name, 1)) {
+            send_global(req->sd, &req->src, "[Server] Usage: sub$ <topic pattern>, e.g. alerts.db.*");
+            return;
+        }
+        state_wrlock(req->state);
+        int rc = subscribe ? topic_subscribe(&req->state->topics, sender, name)
+                           : topic_unsubscribe(&req->state->topics, sender, name);
+        state_unlock(req->state);
+        char msg[256];
+        if (rc == 0)
+            snprintf(msg, sizeof(msg), subscribe ? "[Server] Subscribed to <%s>" : "[Server] Unsubscribed from <%s>",
+                     name);
+        else if (!subscribe)
+            snprintf(msg, sizeof(msg), "[Server] You are not subscribed to that pattern");
+        else
+            snprintf(msg, sizeof(msg), rc > 0 ? "[Server] Already subscribed to <%s>"
+                     : "[Server] Too many subscriptions; unsub$ one first", name);
+        send_global(req->sd, &req->src, msg);
+        return;
+    }
+
+    if (strcmp(cmd, "pub") == 0) {
+        const char *who = sender_name_ref(req->state, &req->src);
+        if (!who) return;
+        char *space = strchr(args, ' ');
+        char *text = space ? skip_spaces(space + 1) : NULL;
+        if (!space || !topic_valid(name, 0)) {
+            send_global(req->sd, &req->src, "[Server] Usage: pub$ <topic> <msg>");
+        } else if (text[0] != '\0') {
+            char formatted[BUFFER_SIZE];
+            snprintf(formatted, sizeof(formatted), "[%s|%s] %s", name, who, text);
+            state_wrlock(req->state);
+            deliver_topic(req->state, req->sd, name, who, formatted);
+            state_unlock(req->state);
+            // Subscriptions are not replicated: every node resolves its own
+            if (req->state->fed)
+                fed_send_all(req->state->fed, FED_OP_PUB, name, who, formatted);
+        }
+        intern_release(who);
+        return;
+    }
+
+    if (strcmp(cmd, "coalesce") == 0) {
         struct client_node *sender = find_client_by_addr(req->state, &req->src);
         if (!sender) return;
+        char *end;
+        long ms = strtol(args, &end, 10);
+        if (args[0] == '\0' || *skip_spaces(end) != '\0' || ms < 0 || ms > COALESCE_MAX_MS) {
+            char usage[128];
+            snprintf(usage, sizeof(usage), "[Server] Usage: coalesce$ <ms>, 0 to %d (0 turns it off)",
+                     COALESCE_MAX_MS);
+            send_global(req->sd, &req->src, usage);
+            return;
+        }
+        state_wrlock(req->state);
+        struct client_cold *cold = sender->cold;
+        int rc = 0;
+        if (ms == 0) {
+            // Buffered records go out before the reply, as the window would have sent them
+            coalesce_flush(cold->coalesce);
+            coalesce_close(cold->coalesce);
+            cold->coalesce = NULL;
+            sender->coalescing = 0;
+        } else if (cold->coalesce) {
+            coalesce_set_window(cold->coalesce, (unsigned)ms);
+        } else if ((cold->coalesce = coalesce_open(&sender->addr, (unsigned)ms))) {
+            sender->coalescing = 1;
+        } else {
+            rc = -1;
+        }
+        state_unlock(req->state);
+        char msg[128];
+        if (rc != 0) snprintf(msg, sizeof(msg), "[Server] Could not start coalescing");
+        else if (ms == 0) snprintf(msg, sizeof(msg), "[Server] Coalescing off");
+        else snprintf(msg, sizeof(msg), "[Server] Coalescing messages within %ld ms", ms);
+        send_global(req->sd, &req->src, msg);
+        return;
+    }
+
+    if (strcmp(cmd, "say") == 0) {
         if (args[0] == '\0') return;
+        const char *who = sender_name_ref(req->state, &req->src);
+        if (!who) return;
         char msg[BUFFER_SIZE];
-        snprintf(msg, sizeof(msg), "[%s] %s", sender->name, args);
-        pthread_rwlock_wrlock(&req->state->rwlock);
+        snprintf(msg, sizeof(msg), "[%s] %s", who, args);
+        state_wrlock(req->state);
         enqueue(&req->state->msg_queue, msg);
-        pthread_rwlock_unlock(&req->state->rwlock);
-        say_message(req->state, req->sd, msg, sender->name);
+        history_append(&req->state->global_log, msg);
+        state_unlock(req->state);
+        say_message(req->state, req->sd, msg, who);
+        if (req->state->fed) fed_send_all(req->state->fed, FED_OP_SAY, who, msg, NULL);
+        intern_release(who);
         return;
     }
 
     if (strcmp(cmd, "sayto") == 0) {
-        struct client_node *sender = find_client_by_addr(req->state, &req->src);
-        if (!sender) return;
-        char recipient[MAX_NAME_LEN];
         char *space = strchr(args, ' ');
         if (!space) return;
-        *space = '\0';
-        strncpy(recipient, args, MAX_NAME_LEN);
-        recipient[MAX_NAME_LEN-1] = '\0';
         char *msg = skip_spaces(space + 1);
         if (msg[0] == '\0') return;
+        const char *who = sender_name_ref(req->state, &req->src);
+        if (!who) return;
         char formatted[BUFFER_SIZE];
-        snprintf(formatted, sizeof(formatted), "[%s] %s", sender->name, msg);
-        say_to(req->state, req->sd, formatted, recipient, sender->name);
+        snprintf(formatted, sizeof(formatted), "[%s] %s", who, msg);
+        if ((!name || say_to(req->state, req->sd, formatted, name, who) != 0) && req->state->fed) {
+            // A client on another node has no handle here: look up the raw word
+            *space = '\0';
+            const char *target = name ? name : args;
+            uint32_t node;
+            if (fed_dir_get(&req->state->fed->users, target, &node) == 0)
+                fed_send(req->state->fed, (int)node, FED_OP_SAYTO, target, who, formatted);
+        }
+        intern_release(who);
         return;
     }
 
@@ -664,34 +1178,33 @@ static void handle_request(struct request *req) {
     }
 
     if (strcmp(cmd, "mute") == 0) {
-        struct client_node *sender = find_client_by_addr(req->state, &req->src);
-        if (!sender) return;
-        add_muted_for_client(req->state, sender->name, args);
+        const char *who = sender_name_ref(req->state, &req->src);
+        if (who && name) add_muted_for_client(req->state, who, name);
+        intern_release(who);
         return;
     }
 
     if (strcmp(cmd, "unmute") == 0) {
         struct client_node *sender = find_client_by_addr(req->state, &req->src);
         if (!sender) return;
-        pthread_rwlock_wrlock(&req->state->rwlock);
+        state_wrlock(req->state);
         for (int i = 0; i < sender->muted_count; i++) {
-            if (strcmp(sender->muted[i], args) == 0) {
+            if (sender->cold->muted[i] == name) {
+                intern_release(sender->cold->muted[i]);
                 for (int j = i; j < sender->muted_count-1; j++)
-                    strncpy(sender->muted[j], sender->muted[j+1], MAX_NAME_LEN);
+                    sender->cold->muted[j] = sender->cold->muted[j+1];
                 sender->muted_count--;
                 break;
             }
         }
-        pthread_rwlock_unlock(&req->state->rwlock);
+        state_unlock(req->state);
         return;
     }
 
     if (strcmp(cmd, "rename") == 0) {
         struct client_node *sender = find_client_by_addr(req->state, &req->src);
         if (!sender) return;
-        char old[MAX_NAME_LEN];
-        strncpy(old, sender->name, MAX_NAME_LEN);
-        if (rename_client(req->state, &req->src, args) == 0) {
+        if (rename_client(req->state, &req->src, name) == 0) {
             char msg[256];
             snprintf(msg, sizeof(msg), "[Server] You are now known as %s", args);
             send_global(req->sd, &req->src, msg);
@@ -699,8 +1212,22 @@ static void handle_request(struct request *req) {
         return;
     }
 
+    if (strcmp(cmd, "stats") == 0) {
+        if (ntohs(req->src.sin_port) != 6666) {
+            send_global(req->sd, &req->src, "[Server] You are not an admin");
+            return;
+        }
+        struct metrics_gauges g;
+        collect_gauges(req->state, &g);
+        struct reply_stream st = { .sd = req->sd, .addr = &req->src, .prefix = MSG_GLOBAL, .len = 0 };
+        metrics_report(&g, stats_stream_emit, &st);
+        pool_report(stats_stream_emit, &st);
+        reply_stream_flush(&st);
+        return;
+    }
+
     if (strcmp(cmd, "kick") == 0) {
-        struct client_node *client = find_client_by_name(req->state, args);
+        struct client_node *client = find_client_by_name(req->state, name);
         if (!client) return;
         if (ntohs(req->src.sin_port) != 6666) {
             char notify[256];
@@ -712,7 +1239,7 @@ static void handle_request(struct request *req) {
             char notify[256];
             snprintf(notify, sizeof(notify), "[Server] You have been removed from the chat. disconn$ to close safely or conn$ <name> to join back");
             send_global(req->sd, &client->addr, notify);
-            remove_client_by_name(req->state, args);
+            remove_client_by_name(req->state, name);
             char bc[256];
             snprintf(bc, sizeof(bc), "[Server] %s has been removed from the chat", args);
             say_message(req->state, req->sd, bc, NULL);
@@ -721,65 +1248,692 @@ static void handle_request(struct request *req) {
     }
 }
 
-void *request_handler_thread(void *arg) {
-    if (!arg) return NULL;
-    struct request *req = (struct request *)arg;
-    handle_request(req);
-    free(req);
+// Client text ends up inside '\n'-separated records whose first byte is
+// the channel, so control characters become spaces before any record is
+// built; trailing ones are trimmed
+static void sanitize_args(char *args) {
+    char *end = args;
+    for (char *p = args; *p; ++p) {
+        if ((unsigned char)*p < 0x20) *p = ' ';
+        if (*p != ' ') end = p + 1;
+    }
+    *end = '\0';
+}
+
+static void handle_request(struct request *req) {
+    ensure_null_terminated(req->buf, req->len);
+    char *p = skip_spaces(req->buf);
+    char *dollar = strchr(p, '$');
+    if (!dollar) return;
+    *dollar = '\0';
+    char *cmd = p;
+    char *args = skip_spaces(dollar + 1);
+
+    if (strcmp(cmd, "fed") == 0) {
+        handle_federation(req, args);
+        return;
+    }
+    sanitize_args(args);
+
+    // Flood protection runs before any server_state lock is taken
+    if (ratelimit_enabled && ntohs(req->src.sin_port) != 6666) {
+        enum rl_verdict verdict = ratelimit_check(shard_limiter ? shard_limiter : &limiter, &req->src,
+                                                  ratelimit_class(cmd), metrics_now_ns());
+        if (verdict != RL_PASS) {
+            metrics_count(METRIC_THROTTLED, 1);
+            if (verdict == RL_THROTTLED_FIRST)
+                send_global(req->sd, &req->src, "[Server] Rate limit exceeded; messages are being dropped");
+            return;
+        }
+    }
+
+    int too_long = 0;
+    const char *name = intern_argument(cmd, args, &too_long);
+    if (too_long) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "[Server] Names are limited to %d characters", MAX_NAME_LEN - 1);
+        send_global(req->sd, &req->src, msg);
+        return;
+    }
+    dispatch_request(req, cmd, args, name);
+    intern_release(name);
+}
+
+// Copies the command word of a raw datagram (text before '$') into <out>
+static void peek_command(const char *buf, int len, char *out, size_t cap) {
+    int i = 0;
+    while (i < len && (buf[i] == ' ' || buf[i] == '\t')) i++;
+    size_t n = 0;
+    while (i < len && buf[i] != '$' && buf[i] != '\0' && n + 1 < cap) out[n++] = buf[i++];
+    out[n] = '\0';
+}
+
+// Runs requests off the shared queue; the pool is started once and outlives
+// listener restarts during a handoff
+static void *worker_thread(void *arg) {
+    (void)arg;
+    if (use_uring) {
+        struct uring_send *tx = malloc(sizeof(*tx));
+        if (tx && uring_send_init(tx) == 0) send_batch = tx;
+        else free(tx);
+    }
+    while (1) {
+        enum work_lane lane;
+        uint64_t wait_ns;
+        struct request *req = work_queue_pop(&request_queue, &lane, &wait_ns);
+        if (req->fanout) {
+            fanout_run(req->fanout);
+            flush_send_batch();
+            fanout_job_release(req->fanout);
+            pool_free(&request_pool, req);
+            continue;
+        }
+        metrics_record(lane == WORK_LANE_CONTROL ? METRIC_CONTROL_WAIT : METRIC_BULK_WAIT, wait_ns);
+        uint64_t start = metrics_now_ns();
+        handle_request(req);
+        flush_send_batch();
+        metrics_command(metrics_command_index(req->cmd), metrics_now_ns() - start);
+        pool_free(&request_pool, req);
+        atomic_fetch_sub(&inflight_requests, 1);
+    }
     return NULL;
 }
 
+// Admission classes, most important first; lower classes are shed earlier.
+// CONTROL and CONN are queued on the control lane, the rest on the bulk lane.
+enum admit_class {
+    ADMIT_CONTROL,       // re-ping$, disconn$, fed$ and admin commands
+    ADMIT_CONN,          // conn$: refused with a retry-after reply when busy
+    ADMIT_NORMAL,        // room management, mute$, rename$, ...
+    ADMIT_CHAT           // say$, sayto$, sayroom$, history$, pub$
+};
+
+static enum admit_class admit_class(const struct request *req) {
+    const char *cmd = req->cmd;
+    if (ntohs(req->src.sin_port) == 6666 || strcmp(cmd, "re-ping") == 0 || strcmp(cmd, "disconn") == 0)
+        return ADMIT_CONTROL;
+    // Only configured peers get the control lane; anyone else's fed$ is
+    // dropped by handle_federation and must not skip shedding on the way
+    if (strcmp(cmd, "fed") == 0)
+        return req->state->fed && fed_node_by_addr(req->state->fed, &req->src) >= 0 ? ADMIT_CONTROL
+                                                                                   : ADMIT_NORMAL;
+    if (strcmp(cmd, "conn") == 0) return ADMIT_CONN;
+    if (strcmp(cmd, "say") == 0 || strcmp(cmd, "sayto") == 0 ||
+        strcmp(cmd, "sayroom") == 0 || strcmp(cmd, "history") == 0 || strcmp(cmd, "pub") == 0)
+        return ADMIT_CHAT;
+    return ADMIT_NORMAL;
+}
+
+// 0 = healthy, 1 = busy, 2 = overloaded, judged by the bulk lane (control
+// traffic always runs first, so its lane stays short)
+static int load_level(void) {
+    size_t depth = work_queue_depth(&request_queue, WORK_LANE_BULK);
+    if (depth >= request_queue.capacity * OVERLOAD_DEPTH_PERCENT / 100) return 2;
+    if (depth >= request_queue.capacity * BUSY_DEPTH_PERCENT / 100) return 1;
+    if (depth >= OVERLOAD_MIN_DEPTH &&
+        work_queue_wait_ewma(&request_queue, WORK_LANE_BULK) > OVERLOAD_WAIT_NS)
+        return 1;
+    return 0;
+}
+
+// Queues <req> for the workers unless the current load sheds its class.
+// Returns 0 if the queue took ownership of <req>.
+static int admit_request(struct request *req) {
+    enum admit_class cls = admit_class(req);
+    int level = cls == ADMIT_CONTROL ? 0 : load_level();
+    if (cls == ADMIT_CONN && level > 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "[Server] Server busy, retry after %d seconds", OVERLOAD_RETRY_SEC);
+        send_global(req->sd, &req->src, msg);
+        metrics_count(METRIC_REJECTED, 1);
+        return -1;
+    }
+    if ((cls == ADMIT_CHAT && level > 0) || (cls == ADMIT_NORMAL && level > 1)) {
+        metrics_count(METRIC_SHED, 1);
+        return -1;
+    }
+    enum work_lane lane = cls <= ADMIT_CONN ? WORK_LANE_CONTROL : WORK_LANE_BULK;
+    atomic_fetch_add(&inflight_requests, 1);
+    if (work_queue_push(&request_queue, lane, req) != 0) {
+        atomic_fetch_sub(&inflight_requests, 1);
+        metrics_count(METRIC_SHED, 1);
+        return -1;
+    }
+    return 0;
+}
+
+static int start_workers(int count) {
+    if (work_queue_init(&request_queue, WORK_QUEUE_CAPACITY) != 0) return -1;
+    for (int i = 0; i < count; ++i) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, worker_thread, NULL) != 0) return i > 0 ? 0 : -1;
+        pthread_detach(worker);
+        worker_count = i + 1;
+    }
+    return 0;
+}
+
+// Sleeps until the socket is readable or the listener is asked to stop
+static void wait_readable(int sd, int wake_fd) {
+    struct pollfd fds[2] = {
+        { .fd = sd, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN },
+    };
+    poll(fds, 2, -1);
+}
+
+// Accounts for a received datagram and offers it to admission control.
+// Returns 0 if the request was queued.
+static int accept_datagram(struct request *req) {
+    req->fanout = NULL;
+    metrics_count(METRIC_PACKETS_IN, 1);
+    metrics_count(METRIC_BYTES_IN, (uint64_t)req->len);
+    peek_command(req->buf, req->len, req->cmd, sizeof(req->cmd));
+    return admit_request(req);
+}
+
+// Queues one received datagram; the io_uring and shared-memory receive
+// paths both deliver here
+static void uring_datagram(const struct sockaddr_in *src, const char *data, size_t len, void *user) {
+    struct listener_args *args = user;
+    struct request *req = pool_alloc(&request_pool);
+    if (!req) return;
+    req->sd = args->sd;
+    req->state = args->state;
+    req->src = *src;
+    req->len = (int)(len < BUFFER_SIZE ? len : BUFFER_SIZE);
+    memcpy(req->buf, data, (size_t)req->len);
+    if (accept_datagram(req) != 0) pool_free(&request_pool, req);
+}
+
+// A local client closed its session: it will never send disconn$
+static void local_hangup(const struct sockaddr_in *src, void *user) {
+    struct listener_args *args = user;
+    remove_client_by_addr(args->state, src);
+}
+
+// io_uring receive loop. Returns 0 when asked to stop, -1 if the engine
+// fails, in which case the caller carries on with recvfrom.
+static int uring_listen(struct listener_args *args) {
+    struct uring_recv rx;
+    if (uring_recv_open(&rx, args->sd) != 0) {
+        perror("io_uring receive setup");
+        return -1;
+    }
+    int result = 0;
+    while (!atomic_load(&args->stop)) {
+        if (uring_recv_wait(&rx, args->wake_fd[0], uring_datagram, args) < 0) {
+            perror("io_uring receive");
+            result = -1;
+            break;
+        }
+    }
+    uring_recv_close(&rx, uring_datagram, args);
+    return result;
+}
+
+// Reads with MSG_DONTWAIT and only polls when the socket is empty, so a busy
+// server pays one syscall per datagram while still being stoppable for handoff.
 void *listener_thread(void *arg) {
     struct listener_args *args = arg;
     int sd = args->sd;
     struct server_state *state = args->state;
+    struct request *req = NULL;
 
-    while (1) {
-        struct request *req = malloc(sizeof(struct request));
-        if (!req) continue;
+    if (use_uring && uring_listen(args) == 0) return NULL;
+
+    while (!atomic_load(&args->stop)) {
+        if (!req) {
+            req = pool_alloc(&request_pool);
+            if (!req) continue;
+        }
 
         req->sd = sd;
         req->state = state;
 
-        socklen_t srclen = sizeof(req->src);
-        req->len = udp_socket_read(sd, &req->src, req->buf, BUFFER_SIZE);
+        req->len = udp_socket_try_read(sd, &req->src, req->buf, BUFFER_SIZE);
         if (req->len < 0) {
-            perror("udp_socket_read");
-            free(req);
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_readable(sd, args->wake_fd[0]);
+            } else if (errno != EINTR) {
+                perror("udp_socket_read");
+            }
             continue;
         }
-        pthread_t worker;
-        pthread_create(&worker, NULL, request_handler_thread, req);
-        pthread_detach(worker);
+        // A shed request's buffer is reused for the next datagram
+        if (accept_datagram(req) == 0) req = NULL;
+    }
+    pool_free(&request_pool, req);
+    return NULL;
+}
+
+// Stops the listener without consuming any more datagrams and waits until
+// every dispatched request has finished
+static void quiesce_listener(void *ctx) {
+    struct listener_args *args = ctx;
+    atomic_store(&args->stop, 1);
+    char b = 1;
+    if (write(args->wake_fd[1], &b, 1) < 0) perror("wake listener");
+    pthread_join(args->listener, NULL);
+    while (atomic_load(&inflight_requests) > 0) {
+        usleep(1000);
+    }
+}
+
+static void resume_listener(void *ctx) {
+    struct listener_args *args = ctx;
+    char b;
+    while (read(args->wake_fd[0], &b, 1) == 1) {}
+    atomic_store(&args->stop, 0);
+    pthread_create(&args->listener, NULL, listener_thread, args);
+}
+
+struct stats_args {
+    struct server_state *state;
+    const char *path;
+    int interval;
+};
+
+static void stats_file_emit(const char *line, void *user) {
+    fprintf(user, "%s\n", line);
+}
+
+// Rewrites the stats file every <interval> seconds (tmp + rename)
+static void *stats_dump_thread(void *arg) {
+    struct stats_args *args = arg;
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", args->path);
+    while (1) {
+        sleep(args->interval);
+        struct metrics_gauges g;
+        collect_gauges(args->state, &g);
+        FILE *fp = fopen(tmp, "w");
+        if (!fp) {
+            perror("stats file");
+            continue;
+        }
+        metrics_report(&g, stats_file_emit, fp);
+        pool_report(stats_file_emit, fp);
+        if (fclose(fp) == 0) rename(tmp, args->path);
     }
     return NULL;
 }
 
-int main() {
+// Shard that owns a client. The reuseport BPF program below computes the
+// same function in the kernel, so datagrams normally land on their owner.
+static int shard_of(const struct sockaddr_in *addr) {
+    return (int)((ntohl(addr->sin_addr.s_addr) ^ ntohs(addr->sin_port)) % (uint32_t)shard_count);
+}
+
+// Steers each datagram to socket shard_of(src) of the reuseport group.
+// Assumes IPv4 without options; anything it misroutes is forwarded.
+static int attach_shard_steering(int sd) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)SKF_NET_OFF + 12),  // A = source address
+        BPF_STMT(BPF_ST, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, (uint32_t)SKF_NET_OFF + 20),  // A = source port
+        BPF_STMT(BPF_LDX | BPF_W | BPF_MEM, 0),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)shard_count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+    return setsockopt(sd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+// fed_deliver_fn: cross-shard batches (sayto$, broadcasts, room fan-out)
+static void shard_deliver(void *ctx, int node, const char *batch, size_t len) {
+    struct shard *from = ctx;
+    if (mailbox_push(&shards[node].inbox, &from->fed.nodes[from->index].addr, batch, len) != 0)
+        metrics_count(METRIC_SHED, 1);
+}
+
+// Runs one datagram inline on the shard's thread
+static void shard_handle(struct shard *sh, const struct sockaddr_in *src, const char *buf, int len) {
+    struct request req;
+    req.sd = sh->sd;
+    req.state = &sh->state;
+    req.src = *src;
+    req.len = len;
+    memcpy(req.buf, buf, (size_t)len);
+    peek_command(req.buf, req.len, req.cmd, sizeof(req.cmd));
+    uint64_t start = metrics_now_ns();
+    handle_request(&req);
+    metrics_command(metrics_command_index(req.cmd), metrics_now_ns() - start);
+}
+
+// Returns 1 if the socket may hold more datagrams
+static int reactor_drain_socket(struct shard *sh) {
+    struct mmsghdr msgs[REACTOR_BATCH];
+    struct iovec iovs[REACTOR_BATCH];
+    struct sockaddr_in srcs[REACTOR_BATCH];
+    static __thread char bufs[REACTOR_BATCH][BUFFER_SIZE];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < REACTOR_BATCH; ++i) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = BUFFER_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &srcs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(srcs[i]);
+    }
+    int n = recvmmsg(sh->sd, msgs, REACTOR_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) return 0;
+    for (int i = 0; i < n; ++i) {
+        int len = (int)msgs[i].msg_len;
+        metrics_count(METRIC_PACKETS_IN, 1);
+        metrics_count(METRIC_BYTES_IN, (uint64_t)len);
+        int owner = shard_of(&srcs[i]);
+        if (owner == sh->index) {
+            shard_handle(sh, &srcs[i], bufs[i], len);
+        } else {
+            metrics_count(METRIC_FORWARDED, 1);
+            if (mailbox_push(&shards[owner].inbox, &srcs[i], bufs[i], (size_t)len) != 0)
+                metrics_count(METRIC_SHED, 1);
+        }
+    }
+    return n == REACTOR_BATCH;
+}
+
+// Returns 1 if the mailbox may hold more messages
+static int reactor_drain_inbox(struct shard *sh) {
+    struct mailbox_slot *slot;
+    int n = 0;
+    while (n < REACTOR_BATCH && (slot = mailbox_peek(&sh->inbox)) != NULL) {
+        shard_handle(sh, &slot->src, slot->buf, slot->len);
+        mailbox_pop(&sh->inbox);
+        n++;
+    }
+    return n == REACTOR_BATCH;
+}
+
+// One shard's event loop: alternates between its socket and its mailbox,
+// and only sleeps in epoll_wait once both are empty.
+static void *reactor_thread(void *arg) {
+    struct shard *sh = arg;
+    intern_use(&sh->names);
+    shard_limiter = &sh->limiter;
+    int ep = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sh->sd };
+    epoll_ctl(ep, EPOLL_CTL_ADD, sh->sd, &ev);
+    ev.data.fd = sh->inbox.wake_fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sh->inbox.wake_fd, &ev);
+
+    while (1) {
+        int busy = reactor_drain_socket(sh);
+        busy |= reactor_drain_inbox(sh);
+        fed_flush(&sh->fed);
+        if (busy || mailbox_sleep(&sh->inbox) != 0) continue;
+        struct epoll_event events[2];
+        int n = epoll_wait(ep, events, 2, -1);
+        int signaled = 0;
+        for (int i = 0; i < n; ++i)
+            if (events[i].data.fd == sh->inbox.wake_fd) signaled = 1;
+        mailbox_awake(&sh->inbox, signaled);
+    }
+    return NULL;
+}
+
+// The ping monitor drops clients by name, so it needs its shard's names
+static void *shard_ping_thread(void *arg) {
+    struct shard *sh = arg;
+    intern_use(&sh->names);
+    return ping_monitor_thread(&sh->args);
+}
+
+// Runs the server as <shard_count> shared-nothing reactors; never returns
+// unless setup fails
+static int run_reactor(int port, struct stats_args *stats) {
+    shards = calloc((size_t)shard_count, sizeof(*shards));
+    if (!shards) return 1;
+    for (int i = 0; i < shard_count; ++i) {
+        struct shard *sh = &shards[i];
+        sh->index = i;
+        sh->sd = udp_socket_open_shared(port);
+        if (sh->sd < 0 || mailbox_init(&sh->inbox) != 0 ||
+            fed_init_local(&sh->fed, i, shard_count, shard_deliver, sh) != 0) {
+            fprintf(stderr, "Failed to set up reactor shard %d on port %d\n", i, port);
+            return 1;
+        }
+        init_server_state(&sh->state);
+        sh->state.fed = &sh->fed;
+        sh->args.sd = sh->sd;
+        sh->args.state = &sh->state;
+        ratelimit_init(&sh->limiter);
+        intern_table_init(&sh->names);
+
+        // A client's shard depends on the shard count, so each count keeps its own files
+        snprintf(sh->snapshot_path, sizeof(sh->snapshot_path), SNAPSHOT_SHARD_PATH_FMT, port, i, shard_count);
+        sh->snapshot.state = &sh->state;
+        sh->snapshot.path = sh->snapshot_path;
+        intern_use(&sh->names);
+        int loaded = snapshot_load(&sh->state, sh->snapshot_path);
+        intern_use(NULL);
+        if (loaded < 0) {
+            fprintf(stderr, "Ignoring unreadable snapshot %s\n", sh->snapshot_path);
+            destroy_server_state(&sh->state);
+            init_server_state(&sh->state);
+            sh->state.fed = &sh->fed;
+        } else if (loaded == 0) {
+            printf("Restored shard %d from %s (%zu clients)\n", i, sh->snapshot_path, sh->state.activity.size);
+        }
+    }
+    if (attach_shard_steering(shards[0].sd) != 0)
+        perror("reuseport steering (mis-steered datagrams will be forwarded)");
+
+    for (int i = 0; i < shard_count; ++i) {
+        struct shard *sh = &shards[i];
+        pthread_t pinger, fed_flusher, snapshotter;
+        pthread_create(&sh->thread, NULL, reactor_thread, sh);
+        pthread_create(&pinger, NULL, shard_ping_thread, sh);
+        pthread_detach(pinger);
+        pthread_create(&snapshotter, NULL, snapshot_thread, &sh->snapshot);
+        pthread_detach(snapshotter);
+        // Flushes what the ping monitor queues while the reactor is idle
+        pthread_create(&fed_flusher, NULL, fed_flush_thread, &sh->fed);
+        pthread_detach(fed_flusher);
+    }
+    // Restored users and room views are announced to the other shards again
+    for (int i = 0; i < shard_count; ++i) federation_sync(&shards[i].state, -1);
+    if (stats->path) {
+        stats->state = &shards[0].state;
+        pthread_t stats_dumper;
+        pthread_create(&stats_dumper, NULL, stats_dump_thread, stats);
+        pthread_detach(stats_dumper);
+    }
+    printf("Server running on port %d with %d reactor shards...\n", port, shard_count);
+    for (int i = 0; i < shard_count; ++i) pthread_join(shards[i].thread, NULL);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--takeover] [--port N] [--node ip:port] [--peer ip:port]... "
+                    "[--stats-file path] [--stats-interval sec] [--no-ratelimit] [--workers N] [--io-uring] [--shm] [--reactor N] [--fanout-threshold N] [--history-mb N]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int takeover = 0;
+    int port = SERVER_PORT;
+    const char *self_id = NULL;
+    const char *peers[FED_MAX_NODES];
+    int peer_count = 0;
+    struct stats_args stats = { .path = NULL, .interval = METRICS_DUMP_INTERVAL };
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus * WORKERS_PER_CPU : MIN_WORKERS;
+    if (workers < MIN_WORKERS) workers = MIN_WORKERS;
+    long history_mb = HISTORY_BUDGET_MB;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--takeover") == 0) {
+            takeover = 1;
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--node") == 0 && i + 1 < argc) {
+            self_id = argv[++i];
+        } else if (strcmp(argv[i], "--peer") == 0 && i + 1 < argc && peer_count < FED_MAX_NODES - 1) {
+            peers[peer_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reactor") == 0 && i + 1 < argc) {
+            shard_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fanout-threshold") == 0 && i + 1 < argc) {
+            fanout_threshold = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--history-mb") == 0 && i + 1 < argc) {
+            history_mb = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            use_uring = 1;
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            use_shm = 1;
+        } else if (strcmp(argv[i], "--no-ratelimit") == 0) {
+            ratelimit_enabled = 0;
+        } else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+            stats.path = argv[++i];
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            stats.interval = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (port <= 0 || port > 65535 || stats.interval <= 0 || workers <= 0 ||
+        shard_count < 0 || shard_count > FED_MAX_NODES || history_mb < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    history_set_budget((size_t)history_mb * 1024 * 1024);
+    metrics_init();
+    ratelimit_init(&limiter);
+    coalesce_init(send_now);
+    if (shard_count > 0) {
+        if (takeover || peer_count > 0 || use_shm) {
+            fprintf(stderr, "--reactor cannot be combined with --takeover, --peer or --shm\n");
+            return 1;
+        }
+        return run_reactor(port, &stats);
+    }
+    if (use_uring && uring_probe() != 0) {
+        fprintf(stderr, "io_uring unavailable, using recvfrom/sendto\n");
+        use_uring = 0;
+    }
+    if (start_workers(workers) != 0) {
+        fprintf(stderr, "Failed to start worker threads\n");
+        return 1;
+    }
+
+    char snapshot_path[64];
+    char handoff_path[108];
+    if (port == SERVER_PORT) {
+        snprintf(snapshot_path, sizeof(snapshot_path), "%s", SNAPSHOT_PATH);
+        snprintf(handoff_path, sizeof(handoff_path), "%s", HANDOFF_SOCKET_PATH);
+    } else {
+        snprintf(snapshot_path, sizeof(snapshot_path), SNAPSHOT_PATH_FMT, port);
+        snprintf(handoff_path, sizeof(handoff_path), HANDOFF_SOCKET_PATH_FMT, port);
+    }
+
     struct server_state state;
     init_server_state(&state);
 
-    int sd = udp_socket_open(SERVER_PORT);
-    if (sd < 0) {
-        fprintf(stderr, "Server failed to open UDP socket on port %d\n", SERVER_PORT);
-        perror("udp_socket_open");
-        destroy_server_state(&state);
-        return 1;
+    int sd;
+    if (takeover) {
+        sd = handoff_takeover(&state, handoff_path);
+        if (sd < 0) {
+            fprintf(stderr, "Server failed to take over from %s\n", handoff_path);
+            destroy_server_state(&state);
+            return 1;
+        }
+        printf("Took over socket and state (%zu clients)\n", state.activity.size);
+    } else {
+        int loaded = snapshot_load(&state, snapshot_path);
+        if (loaded < 0) {
+            fprintf(stderr, "Ignoring unreadable snapshot %s\n", snapshot_path);
+            destroy_server_state(&state);
+            init_server_state(&state);
+        } else if (loaded == 0) {
+            printf("Restored state from %s (%zu clients)\n", snapshot_path, state.activity.size);
+        }
+
+        sd = udp_socket_open(port);
+        if (sd < 0) {
+            fprintf(stderr, "Server failed to open UDP socket on port %d\n", port);
+            perror("udp_socket_open");
+            destroy_server_state(&state);
+            return 1;
+        }
+    }
+
+    static struct federation fed;
+    if (peer_count > 0) {
+        char default_id[FED_ID_LEN];
+        snprintf(default_id, sizeof(default_id), "127.0.0.1:%d", port);
+        if (fed_init(&fed, sd, self_id ? self_id : default_id, peers, peer_count) != 0 || fed.self < 0) {
+            fprintf(stderr, "Invalid federation configuration\n");
+            close(sd);
+            destroy_server_state(&state);
+            return 1;
+        }
+        state.fed = &fed;
     }
 
     struct listener_args args;
     args.sd = sd;
     args.state = &state;
+    atomic_init(&args.stop, 0);
+    if (pipe(args.wake_fd) < 0) {
+        perror("pipe");
+        close(sd);
+        destroy_server_state(&state);
+        return 1;
+    }
+    fcntl(args.wake_fd[0], F_SETFL, O_NONBLOCK);
+
+    struct handoff_args handoff = {
+        .sd = sd,
+        .state = &state,
+        .path = handoff_path,
+        .quiesce = quiesce_listener,
+        .resume = resume_listener,
+        .ctx = &args,
+    };
 
-    pthread_t listener;
     pthread_t pinger;
-    pthread_create(&listener, NULL, listener_thread, &args);
+    pthread_t snapshotter;
+    pthread_t handoff_listener;
+    pthread_create(&args.listener, NULL, listener_thread, &args);
     pthread_create(&pinger, NULL, ping_monitor_thread, &args);
+    struct snapshot_args snapshot = { .state = &state, .path = snapshot_path };
+    pthread_create(&snapshotter, NULL, snapshot_thread, &snapshot);
+    pthread_create(&handoff_listener, NULL, handoff_thread, &handoff);
+    if (use_shm) {
+        char shm_path[108];
+        shm_socket_path(shm_path, sizeof(shm_path), port);
+        if (shm_server_start(&shm_server, shm_path, uring_datagram, local_hangup, &args) != 0) {
+            perror("shared-memory transport");
+            use_shm = 0;
+        }
+    }
+
+    if (stats.path) {
+        stats.state = &state;
+        pthread_t stats_dumper;
+        pthread_create(&stats_dumper, NULL, stats_dump_thread, &stats);
+        pthread_detach(stats_dumper);
+    }
+
+    if (state.fed) {
+        pthread_t fed_flusher;
+        pthread_create(&fed_flusher, NULL, fed_flush_thread, state.fed);
+        pthread_detach(fed_flusher);
+        fed_send_all(state.fed, FED_OP_HELLO, NULL, NULL, NULL);
+        federation_sync(&state, -1);
+        printf("Federated as %s with %d peer(s)\n", state.fed->nodes[state.fed->self].id, peer_count);
+    }
 
-    printf("Server running on port %d...\n", SERVER_PORT);
+    printf("Server running on port %d...\n", port);
 
-    pthread_join(listener, NULL);
+    // The listener is joined by quiesce_listener during a handoff
     pthread_join(pinger, NULL);
+    pthread_join(snapshotter, NULL);
+    pthread_join(handoff_listener, NULL);
 
     destroy_server_state(&state);
     close(sd);
@@ -7,42 +7,33 @@
 #include <pthread.h>
 #include "circular_queue.h"
 #define MAX_NAME_LEN 64
-#define MAX_MUTED 16
 #define ROOM_BUCKETS 32
 #include "activity_heap.h"
 #include "room.h"
+#include "topic.h"
+#include "history.h"
+#include "client_table.h"
 
 struct chat_room;
-
-struct client_node {
-    char name[MAX_NAME_LEN];
-    struct sockaddr_in addr;
-    char muted[MAX_MUTED][MAX_NAME_LEN];
-    int muted_count;
-    time_t last_active;
-    time_t last_ping_sent;
-    int waiting_ping;
-    int heap_index;
-    struct chat_room *room;
-    struct client_node *next;
-};
+struct federation;
 
 struct server_state {
-    struct client_node *head;
+    struct client_table clients;
     pthread_rwlock_t rwlock;
     message_queue msg_queue;
+    struct history_log global_log;
     struct activity_heap activity;
     struct room_table rooms;
+    struct topic_tree topics;
+    struct federation *fed;   // NULL unless running federated
 };
 
 void init_server_state(struct server_state *s);
 void destroy_server_state(struct server_state *s);
 
-static void send_with_newline(int sd, const struct sockaddr_in *addr, const char *msg);
 void say_message(struct server_state *s, int sd, const char *msg, const char *sender_name);
 int say_to(struct server_state *s, int sd, const char *msg, const char *recipient_name, const char *sender_name);
 
-
 struct client_node *find_client_by_name(struct server_state *s, const char *name);
 struct client_node *find_client_by_addr(struct server_state *s, const struct sockaddr_in *addr);
 
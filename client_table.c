@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+#include "client_table.h"
+
+_Static_assert(sizeof(struct client_node) <= 64, "hot client record must fit one cache line");
+
+void client_table_init(struct client_table *t) {
+    memset(t, 0, sizeof(*t));
+}
+
+void client_table_destroy(struct client_table *t) {
+    for (size_t i = 0; i < t->high; ++i) client_table_free(t, client_table_at(t, i));
+    for (size_t i = 0; i < t->chunk_count; ++i) {
+        free(t->chunks[i]);
+        free(t->cold_chunks[i]);
+    }
+    free(t->chunks);
+    free(t->cold_chunks);
+    free(t->free_slots);
+    free(t->by_name);
+    memset(t, 0, sizeof(*t));
+}
+
+// Adds one chunk of hot records (cache-line aligned) and its cold records
+static int client_table_grow(struct client_table *t) {
+    size_t n = t->chunk_count + 1;
+    struct client_node **chunks = realloc(t->chunks, n * sizeof(*chunks));
+    if (!chunks) return -1;
+    t->chunks = chunks;
+    struct client_cold **cold_chunks = realloc(t->cold_chunks, n * sizeof(*cold_chunks));
+    if (!cold_chunks) return -1;
+    t->cold_chunks = cold_chunks;
+    uint32_t *free_slots = realloc(t->free_slots, n * CLIENT_CHUNK * sizeof(*free_slots));
+    if (!free_slots) return -1;
+    t->free_slots = free_slots;
+
+    struct client_node *hot = aligned_alloc(64, CLIENT_CHUNK * sizeof(*hot));
+    struct client_cold *cold = calloc(CLIENT_CHUNK, sizeof(*cold));
+    if (!hot || !cold) {
+        free(hot);
+        free(cold);
+        return -1;
+    }
+    memset(hot, 0, CLIENT_CHUNK * sizeof(*hot));
+    t->chunks[t->chunk_count] = hot;
+    t->cold_chunks[t->chunk_count] = cold;
+    t->chunk_count = n;
+    return 0;
+}
+
+struct client_node *client_table_alloc(struct client_table *t) {
+    size_t slot;
+    if (t->free_count > 0) {
+        slot = t->free_slots[--t->free_count];
+    } else {
+        if (t->high == t->chunk_count * CLIENT_CHUNK && client_table_grow(t) != 0) return NULL;
+        slot = t->high++;
+    }
+    struct client_node *c = client_table_at(t, slot);
+    struct client_cold *cold = &t->cold_chunks[slot / CLIENT_CHUNK][slot % CLIENT_CHUNK];
+    memset(c, 0, sizeof(*c));
+    memset(cold, 0, sizeof(*cold));
+    c->cold = cold;
+    c->slot = (uint32_t)slot;
+    c->heap_index = -1;
+    c->live = 1;
+    t->count++;
+    return c;
+}
+
+// ---------------- name index ----------------
+
+static size_t name_bucket(const struct client_table *t, const char *name) {
+    return intern_hash(name) & (t->name_cap - 1);
+}
+
+static void index_insert(struct client_table *t, const char *name, uint32_t slot) {
+    size_t i = name_bucket(t, name);
+    while (t->by_name[i].name) i = (i + 1) & (t->name_cap - 1);
+    t->by_name[i].name = name;
+    t->by_name[i].slot = slot;
+}
+
+// Keeps the index at most half full
+static int index_reserve(struct client_table *t) {
+    if ((t->count + 1) * 2 <= t->name_cap) return 0;
+    size_t cap = t->name_cap ? t->name_cap * 2 : CLIENT_NAME_INDEX_MIN;
+    struct client_name_slot *old = t->by_name;
+    size_t old_cap = t->name_cap;
+    t->by_name = calloc(cap, sizeof(*t->by_name));
+    if (!t->by_name) {
+        t->by_name = old;
+        return -1;
+    }
+    t->name_cap = cap;
+    for (size_t i = 0; i < old_cap; ++i)
+        if (old[i].name) index_insert(t, old[i].name, old[i].slot);
+    free(old);
+    return 0;
+}
+
+// Deletes with backward shift so probe chains never contain holes
+static void index_remove(struct client_table *t, const char *name) {
+    size_t mask = t->name_cap - 1;
+    size_t i = name_bucket(t, name);
+    while (t->by_name[i].name != name) {
+        if (!t->by_name[i].name) return;
+        i = (i + 1) & mask;
+    }
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; t->by_name[j].name; j = (j + 1) & mask) {
+        size_t home = name_bucket(t, t->by_name[j].name);
+        // Move j back unless its home lies cyclically in (hole, j]
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            t->by_name[hole] = t->by_name[j];
+            hole = j;
+        }
+    }
+    t->by_name[hole].name = NULL;
+}
+
+struct client_node *client_table_find(const struct client_table *t, const char *name) {
+    if (!name || t->name_cap == 0) return NULL;
+    for (size_t i = name_bucket(t, name); t->by_name[i].name; i = (i + 1) & (t->name_cap - 1)) {
+        if (t->by_name[i].name == name) return client_table_at(t, t->by_name[i].slot);
+    }
+    return NULL;
+}
+
+int client_table_set_name(struct client_table *t, struct client_node *c, const char *name) {
+    if (!name) return -1;
+    struct client_node *holder = client_table_find(t, name);
+    if (holder) return holder == c ? 0 : -1;
+    if (index_reserve(t) != 0) return -1;
+    const char *old = c->cold->name;
+    if (old) index_remove(t, old);
+    c->cold->name = intern_ref(name);
+    index_insert(t, c->cold->name, c->slot);
+    intern_release(old);
+    return 0;
+}
+
+void client_table_free(struct client_table *t, struct client_node *c) {
+    if (!c || !c->live) return;
+    struct client_cold *cold = c->cold;
+    if (cold->name) {
+        index_remove(t, cold->name);
+        intern_release(cold->name);
+        cold->name = NULL;
+    }
+    for (int i = 0; i < c->muted_count; ++i) intern_release(cold->muted[i]);
+    c->live = 0;
+    c->rooms = NULL;
+    c->room_count = 0;
+    c->muted_count = 0;
+    c->coalescing = 0;
+    cold->topics = NULL;
+    cold->coalesce = NULL;
+    cold->topic_count = 0;
+    t->free_slots[t->free_count++] = c->slot;
+    t->count--;
+}
@@ -0,0 +1,90 @@
+#ifndef CLIENT_TABLE_H
+#define CLIENT_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "intern.h"
+
+#define MAX_MUTED 16
+#define CLIENT_CHUNK 1024            // records per chunk (64 KiB of hot data)
+#define CLIENT_NAME_INDEX_MIN 1024   // initial name index buckets (power of two)
+
+struct room_member;
+struct coalesce_buf;
+
+// Per-client state is split by access frequency. The hot record holds what
+// every broadcast, keepalive and activity update touches and fits in one
+// cache line; records are packed in chunked arrays so a broadcast walks
+// memory sequentially. The cold record (name, mute list) is only read when
+// a client is addressed by name or has muted someone. Names are interned
+// handles (intern.h) and every one stored here holds a reference. Topic
+// subscriptions (topic.h) live here too: only (un)subscribing touches them.
+// So does the coalescing buffer (coalesce.h), which its owner closes
+// before freeing the client.
+struct client_cold {
+    const char *name;
+    const char *muted[MAX_MUTED];
+    struct room_member *topics;      // subscriptions, most recent first
+    struct coalesce_buf *coalesce;   // set while ->coalescing
+    uint8_t topic_count;
+};
+
+struct client_node {
+    struct sockaddr_in addr;
+    time_t last_active;
+    uint64_t ping_sent_ns;           // monotonic; drives the ping timeout and RTT histogram
+    struct room_member *rooms;       // memberships, most recent join first
+    struct client_cold *cold;        // fixed per slot, stays valid after the client leaves
+    int heap_index;
+    uint32_t slot;
+    uint8_t live;
+    uint8_t waiting_ping;
+    uint8_t muted_count;             // entries used in cold->muted
+    uint8_t room_count;
+    uint8_t coalescing;              // records go through cold->coalesce
+};
+
+struct client_name_slot {
+    const char *name;                // NULL = empty bucket
+    uint32_t slot;
+};
+
+// Slots are never moved, so client_node pointers held by the activity heap
+// and room member lists stay valid; freed slots are reused before the
+// table grows. Clients are also indexed by name handle (open addressing
+// on the interned hash, linear probing).
+struct client_table {
+    struct client_node **chunks;
+    struct client_cold **cold_chunks;
+    size_t chunk_count;
+    size_t high;                     // slots handed out so far: the iteration bound
+    size_t count;                    // live clients
+    uint32_t *free_slots;
+    size_t free_count;
+    struct client_name_slot *by_name;
+    size_t name_cap;
+};
+
+void client_table_init(struct client_table *t);
+void client_table_destroy(struct client_table *t);
+
+// Returns a cleared, live record (heap_index -1), or NULL when out of memory
+struct client_node *client_table_alloc(struct client_table *t);
+// Also releases the client's name and mute handles
+void client_table_free(struct client_table *t, struct client_node *c);
+
+// Client holding the name handle <name>, or NULL
+struct client_node *client_table_find(const struct client_table *t, const char *name);
+
+// Gives <c> the handle <name> (taking a reference) and re-indexes it;
+// -1 when another client holds the name or the index cannot grow
+int client_table_set_name(struct client_table *t, struct client_node *c, const char *name);
+
+// Slot <i> below t->high; check ->live before using it
+static inline struct client_node *client_table_at(const struct client_table *t, size_t i) {
+    return &t->chunks[i / CLIENT_CHUNK][i % CLIENT_CHUNK];
+}
+
+#endif // CLIENT_TABLE_H
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "coalesce.h"
+
+struct coalesce_bucket {
+    pthread_mutex_t lock;
+    struct coalesce_buf *head;
+};
+
+struct coalescer {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;             // on CLOCK_MONOTONIC
+    struct coalesce_buf *due;        // buffers holding records, unordered
+    uint64_t due_deadline;           // earliest deadline queued since the flusher took the list
+    coalesce_send_fn send;
+    pthread_once_t once;
+    int started;
+    atomic_int open;                 // buffers in the index; 0 skips coalesce_flush_addr
+    struct coalesce_bucket index[COALESCE_INDEX_BUCKETS];
+};
+
+static struct coalescer co = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+    .due_deadline = UINT64_MAX,
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static struct coalesce_bucket *bucket_of(const struct sockaddr_in *addr) {
+    uint32_t h = ntohl(addr->sin_addr.s_addr) * 2654435761u ^ ntohs(addr->sin_port);
+    return &co.index[h % COALESCE_INDEX_BUCKETS];
+}
+
+static void free_buf(struct coalesce_buf *b) {
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
+
+// Sends every buffer whose window has expired and sleeps until the
+// earliest one still waiting, or until a buffer gets its first record
+static void *flusher_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&co.lock);
+    for (;;) {
+        while (!co.due) pthread_cond_wait(&co.wake, &co.lock);
+        struct coalesce_buf *list = co.due;
+        co.due = NULL;
+        co.due_deadline = UINT64_MAX;
+        pthread_mutex_unlock(&co.lock);
+
+        uint64_t now = now_ns();
+        uint64_t next = UINT64_MAX;
+        struct coalesce_buf *keep = NULL, *keep_tail = NULL;
+        while (list) {
+            struct coalesce_buf *b = list;
+            list = b->next;
+            pthread_mutex_lock(&b->lock);
+            if (b->closed) {
+                pthread_mutex_unlock(&b->lock);
+                free_buf(b);
+                continue;
+            }
+            if (b->len > 0 && b->deadline_ns > now) {
+                if (b->deadline_ns < next) next = b->deadline_ns;
+                b->next = NULL;
+                if (keep_tail) keep_tail->next = b;
+                else keep = b;
+                keep_tail = b;
+                pthread_mutex_unlock(&b->lock);
+                continue;
+            }
+            if (b->len > 0) co.send(b->sd, &b->addr, b->data, b->len);
+            b->len = 0;
+            b->queued = 0;
+            pthread_mutex_unlock(&b->lock);
+        }
+
+        pthread_mutex_lock(&co.lock);
+        if (keep) {
+            // Buffers queued while we worked unlocked signalled nobody: their
+            // deadlines were recorded in due_deadline instead
+            if (co.due_deadline < next) next = co.due_deadline;
+            keep_tail->next = co.due;
+            co.due = keep;
+            struct timespec until = { .tv_sec = (time_t)(next / 1000000000ull),
+                                      .tv_nsec = (long)(next % 1000000000ull) };
+            pthread_cond_timedwait(&co.wake, &co.lock, &until);
+        }
+    }
+    return NULL;
+}
+
+static void start_flusher(void) {
+    for (int i = 0; i < COALESCE_INDEX_BUCKETS; ++i) pthread_mutex_init(&co.index[i].lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&co.wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flusher_thread, NULL) != 0) return;
+    pthread_detach(thread);
+    co.started = 1;
+}
+
+void coalesce_init(coalesce_send_fn send) {
+    co.send = send;
+}
+
+struct coalesce_buf *coalesce_open(const struct sockaddr_in *addr, unsigned window_ms) {
+    if (!co.send) return NULL;
+    pthread_once(&co.once, start_flusher);
+    if (!co.started) return NULL;
+    struct coalesce_buf *b = calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    pthread_mutex_init(&b->lock, NULL);
+    b->addr = *addr;
+    b->sd = -1;
+    b->window_ms = window_ms;
+    struct coalesce_bucket *bucket = bucket_of(addr);
+    pthread_mutex_lock(&bucket->lock);
+    b->index_next = bucket->head;
+    bucket->head = b;
+    pthread_mutex_unlock(&bucket->lock);
+    atomic_fetch_add(&co.open, 1);
+    return b;
+}
+
+void coalesce_set_window(struct coalesce_buf *b, unsigned window_ms) {
+    pthread_mutex_lock(&b->lock);
+    b->window_ms = window_ms;
+    pthread_mutex_unlock(&b->lock);
+}
+
+// Caller holds b->lock
+static void send_buffered(struct coalesce_buf *b) {
+    if (b->len > 0) co.send(b->sd, &b->addr, b->data, b->len);
+    b->len = 0;
+}
+
+void coalesce_flush(struct coalesce_buf *b) {
+    if (!b) return;
+    pthread_mutex_lock(&b->lock);
+    send_buffered(b);
+    pthread_mutex_unlock(&b->lock);
+}
+
+void coalesce_flush_addr(const struct sockaddr_in *addr) {
+    if (atomic_load_explicit(&co.open, memory_order_relaxed) == 0) return;
+    struct coalesce_bucket *bucket = bucket_of(addr);
+    pthread_mutex_lock(&bucket->lock);
+    struct coalesce_buf *b = bucket->head;
+    while (b && (b->addr.sin_addr.s_addr != addr->sin_addr.s_addr || b->addr.sin_port != addr->sin_port))
+        b = b->index_next;
+    // Locked before the bucket is released, so coalesce_close waits for us
+    if (b) pthread_mutex_lock(&b->lock);
+    pthread_mutex_unlock(&bucket->lock);
+    if (!b) return;
+    send_buffered(b);
+    pthread_mutex_unlock(&b->lock);
+}
+
+void coalesce_close(struct coalesce_buf *b) {
+    if (!b) return;
+    struct coalesce_bucket *bucket = bucket_of(&b->addr);
+    pthread_mutex_lock(&bucket->lock);
+    struct coalesce_buf **link = &bucket->head;
+    while (*link != b) link = &(*link)->index_next;
+    *link = b->index_next;
+    pthread_mutex_unlock(&bucket->lock);
+    atomic_fetch_sub(&co.open, 1);
+    pthread_mutex_lock(&b->lock);
+    if (b->queued) {
+        b->closed = 1;
+        pthread_mutex_unlock(&b->lock);
+        return;
+    }
+    pthread_mutex_unlock(&b->lock);
+    free_buf(b);
+}
+
+// Sends under the buffer lock, so a record can never overtake one that
+// was buffered before it
+void coalesce_add(struct coalesce_buf *b, int sd, const char *rec, size_t len) {
+    pthread_mutex_lock(&b->lock);
+    if (b->len > 0 && (b->len + len > COALESCE_PAYLOAD || sd != b->sd)) send_buffered(b);
+    b->sd = sd;
+    if (len > COALESCE_PAYLOAD) {
+        co.send(sd, &b->addr, (char *)rec, len);
+        pthread_mutex_unlock(&b->lock);
+        return;
+    }
+    if (b->len == 0) b->deadline_ns = now_ns() + (uint64_t)b->window_ms * 1000000ull;
+    memcpy(b->data + b->len, rec, len);
+    b->len += len;
+    if (!b->queued) {
+        b->queued = 1;
+        pthread_mutex_lock(&co.lock);
+        b->next = co.due;
+        co.due = b;
+        if (b->deadline_ns < co.due_deadline) co.due_deadline = b->deadline_ns;
+        pthread_cond_signal(&co.wake);
+        pthread_mutex_unlock(&co.lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
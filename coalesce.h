@@ -0,0 +1,55 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "udp.h"
+
+// Opt-in per-recipient coalescing. A client that asked for a window gets
+// its records appended to a buffer instead of sent one datagram each; the
+// buffer leaves as a single datagram of '\n'-separated records when the
+// next record would not fit, or when its oldest record has waited for the
+// window. One flusher thread sends the buffers whose window has expired.
+
+#define COALESCE_MAX_MS 20                   // longest window a client may ask for
+#define COALESCE_PAYLOAD (BUFFER_SIZE - 1)   // packed datagram limit, as for history replies
+#define COALESCE_INDEX_BUCKETS 256           // open buffers by address, for coalesce_flush_addr
+
+// Same shape as the server's send_datagram
+typedef void (*coalesce_send_fn)(int sd, const struct sockaddr_in *addr, char *buf, size_t len);
+
+struct coalesce_buf {
+    pthread_mutex_t lock;
+    struct coalesce_buf *next;       // on the flusher's list
+    struct coalesce_buf *index_next; // on its address bucket
+    struct sockaddr_in addr;
+    int sd;                          // socket of the last record's sender
+    unsigned window_ms;
+    uint64_t deadline_ns;            // oldest record + window (monotonic)
+    uint8_t queued;                  // on the flusher's list, or being flushed
+    uint8_t closed;                  // owner left while queued: the flusher frees it
+    size_t len;
+    char data[COALESCE_PAYLOAD];
+};
+
+// Sets how the flusher sends; call once before any buffer is opened
+void coalesce_init(coalesce_send_fn send);
+
+// NULL when out of memory or the flusher cannot start
+struct coalesce_buf *coalesce_open(const struct sockaddr_in *addr, unsigned window_ms);
+void coalesce_set_window(struct coalesce_buf *b, unsigned window_ms);
+// Sends anything still buffered now, from the calling thread
+void coalesce_flush(struct coalesce_buf *b);
+// Same for the open buffer of <addr>, if any. A direct send to a client
+// calls this first, so it cannot overtake records buffered before it.
+void coalesce_flush_addr(const struct sockaddr_in *addr);
+// Drops anything still buffered; flush first to deliver it
+void coalesce_close(struct coalesce_buf *b);
+
+// Appends one record, first sending the buffered datagram from the calling
+// thread when the record does not fit
+void coalesce_add(struct coalesce_buf *b, int sd, const char *rec, size_t len);
+
+#endif // COALESCE_H
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include "fanout.h"
+#include "pool.h"
+
+static struct pool job_pool = POOL_INITIALIZER("fanout_job", struct fanout_job);
+
+struct fanout_job *fanout_job_create(fanout_visit_fn visit, void *ctx, size_t total, size_t chunk) {
+    struct fanout_job *job = pool_alloc(&job_pool);
+    if (!job) return NULL;
+    job->visit = visit;
+    job->ctx = ctx;
+    job->total = total;
+    job->chunk = chunk ? chunk : FANOUT_CHUNK;
+    atomic_init(&job->next, 0);
+    atomic_init(&job->done, 0);
+    atomic_init(&job->sent, 0);
+    atomic_init(&job->refs, 1);
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+    return job;
+}
+
+struct fanout_job *fanout_job_ref(struct fanout_job *job) {
+    atomic_fetch_add(&job->refs, 1);
+    return job;
+}
+
+void fanout_job_release(struct fanout_job *job) {
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->finished);
+    pool_free(&job_pool, job);
+}
+
+int fanout_run(struct fanout_job *job) {
+    int chunks = 0;
+    for (;;) {
+        size_t begin = atomic_fetch_add(&job->next, job->chunk);
+        if (begin >= job->total) return chunks;
+        size_t end = begin + job->chunk < job->total ? begin + job->chunk : job->total;
+        atomic_fetch_add(&job->sent, job->visit(job->ctx, begin, end));
+        chunks++;
+        if (atomic_fetch_add(&job->done, end - begin) + (end - begin) == job->total) {
+            pthread_mutex_lock(&job->lock);
+            pthread_cond_broadcast(&job->finished);
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+}
+
+uint64_t fanout_wait(struct fanout_job *job) {
+    fanout_run(job);
+    pthread_mutex_lock(&job->lock);
+    while (atomic_load(&job->done) < job->total) pthread_cond_wait(&job->finished, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+    return atomic_load(&job->sent);
+}
+
+// ---------------- batched sends ----------------
+
+void fanout_batch_init(struct fanout_batch *b, int sd, const void *buf, size_t len) {
+    b->sd = sd;
+    b->iov.iov_base = (void *)buf;
+    b->iov.iov_len = len;
+    b->count = 0;
+    b->packets = 0;
+}
+
+void fanout_batch_add(struct fanout_batch *b, const struct sockaddr_in *addr) {
+    struct mmsghdr *m = &b->msgs[b->count];
+    memset(m, 0, sizeof(*m));
+    b->addrs[b->count] = *addr;
+    m->msg_hdr.msg_name = &b->addrs[b->count];
+    m->msg_hdr.msg_namelen = sizeof(*addr);
+    m->msg_hdr.msg_iov = &b->iov;
+    m->msg_hdr.msg_iovlen = 1;
+    if (++b->count == FANOUT_SEND_BATCH) fanout_batch_flush(b);
+}
+
+// A datagram the kernel refuses is skipped, as a failed sendto would be
+void fanout_batch_flush(struct fanout_batch *b) {
+    int off = 0;
+    while (off < b->count) {
+        int n = sendmmsg(b->sd, b->msgs + off, (unsigned)(b->count - off), 0);
+        if (n > 0) {
+            off += n;
+            b->packets += (uint64_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            off++;
+        }
+    }
+    b->count = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Parallel fan-out. A large broadcast becomes a job over its recipient
+// range; the thread that owns the job and any helper threads it wakes
+// claim fixed-size chunks from a shared atomic cursor until none are left,
+// so a helper that arrives late or a chunk that sends slowly never holds
+// the others up. The owner keeps whatever lock protects the recipients
+// until fanout_wait returns, so chunks read them without locking.
+
+#define FANOUT_THRESHOLD 4096        // default recipients before a broadcast is split
+#define FANOUT_CHUNK 1024            // recipients per claimed chunk
+#define FANOUT_MAX_HELPERS 15        // helper threads woken per job
+#define FANOUT_SEND_BATCH 64         // datagrams per sendmmsg
+
+// Sends to recipients [begin, end) of <ctx>; returns how many it sent to
+typedef uint64_t (*fanout_visit_fn)(void *ctx, size_t begin, size_t end);
+
+// Reference-counted: the owner and every helper it queued hold one, so a
+// helper that is dequeued after the job finished can still look at it
+struct fanout_job {
+    fanout_visit_fn visit;
+    void *ctx;                       // only read while chunks remain
+    size_t total;
+    size_t chunk;
+    atomic_size_t next;              // first unclaimed recipient
+    atomic_size_t done;              // recipients in finished chunks
+    atomic_uint_fast64_t sent;
+    atomic_int refs;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+};
+
+// NULL when out of memory; the caller holds the first reference
+struct fanout_job *fanout_job_create(fanout_visit_fn visit, void *ctx, size_t total, size_t chunk);
+struct fanout_job *fanout_job_ref(struct fanout_job *job);
+void fanout_job_release(struct fanout_job *job);
+
+// Claims and runs chunks until none are left; returns the chunks it ran
+int fanout_run(struct fanout_job *job);
+
+// Owner side: runs chunks too, then waits for those still in flight on
+// helpers. Returns the total sent.
+uint64_t fanout_wait(struct fanout_job *job);
+
+// One payload to many addresses, sent FANOUT_SEND_BATCH at a time
+struct fanout_batch {
+    int sd;
+    struct iovec iov;
+    struct mmsghdr msgs[FANOUT_SEND_BATCH];
+    struct sockaddr_in addrs[FANOUT_SEND_BATCH];
+    int count;
+    uint64_t packets;                // datagrams the kernel accepted
+};
+
+void fanout_batch_init(struct fanout_batch *b, int sd, const void *buf, size_t len);
+// Flushes by itself when the batch fills
+void fanout_batch_add(struct fanout_batch *b, const struct sockaddr_in *addr);
+void fanout_batch_flush(struct fanout_batch *b);
+
+#endif // FANOUT_H
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "federation.h"
+#include "metrics.h"
+
+#define FED_PREFIX "fed$"
+#define FED_PREFIX_LEN 4
+
+// FNV-1a; stable across nodes so every member computes the same ring
+static uint32_t fed_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int fed_parse_id(const char *id, struct sockaddr_in *addr) {
+    char ip[FED_ID_LEN];
+    const char *colon = strrchr(id, ':');
+    if (!colon || (size_t)(colon - id) >= sizeof(ip)) return -1;
+    memcpy(ip, id, (size_t)(colon - id));
+    ip[colon - id] = '\0';
+    int port = atoi(colon + 1);
+    if (port <= 0 || port > 65535) return -1;
+    return set_socket_addr(addr, ip, port);
+}
+
+static int fed_cmp_peer(const void *a, const void *b) {
+    return strcmp(((const struct fed_peer *)a)->id, ((const struct fed_peer *)b)->id);
+}
+
+static int fed_cmp_vnode(const void *a, const void *b) {
+    uint32_t x = ((const struct fed_vnode *)a)->hash;
+    uint32_t y = ((const struct fed_vnode *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+static void fed_dir_init(struct fed_dir *dir) {
+    pthread_rwlock_init(&dir->lock, NULL);
+    memset(dir->buckets, 0, sizeof(dir->buckets));
+}
+
+static void fed_dir_destroy(struct fed_dir *dir) {
+    for (int i = 0; i < FED_DIR_BUCKETS; ++i) {
+        struct fed_dir_entry *e = dir->buckets[i];
+        while (e) {
+            struct fed_dir_entry *next = e->next;
+            free(e);
+            e = next;
+        }
+        dir->buckets[i] = NULL;
+    }
+    pthread_rwlock_destroy(&dir->lock);
+}
+
+// Returns the slot holding <key>, or the terminating NULL slot of its bucket
+static struct fed_dir_entry **fed_dir_slot(struct fed_dir *dir, const char *key) {
+    struct fed_dir_entry **ind = &dir->buckets[fed_hash(key) % FED_DIR_BUCKETS];
+    while (*ind && strncmp((*ind)->key, key, sizeof((*ind)->key)) != 0)
+        ind = &(*ind)->next;
+    return ind;
+}
+
+int fed_dir_get(struct fed_dir *dir, const char *key, uint32_t *value) {
+    pthread_rwlock_rdlock(&dir->lock);
+    struct fed_dir_entry *e = *fed_dir_slot(dir, key);
+    if (e && value) *value = e->value;
+    pthread_rwlock_unlock(&dir->lock);
+    return e ? 0 : -1;
+}
+
+static void fed_dir_set_locked(struct fed_dir *dir, const char *key, uint32_t value) {
+    struct fed_dir_entry **slot = fed_dir_slot(dir, key);
+    if (*slot) {
+        (*slot)->value = value;
+        return;
+    }
+    struct fed_dir_entry *e = calloc(1, sizeof(*e));
+    if (!e) return;
+    strncpy(e->key, key, sizeof(e->key) - 1);
+    e->value = value;
+    *slot = e;
+}
+
+static void fed_dir_del_locked(struct fed_dir *dir, const char *key) {
+    struct fed_dir_entry **slot = fed_dir_slot(dir, key);
+    if (!*slot) return;
+    struct fed_dir_entry *del = *slot;
+    *slot = del->next;
+    free(del);
+}
+
+void fed_dir_set(struct fed_dir *dir, const char *key, uint32_t value) {
+    pthread_rwlock_wrlock(&dir->lock);
+    fed_dir_set_locked(dir, key, value);
+    pthread_rwlock_unlock(&dir->lock);
+}
+
+void fed_dir_del(struct fed_dir *dir, const char *key) {
+    pthread_rwlock_wrlock(&dir->lock);
+    fed_dir_del_locked(dir, key);
+    pthread_rwlock_unlock(&dir->lock);
+}
+
+// Builds the hash ring and directories once nodes[] is in its final order
+static void fed_build(struct federation *fed) {
+    for (int i = 0; i < fed->node_count; ++i) {
+        pthread_mutex_init(&fed->nodes[i].lock, NULL);
+        for (int v = 0; v < FED_VNODES; ++v) {
+            char label[FED_ID_LEN + 16];
+            snprintf(label, sizeof(label), "%s#%d", fed->nodes[i].id, v);
+            fed->ring[fed->ring_size].hash = fed_hash(label);
+            fed->ring[fed->ring_size].node = i;
+            fed->ring_size++;
+        }
+    }
+    qsort(fed->ring, (size_t)fed->ring_size, sizeof(fed->ring[0]), fed_cmp_vnode);
+    fed_dir_init(&fed->users);
+    fed_dir_init(&fed->interest);
+    fed_dir_init(&fed->remote_rooms);
+}
+
+// Sets up peers (sorted so all nodes agree on indices) and the hash ring
+int fed_init(struct federation *fed, int sd, const char *self_id,
+             const char **peer_ids, int peer_count) {
+    memset(fed, 0, sizeof(*fed));
+    if (peer_count + 1 > FED_MAX_NODES) return -1;
+    fed->sd = sd;
+    fed->node_count = peer_count + 1;
+    for (int i = 0; i < fed->node_count; ++i) {
+        const char *id = i == 0 ? self_id : peer_ids[i - 1];
+        strncpy(fed->nodes[i].id, id, FED_ID_LEN - 1);
+        if (fed_parse_id(id, &fed->nodes[i].addr) != 0) {
+            fprintf(stderr, "federation: bad node address %s (want ip:port)\n", id);
+            return -1;
+        }
+    }
+    qsort(fed->nodes, (size_t)fed->node_count, sizeof(fed->nodes[0]), fed_cmp_peer);
+    fed->self = -1;
+    for (int i = 0; i < fed->node_count; ++i) {
+        if (strcmp(fed->nodes[i].id, self_id) == 0) fed->self = i;
+    }
+    fed_build(fed);
+    return 0;
+}
+
+int fed_init_local(struct federation *fed, int self, int count,
+                   fed_deliver_fn deliver, void *ctx) {
+    memset(fed, 0, sizeof(*fed));
+    if (count > FED_MAX_NODES || self < 0 || self >= count) return -1;
+    fed->sd = -1;
+    fed->deliver = deliver;
+    fed->deliver_ctx = ctx;
+    fed->node_count = count;
+    fed->self = self;
+    for (int i = 0; i < count; ++i) {
+        snprintf(fed->nodes[i].id, FED_ID_LEN, "shard-%02d", i);
+        set_socket_addr(&fed->nodes[i].addr, NULL, i + 1);
+    }
+    fed_build(fed);
+    return 0;
+}
+
+void fed_destroy(struct federation *fed) {
+    for (int i = 0; i < fed->node_count; ++i)
+        pthread_mutex_destroy(&fed->nodes[i].lock);
+    fed_dir_destroy(&fed->users);
+    fed_dir_destroy(&fed->interest);
+    fed_dir_destroy(&fed->remote_rooms);
+}
+
+int fed_node_by_addr(const struct federation *fed, const struct sockaddr_in *addr) {
+    for (int i = 0; i < fed->node_count; ++i) {
+        if (i != fed->self &&
+            fed->nodes[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            fed->nodes[i].addr.sin_port == addr->sin_port)
+            return i;
+    }
+    return -1;
+}
+
+// Consistent hashing: the first virtual node clockwise from hash(room)
+int fed_room_owner(const struct federation *fed, const char *room) {
+    uint32_t h = fed_hash(room);
+    int lo = 0, hi = fed->ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (fed->ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == fed->ring_size) lo = 0;
+    return fed->ring[lo].node;
+}
+
+static void fed_flush_peer(struct federation *fed, struct fed_peer *peer) {
+    if (peer->len <= FED_PREFIX_LEN) return;
+    if (fed->deliver) {
+        fed->deliver(fed->deliver_ctx, (int)(peer - fed->nodes), peer->batch, peer->len);
+    } else if (udp_socket_write(fed->sd, &peer->addr, peer->batch, (int)peer->len) >= 0) {
+        metrics_count(METRIC_PACKETS_OUT, 1);
+        metrics_count(METRIC_BYTES_OUT, peer->len);
+    }
+    peer->len = 0;
+}
+
+static int fed_field_ok(const char *s) {
+    return !s || s[strcspn(s, "\n\x1f")] == '\0';
+}
+
+// Appends one line to the peer's batch; batches leave when full or on the
+// next flush tick, so a burst to one peer costs one datagram.
+void fed_send(struct federation *fed, int node, char op,
+              const char *a, const char *b, const char *c) {
+    if (node < 0 || node >= fed->node_count || node == fed->self) return;
+    if (!fed_field_ok(a) || !fed_field_ok(b) || !fed_field_ok(c)) return;
+    char line[BUFFER_SIZE];
+    int n = snprintf(line, sizeof(line), "%c%c%s%c%s%c%s", op, FED_SEP,
+                     a ? a : "", FED_SEP, b ? b : "", FED_SEP, c ? c : "");
+    if (n < 0) return;
+    size_t len = (size_t)n;
+    size_t cap = BUFFER_SIZE - 1 - FED_PREFIX_LEN - 1;
+    if (len > cap) len = cap;
+    line[len++] = '\n';
+
+    struct fed_peer *peer = &fed->nodes[node];
+    pthread_mutex_lock(&peer->lock);
+    if (peer->len + len > BUFFER_SIZE - 1) fed_flush_peer(fed, peer);
+    if (peer->len == 0) {
+        memcpy(peer->batch, FED_PREFIX, FED_PREFIX_LEN);
+        peer->len = FED_PREFIX_LEN;
+    }
+    memcpy(peer->batch + peer->len, line, len);
+    peer->len += len;
+    pthread_mutex_unlock(&peer->lock);
+}
+
+void fed_send_all(struct federation *fed, char op,
+                  const char *a, const char *b, const char *c) {
+    for (int i = 0; i < fed->node_count; ++i)
+        fed_send(fed, i, op, a, b, c);
+}
+
+void fed_flush(struct federation *fed) {
+    for (int i = 0; i < fed->node_count; ++i) {
+        if (i == fed->self) continue;
+        pthread_mutex_lock(&fed->nodes[i].lock);
+        fed_flush_peer(fed, &fed->nodes[i]);
+        pthread_mutex_unlock(&fed->nodes[i].lock);
+    }
+}
+
+void *fed_flush_thread(void *arg) {
+    struct federation *fed = arg;
+    while (1) {
+        usleep(FED_FLUSH_USEC);
+        fed_flush(fed);
+    }
+    return NULL;
+}
+
+// Splits the next line off <cursor> (the text after "fed$"). Returns 0 when
+// a message was parsed, -1 at the end of the datagram.
+int fed_next(char **cursor, struct fed_msg *msg) {
+    char *line = *cursor;
+    while (*line == '\n') line++;
+    if (*line == '\0') return -1;
+    char *nl = strchr(line, '\n');
+    if (nl) {
+        *nl = '\0';
+        *cursor = nl + 1;
+    } else {
+        *cursor = line + strlen(line);
+    }
+    msg->op = line[0];
+    msg->fields = 0;
+    char *fields[FED_FIELDS] = { "", "", "" };
+    char *p = line[1] == FED_SEP ? line + 2 : NULL;
+    while (p) {
+        char *sep = strchr(p, FED_SEP);
+        if (sep) *sep = '\0';
+        if (msg->fields < FED_FIELDS) fields[msg->fields] = p;
+        msg->fields++;
+        p = sep ? sep + 1 : NULL;
+    }
+    msg->a = fields[0];
+    msg->b = fields[1];
+    msg->c = fields[2];
+    return 0;
+}
+
+// Owner side: tracks which nodes host members of <room> and tells everyone
+// when the room starts or stops existing anywhere in the federation.
+void fed_room_interest(struct federation *fed, const char *room, int node, int on) {
+    pthread_rwlock_wrlock(&fed->interest.lock);
+    struct fed_dir_entry *e = *fed_dir_slot(&fed->interest, room);
+    uint32_t before = e ? e->value : 0;
+    uint32_t after = on ? before | (1u << node) : before & ~(1u << node);
+    if (after) fed_dir_set_locked(&fed->interest, room, after);
+    else fed_dir_del_locked(&fed->interest, room);
+    pthread_rwlock_unlock(&fed->interest.lock);
+
+    if (!before && after) fed_send_all(fed, FED_OP_ROOM_NEW, room, NULL, NULL);
+    else if (before && !after) fed_send_all(fed, FED_OP_ROOM_GONE, room, NULL, NULL);
+}
+
+// Called when a local room view is created (<on>) or destroyed
+void fed_local_room(struct federation *fed, const char *room, int on) {
+    int owner = fed_room_owner(fed, room);
+    if (owner == fed->self) fed_room_interest(fed, room, fed->self, on);
+    else fed_send(fed, owner, on ? FED_OP_ROOM_ON : FED_OP_ROOM_OFF, room, NULL, NULL);
+}
+
+// Owner side: forwards a sequenced room message to every other member node
+void fed_room_cast(struct federation *fed, const char *room,
+                   const char *sender, const char *text) {
+    uint32_t mask = 0;
+    if (fed_dir_get(&fed->interest, room, &mask) != 0) return;
+    for (int i = 0; i < fed->node_count; ++i) {
+        if (i != fed->self && (mask & (1u << i)))
+            fed_send(fed, i, FED_OP_ROOM_CAST, room, sender, text);
+    }
+}
+
+// Tells <node> about every live room we own (used when it says hello)
+void fed_announce_rooms(struct federation *fed, int node) {
+    pthread_rwlock_rdlock(&fed->interest.lock);
+    for (int i = 0; i < FED_DIR_BUCKETS; ++i) {
+        for (struct fed_dir_entry *e = fed->interest.buckets[i]; e; e = e->next)
+            fed_send(fed, node, FED_OP_ROOM_NEW, e->key, NULL, NULL);
+    }
+    pthread_rwlock_unlock(&fed->interest.lock);
+}
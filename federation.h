@@ -0,0 +1,117 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "udp.h"
+
+#define FED_MAX_NODES 16
+#define FED_VNODES 64
+#define FED_DIR_BUCKETS 256
+#define FED_FLUSH_USEC 2000
+#define FED_ID_LEN 32
+#define FED_SEP '\x1f'   // field separator inside a forwarded line
+#define FED_FIELDS 3     // every line is <op> then exactly this many fields
+
+// Wire ops, one per line of a "fed$" datagram
+#define FED_OP_HELLO      'H'   // H                      peer (re)joined: resend your view
+#define FED_OP_USER_ON    'U'   // U name                 user connected on sender
+#define FED_OP_USER_OFF   'u'   // u name                 user left sender
+#define FED_OP_SAY        'S'   // S sender text          global broadcast
+#define FED_OP_SAYTO      'P'   // P recipient sender text
+#define FED_OP_ROOM_ON    'R'   // R room                 sender has members (sent to owner)
+#define FED_OP_ROOM_OFF   'r'   // r room                 sender has no members (sent to owner)
+#define FED_OP_ROOM_NEW   'X'   // X room                 room exists somewhere (from owner)
+#define FED_OP_ROOM_GONE  'x'   // x room                 room vanished everywhere (from owner)
+#define FED_OP_ROOM_SAY   'T'   // T room sender text     room message for the owner to sequence
+#define FED_OP_ROOM_CAST  'C'   // C room sender text     owner fan-out to member nodes
+#define FED_OP_PUB        'B'   // B topic sender text    publication for local subscribers
+
+struct fed_peer {
+    char id[FED_ID_LEN];
+    struct sockaddr_in addr;
+    pthread_mutex_t lock;
+    char batch[BUFFER_SIZE];
+    size_t len;
+};
+
+struct fed_vnode {
+    uint32_t hash;
+    int node;
+};
+
+// String-keyed map used for the user directory, owner-side room interest
+// masks and the set of rooms that exist on other nodes
+struct fed_dir_entry {
+    char key[64];
+    uint32_t value;
+    struct fed_dir_entry *next;
+};
+
+struct fed_dir {
+    pthread_rwlock_t lock;
+    struct fed_dir_entry *buckets[FED_DIR_BUCKETS];
+};
+
+// Hands a finished batch to in-process node <node> instead of the socket
+typedef void (*fed_deliver_fn)(void *ctx, int node, const char *batch, size_t len);
+
+struct federation {
+    int sd;
+    fed_deliver_fn deliver;      // NULL: batches go out over UDP
+    void *deliver_ctx;
+    int self;
+    int node_count;
+    struct fed_peer nodes[FED_MAX_NODES];   // sorted by id; nodes[self] is us
+    struct fed_vnode ring[FED_MAX_NODES * FED_VNODES];
+    int ring_size;
+    struct fed_dir users;        // name -> node index
+    struct fed_dir interest;     // room -> bitmask of nodes with members (rooms we own)
+    struct fed_dir remote_rooms; // rooms known to exist elsewhere
+};
+
+// A parsed line of a federation datagram; fields point into the datagram
+struct fed_msg {
+    char op;
+    int fields;                  // FED_FIELDS unless the line is malformed
+    char *a;
+    char *b;
+    char *c;
+};
+
+int fed_init(struct federation *fed, int sd, const char *self_id,
+             const char **peer_ids, int peer_count);
+// In-process federation of <count> shards named shard-00.. (node index ==
+// shard index), reached through <deliver>. Their synthetic addresses are
+// 0.0.0.0:<index + 1>, which no datagram can come from.
+int fed_init_local(struct federation *fed, int self, int count,
+                   fed_deliver_fn deliver, void *ctx);
+void fed_destroy(struct federation *fed);
+
+int fed_node_by_addr(const struct federation *fed, const struct sockaddr_in *addr);
+int fed_room_owner(const struct federation *fed, const char *room);
+
+// Fields holding '\n' or FED_SEP would split into extra lines or fields on
+// the peer, so such an op is dropped rather than forwarded
+void fed_send(struct federation *fed, int node, char op,
+              const char *a, const char *b, const char *c);
+void fed_send_all(struct federation *fed, char op,
+                  const char *a, const char *b, const char *c);
+void fed_flush(struct federation *fed);
+void *fed_flush_thread(void *arg);
+
+int fed_next(char **cursor, struct fed_msg *msg);
+
+int fed_dir_get(struct fed_dir *dir, const char *key, uint32_t *value);
+void fed_dir_set(struct fed_dir *dir, const char *key, uint32_t value);
+void fed_dir_del(struct fed_dir *dir, const char *key);
+
+void fed_room_cast(struct federation *fed, const char *room,
+                   const char *sender, const char *text);
+void fed_announce_rooms(struct federation *fed, int node);
+void fed_room_interest(struct federation *fed, const char *room, int node, int on);
+void fed_local_room(struct federation *fed, const char *room, int on);
+
+#endif // FEDERATION_H
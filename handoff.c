@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "chat_server.h"
+#include "snapshot.h"
+#include "handoff.h"
+
+// Passes <fd> over a connected Unix socket as SCM_RIGHTS ancillary data
+int handoff_send_fd(int unix_fd, int fd) {
+    char tag = 'F';
+    struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(unix_fd, &msg, 0) == 1 ? 0 : -1;
+}
+
+// Receives a descriptor sent with handoff_send_fd; returns it or -1
+int handoff_recv_fd(int unix_fd) {
+    char tag;
+    struct iovec iov = { .iov_base = &tag, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    if (recvmsg(unix_fd, &msg, 0) != 1) return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+static void handoff_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, path, sizeof(addr->sun_path) - 1);
+}
+
+// The other end must run as our user: the socket and the state are the server
+static int peer_trusted(int conn) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return 0;
+    return cred.uid == geteuid();
+}
+
+// Bounds every read and write on <conn>, so a stalled peer cannot hold the
+// transfer (and the state lock) forever
+static void set_timeouts(int conn) {
+    struct timeval tv = { .tv_sec = HANDOFF_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int handoff_takeover(struct server_state *s, const char *path) {
+    int us = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (us < 0) {
+        perror("handoff socket");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    handoff_addr(&addr, path);
+    if (connect(us, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("handoff connect");
+        close(us);
+        return -1;
+    }
+    if (!peer_trusted(us)) {
+        fprintf(stderr, "handoff: %s is not served by our user\n", path);
+        close(us);
+        return -1;
+    }
+    set_timeouts(us);
+
+    int sd = handoff_recv_fd(us);
+    if (sd < 0) {
+        fprintf(stderr, "handoff: no socket received\n");
+        close(us);
+        return -1;
+    }
+    FILE *fp = fdopen(dup(us), "rb");
+    if (!fp) {
+        close(us);
+        close(sd);
+        return -1;
+    }
+    pthread_rwlock_wrlock(&s->rwlock);
+    int rc = snapshot_read(s, fp);
+    pthread_rwlock_unlock(&s->rwlock);
+    fclose(fp);
+    // Acknowledge only a complete state so the predecessor can resume otherwise
+    char ack = 'A';
+    if (rc != 0 || write(us, &ack, 1) != 1) {
+        fprintf(stderr, "handoff: failed to read state from predecessor\n");
+        close(us);
+        close(sd);
+        return -1;
+    }
+    close(us);
+    return sd;
+}
+
+// Blocks until a successor connects, then stops receiving, drains in-flight
+// work and ships the socket plus a serialized state before exiting. Datagrams
+// that arrive meanwhile wait in the shared socket buffer for the successor.
+void *handoff_thread(void *arg) {
+    struct handoff_args *args = arg;
+    int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ls < 0) {
+        perror("handoff socket");
+        return NULL;
+    }
+    struct sockaddr_un addr;
+    handoff_addr(&addr, args->path);
+    unlink(args->path);
+    if (bind(ls, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(args->path, 0600) < 0 ||
+        listen(ls, 1) < 0) {
+        perror("handoff bind");
+        close(ls);
+        return NULL;
+    }
+
+    while (1) {
+        int conn = accept(ls, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            perror("handoff accept");
+            break;
+        }
+        if (!peer_trusted(conn)) {
+            fprintf(stderr, "handoff: refused a peer running as another user\n");
+            close(conn);
+            continue;
+        }
+        set_timeouts(conn);
+        printf("Handoff requested; draining...\n");
+        args->quiesce(args->ctx);
+
+        pthread_rwlock_wrlock(&args->state->rwlock);
+        int rc = handoff_send_fd(conn, args->sd);
+        FILE *fp = rc == 0 ? fdopen(dup(conn), "wb") : NULL;
+        if (fp) {
+            rc = snapshot_write(args->state, fp);
+            if (fclose(fp) != 0) rc = -1;
+        } else {
+            rc = -1;
+        }
+        char ack = 0;
+        if (rc == 0 && (read(conn, &ack, 1) != 1 || ack != 'A')) rc = -1;
+        close(conn);
+        if (rc == 0) {
+            printf("Handoff complete; exiting\n");
+            fflush(stdout);
+            _exit(0);
+        }
+        pthread_rwlock_unlock(&args->state->rwlock);
+        fprintf(stderr, "handoff: transfer failed; resuming service\n");
+        args->resume(args->ctx);
+    }
+    close(ls);
+    return NULL;
+}
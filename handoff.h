@@ -0,0 +1,32 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#define HANDOFF_SOCKET_PATH "/tmp/chat_server.handoff"
+#define HANDOFF_SOCKET_PATH_FMT "/tmp/chat_server.%d.handoff"   // servers on non-default ports
+#define HANDOFF_TIMEOUT_SEC 10       // a stalled peer fails the transfer after this
+
+struct server_state;
+
+struct handoff_args {
+    int sd;
+    struct server_state *state;
+    const char *path;
+    // Stops reading from <sd> and waits for in-flight requests to finish
+    void (*quiesce)(void *ctx);
+    // Restarts the listener if the transfer fails
+    void (*resume)(void *ctx);
+    void *ctx;
+};
+
+int handoff_send_fd(int unix_fd, int fd);
+int handoff_recv_fd(int unix_fd);
+
+// New process: takes over the UDP socket and state from the running
+// server. Returns the inherited socket or -1.
+int handoff_takeover(struct server_state *s, const char *path);
+
+// Old process: waits for a successor on <path>, hands everything over and exits.
+// The socket is mode 0600 and only a peer running as the same user is served.
+void *handoff_thread(void *arg);
+
+#endif // HANDOFF_H
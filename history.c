@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "history.h"
+
+static size_t budget_segments = (size_t)HISTORY_BUDGET_MB * 1024 * 1024 / HISTORY_SEGMENT_BYTES;
+static atomic_size_t live_segments;  // across every log in the process
+
+void history_set_budget(size_t bytes) {
+    budget_segments = bytes / HISTORY_SEGMENT_BYTES;
+}
+
+// Maps a logical position (0 = oldest segment) onto the ring.
+static struct history_segment *history_segment_at(const struct history_log *log, size_t pos) {
+    return log->segments[(log->head + pos) % HISTORY_MAX_SEGMENTS];
+}
+
+// Returns the newest segment or NULL when the log is empty
+static struct history_segment *history_tail(struct history_log *log) {
+    if (log->count == 0) return NULL;
+    return history_segment_at(log, log->count - 1);
+}
+
+// Opens a fresh segment at the end of the ring, recycling the oldest one when
+// the ring is full or the server-wide budget is spent
+static struct history_segment *history_open_segment(struct history_log *log) {
+    if (!log->segments) {
+        log->segments = calloc(HISTORY_MAX_SEGMENTS, sizeof(*log->segments));
+        if (!log->segments) return NULL;
+    }
+    struct history_segment *seg;
+    if (log->count == HISTORY_MAX_SEGMENTS ||
+        (log->count > 0 && atomic_load_explicit(&live_segments, memory_order_relaxed) >= budget_segments)) {
+        seg = log->segments[log->head];
+        log->head = (log->head + 1) % HISTORY_MAX_SEGMENTS;
+        log->count--;
+    } else {
+        seg = malloc(sizeof(*seg));
+        if (!seg) return NULL;
+        atomic_fetch_add_explicit(&live_segments, 1, memory_order_relaxed);
+    }
+    seg->first_seq = log->next_seq;
+    seg->count = 0;
+    seg->used = 0;
+    log->segments[(log->head + log->count) % HISTORY_MAX_SEGMENTS] = seg;
+    log->count++;
+    return seg;
+}
+
+// Initializes an empty log; segments are allocated on first append
+void history_init(struct history_log *log) {
+    if (!log) return;
+    log->segments = NULL;
+    log->head = 0;
+    log->count = 0;
+    log->next_seq = 1;
+}
+
+// Releases every segment plus the index ring
+void history_destroy(struct history_log *log) {
+    if (!log) return;
+    for (size_t i = 0; i < log->count; ++i) {
+        free(history_segment_at(log, i));
+    }
+    atomic_fetch_sub_explicit(&live_segments, log->count, memory_order_relaxed);
+    free(log->segments);
+    log->segments = NULL;
+    log->head = 0;
+    log->count = 0;
+}
+
+// Appends a message and returns its sequence number (0 on allocation failure)
+uint64_t history_append(struct history_log *log, const char *msg) {
+    if (!log || !msg) return 0;
+    size_t len = strnlen(msg, HISTORY_SEGMENT_BYTES - 1) + 1;
+    struct history_segment *seg = history_tail(log);
+    if (!seg || seg->count == HISTORY_SEGMENT_MSGS || seg->used + len > HISTORY_SEGMENT_BYTES) {
+        seg = history_open_segment(log);
+        if (!seg) return 0;
+    }
+    memcpy(seg->data + seg->used, msg, len - 1);
+    seg->data[seg->used + len - 1] = '\0';
+    seg->offsets[seg->count++] = (uint32_t)seg->used;
+    seg->used += len;
+    return log->next_seq++;
+}
+
+// Sequence number of the oldest retained message (next_seq when empty)
+uint64_t history_oldest_seq(const struct history_log *log) {
+    if (!log || log->count == 0) return log ? log->next_seq : 0;
+    return history_segment_at(log, 0)->first_seq;
+}
+
+// Sets the sequence number of the next append; only meaningful on an empty log
+void history_seek(struct history_log *log, uint64_t next_seq) {
+    if (!log || log->count != 0 || next_seq == 0) return;
+    log->next_seq = next_seq;
+}
+
+// Binary search over the segment index for the segment holding <seq>
+static size_t history_find_segment(const struct history_log *log, uint64_t seq) {
+    size_t lo = 0, hi = log->count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (history_segment_at(log, mid)->first_seq <= seq) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Visits up to <count> messages with seq < <before> (0 = newest), oldest first.
+// Returns the number of messages visited.
+int history_page(const struct history_log *log, uint64_t before, int count,
+                 history_visit_fn visit, void *user) {
+    if (!log || !visit || count <= 0 || log->count == 0) return 0;
+    uint64_t oldest = history_oldest_seq(log);
+    if (before == 0 || before > log->next_seq) before = log->next_seq;
+    if (before <= oldest) return 0;
+    uint64_t start = before > (uint64_t)count ? before - (uint64_t)count : 0;
+    if (start < oldest) start = oldest;
+
+    int visited = 0;
+    size_t pos = history_find_segment(log, start);
+    uint64_t seq = start;
+    while (pos < log->count && seq < before) {
+        const struct history_segment *seg = history_segment_at(log, pos);
+        int i = (int)(seq - seg->first_seq);
+        for (; i < seg->count && seq < before; ++i, ++seq) {
+            visit(seq, seg->data + seg->offsets[i], user);
+            visited++;
+        }
+        pos++;
+    }
+    return visited;
+}
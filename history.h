@@ -0,0 +1,46 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_SEGMENT_MSGS 256
+#define HISTORY_SEGMENT_BYTES (64 * 1024)
+#define HISTORY_MAX_SEGMENTS 64       // per channel: 4 MiB
+#define HISTORY_BUDGET_MB 256         // default for every channel together (--history-mb)
+#define HISTORY_MAX_PAGE 100
+
+// A sealed-or-open block of consecutive messages packed into one arena.
+struct history_segment {
+    uint64_t first_seq;
+    int count;
+    size_t used;
+    uint32_t offsets[HISTORY_SEGMENT_MSGS];
+    char data[HISTORY_SEGMENT_BYTES];
+};
+
+// Per-channel message log. <segments> is a ring ordered by first_seq and
+// doubles as the sparse index: one entry per segment, binary searched by seq.
+struct history_log {
+    struct history_segment **segments;
+    size_t head;
+    size_t count;
+    uint64_t next_seq;
+};
+
+typedef void (*history_visit_fn)(uint64_t seq, const char *msg, void *user);
+
+// Caps the segments held by all logs together. A log that needs a new
+// segment once the budget is spent recycles its own oldest one instead, so
+// each channel keeps at least its newest segment.
+void history_set_budget(size_t bytes);
+
+void history_init(struct history_log *log);
+void history_destroy(struct history_log *log);
+uint64_t history_append(struct history_log *log, const char *msg);
+uint64_t history_oldest_seq(const struct history_log *log);
+void history_seek(struct history_log *log, uint64_t next_seq);
+int history_page(const struct history_log *log, uint64_t before, int count,
+                 history_visit_fn visit, void *user);
+
+#endif // HISTORY_H
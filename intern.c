@@ -0,0 +1,134 @@
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "intern.h"
+#include "pool.h"
+
+struct intern_entry {
+    struct intern_entry *next;
+    struct intern_table *table;      // where ref and release find the lock
+    uint32_t hash;
+    uint32_t refs;                   // guarded by the stripe lock
+    char str[MAX_NAME_LEN];
+};
+
+static struct intern_table global_table;
+static pthread_once_t global_once = PTHREAD_ONCE_INIT;
+static __thread struct intern_table *thread_table;
+static struct pool entry_pool = POOL_INITIALIZER("name", struct intern_entry);
+
+void intern_table_init(struct intern_table *t) {
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < INTERN_STRIPES; ++i) pthread_mutex_init(&t->stripes[i].lock, NULL);
+}
+
+static void init_global(void) {
+    intern_table_init(&global_table);
+}
+
+void intern_use(struct intern_table *t) {
+    thread_table = t;
+}
+
+static struct intern_table *current_table(void) {
+    if (thread_table) return thread_table;
+    pthread_once(&global_once, init_global);
+    return &global_table;
+}
+
+static struct intern_entry *entry_of(const char *name) {
+    return (struct intern_entry *)(name - offsetof(struct intern_entry, str));
+}
+
+// FNV-1a
+static uint32_t hash_name(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct intern_stripe *stripe_of(struct intern_table *t, uint32_t hash) {
+    return &t->stripes[hash % INTERN_STRIPES];
+}
+
+static struct intern_entry **head_of(struct intern_stripe *stripe, uint32_t hash) {
+    return &stripe->heads[(hash / INTERN_STRIPES) % INTERN_STRIPE_HEADS];
+}
+
+// Finds <s> and takes a reference, or creates it when <create> is set
+static const char *lookup(const char *s, size_t len, int create) {
+    if (!s) return NULL;
+    len = strnlen(s, len < MAX_NAME_LEN - 1 ? len : MAX_NAME_LEN - 1);
+    if (len == 0) return NULL;
+    struct intern_table *table = current_table();
+    uint32_t hash = hash_name(s, len);
+    struct intern_stripe *stripe = stripe_of(table, hash);
+    struct intern_entry **head = head_of(stripe, hash);
+    pthread_mutex_lock(&stripe->lock);
+    for (struct intern_entry *e = *head; e; e = e->next) {
+        if (e->hash == hash && strncmp(e->str, s, len) == 0 && e->str[len] == '\0') {
+            e->refs++;
+            pthread_mutex_unlock(&stripe->lock);
+            return e->str;
+        }
+    }
+    struct intern_entry *e = create ? pool_alloc(&entry_pool) : NULL;
+    if (e) {
+        memcpy(e->str, s, len);
+        e->str[len] = '\0';
+        e->table = table;
+        e->hash = hash;
+        e->refs = 1;
+        e->next = *head;
+        *head = e;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return e ? e->str : NULL;
+}
+
+const char *intern(const char *s) {
+    return lookup(s, MAX_NAME_LEN, 1);
+}
+
+const char *intern_n(const char *s, size_t len) {
+    return lookup(s, len, 1);
+}
+
+const char *intern_find(const char *s) {
+    return lookup(s, MAX_NAME_LEN, 0);
+}
+
+const char *intern_find_n(const char *s, size_t len) {
+    return lookup(s, len, 0);
+}
+
+const char *intern_ref(const char *name) {
+    if (!name) return NULL;
+    struct intern_entry *e = entry_of(name);
+    struct intern_stripe *stripe = stripe_of(e->table, e->hash);
+    pthread_mutex_lock(&stripe->lock);
+    e->refs++;
+    pthread_mutex_unlock(&stripe->lock);
+    return name;
+}
+
+void intern_release(const char *name) {
+    if (!name) return;
+    struct intern_entry *e = entry_of(name);
+    struct intern_stripe *stripe = stripe_of(e->table, e->hash);
+    pthread_mutex_lock(&stripe->lock);
+    if (--e->refs == 0) {
+        struct intern_entry **ind = head_of(stripe, e->hash);
+        while (*ind != e) ind = &(*ind)->next;
+        *ind = e->next;
+        pool_free(&entry_pool, e);
+    }
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+uint32_t intern_hash(const char *name) {
+    return entry_of(name)->hash;
+}
@@ -0,0 +1,56 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifndef MAX_NAME_LEN
+#define MAX_NAME_LEN 64
+#endif
+
+// Process-wide table of client and room names. Each distinct name has one
+// canonical, reference-counted copy, so two handles name the same thing
+// exactly when the pointers are equal and lookups never compare strings.
+// Handles are ordinary NUL-terminated strings and can be printed directly.
+
+#define INTERN_STRIPES 64
+#define INTERN_STRIPE_HEADS 1024
+
+struct intern_entry;
+
+struct intern_stripe {
+    pthread_mutex_t lock;
+    struct intern_entry *heads[INTERN_STRIPE_HEADS];
+};
+
+// A separate name space. Reactor shards each own one, so their threads never
+// share a stripe lock; handles from different tables never compare equal.
+struct intern_table {
+    struct intern_stripe stripes[INTERN_STRIPES];
+};
+
+void intern_table_init(struct intern_table *t);
+// Makes the calling thread intern into <t> from now on (NULL: the
+// process-wide table, which every thread starts with)
+void intern_use(struct intern_table *t);
+
+// Returns the handle for <s> (truncated to MAX_NAME_LEN - 1 bytes) with a
+// reference held, creating it if needed; NULL for an empty name
+const char *intern(const char *s);
+const char *intern_n(const char *s, size_t len);
+
+// Like intern, but never creates: NULL when no one holds <s>
+const char *intern_find(const char *s);
+const char *intern_find_n(const char *s, size_t len);
+
+// Takes another reference on an existing handle; returns it
+const char *intern_ref(const char *name);
+
+// Drops a reference (NULL is ignored); the last one frees the name
+void intern_release(const char *name);
+
+// Hash computed when the name was interned
+uint32_t intern_hash(const char *name);
+
+#endif // INTERN_H
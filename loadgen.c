@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "udp.h"
+#include "chat_proto.h"
+#include "metrics.h"
+
+// Headless load generator: N simulated clients in one process, each with its
+// own chat_proto connection, driven by a single epoll loop.
+
+#define LOADGEN_MAX_PHASES 16
+#define LOADGEN_EVENTS 256
+#define LOADGEN_SETTLE_MS 500   // pause between the connect/room setup steps
+#define LOADGEN_SETUP_ROUNDS 3  // conn$/joinroom$ are resent to clients that got no reply
+#define LOADGEN_TAG "lg:"       // marks payloads we can time and attribute
+
+enum lg_op { LG_SAY, LG_SAYTO, LG_SAYROOM, LG_OPS };
+
+struct lg_phase {
+    int seconds;
+    int rate;                   // messages per second across all clients
+    int mix[LG_OPS];            // relative weights
+};
+
+struct loadgen;
+
+struct lg_client {
+    struct chat_conn conn;
+    struct loadgen *lg;
+    int room;                   // -1 when not in a room
+    int connected;
+    int joined;
+    char name[32];
+};
+
+struct lg_stats {
+    uint64_t sent[LG_OPS];
+    uint64_t expected;
+    uint64_t delivered;
+    uint64_t pings;
+    uint64_t datagrams;         // received; below delivered when the server coalesces
+    struct metrics_hist latency;
+};
+
+struct loadgen {
+    const char *server_ip;
+    int server_port;
+    struct lg_client *clients;
+    int nclients;
+    int nrooms;
+    int *room_members;
+    int epfd;
+    unsigned run_id;
+    int drain_ms;
+    int coalesce_ms;            // window every client asks for; 0 = none
+    int local;                  // attach over shared memory instead of UDP
+    struct lg_phase phases[LOADGEN_MAX_PHASES];
+    int nphases;
+    struct lg_stats total;
+    struct lg_stats phase;
+};
+
+static uint64_t now_ns(void) {
+    return metrics_now_ns();
+}
+
+static void lg_send(struct lg_client *c, const char *msg) {
+    if (chat_send(&c->conn, msg) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) perror("sendto");
+}
+
+static int connected_count(const struct loadgen *lg) {
+    int n = 0;
+    for (int i = 0; i < lg->nclients; ++i) n += lg->clients[i].connected;
+    return n;
+}
+
+static void lg_on_ping(void *user) {
+    struct lg_client *c = user;
+    c->lg->phase.pings++;
+}
+
+// Handles one record received by client <c>
+static void lg_on_message(void *user, enum chat_channel channel, const char *rec, size_t len) {
+    (void)channel;
+    struct lg_client *c = user;
+    struct loadgen *lg = c->lg;
+    if (strncmp(rec, "[Server]", 8) == 0) {
+        if (memmem(rec, len, "successfully connected", 22)) c->connected = 1;
+        else if (memmem(rec, len, "Joined room <", 13) || memmem(rec, len, "created; you joined", 19)) {
+            if (!c->joined && c->room >= 0) lg->room_members[c->room]++;
+            c->joined = 1;
+        }
+        return;
+    }
+    const char *tag = memmem(rec, len, LOADGEN_TAG, strlen(LOADGEN_TAG));
+    if (!tag) return;
+    unsigned run;
+    unsigned long long sent_ns;
+    if (sscanf(tag + strlen(LOADGEN_TAG), "%x:%llu", &run, &sent_ns) != 2 || run != lg->run_id) return;
+    uint64_t now = now_ns();
+    lg->phase.delivered++;
+    metrics_hist_add(&lg->phase.latency, now > sent_ns ? now - sent_ns : 0);
+}
+
+// Services sockets for up to <ms> milliseconds
+static void lg_poll(struct loadgen *lg, int ms) {
+    struct epoll_event events[LOADGEN_EVENTS];
+    int n = epoll_wait(lg->epfd, events, LOADGEN_EVENTS, ms);
+    for (int i = 0; i < n; ++i) {
+        int got = chat_poll(&lg->clients[events[i].data.u32].conn);
+        if (got > 0) lg->phase.datagrams += (uint64_t)got;
+    }
+}
+
+static void lg_poll_for(struct loadgen *lg, int ms) {
+    uint64_t until = now_ns() + (uint64_t)ms * 1000000ull;
+    uint64_t now;
+    while ((now = now_ns()) < until) lg_poll(lg, (int)((until - now) / 1000000ull) + 1);
+}
+
+static int lg_open_clients(struct loadgen *lg) {
+    // A local session holds four descriptors: epoll, Unix socket, two eventfds
+    rlim_t want = (rlim_t)lg->nclients * (lg->local ? 4 : 1) + 64;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < want) {
+        rl.rlim_cur = rl.rlim_max < want ? rl.rlim_max : want;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    lg->epfd = epoll_create1(0);
+    if (lg->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    const struct chat_callbacks callbacks = { .on_message = lg_on_message, .on_ping = lg_on_ping };
+    for (int i = 0; i < lg->nclients; ++i) {
+        struct lg_client *c = &lg->clients[i];
+        c->lg = lg;
+        if (lg->local) {
+            if (chat_open_local(&c->conn, lg->server_port, &callbacks, c) < 0) return -1;
+        } else {
+            if (chat_open(&c->conn, lg->server_ip, lg->server_port, 0, &callbacks, c) < 0) return -1;
+            int size = 1 << 20;
+            setsockopt(chat_fd(&c->conn), SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+        if (epoll_ctl(lg->epfd, EPOLL_CTL_ADD, chat_fd(&c->conn), &ev) < 0) {
+            perror("epoll_ctl");
+            return -1;
+        }
+        snprintf(c->name, sizeof(c->name), "lg%x_%d", lg->run_id, i);
+        c->room = lg->nrooms > 0 ? i % lg->nrooms : -1;
+    }
+    return 0;
+}
+
+// Connects every client, then has the first member of each room create it
+// and the rest join it. The server drops requests under a burst, so each
+// step is retried for clients that have not been acknowledged yet.
+static void lg_setup(struct loadgen *lg) {
+    char msg[BUFFER_SIZE];
+    for (int round = 0; round < LOADGEN_SETUP_ROUNDS; ++round) {
+        int pending = 0;
+        for (int i = 0; i < lg->nclients; ++i) {
+            if (lg->clients[i].connected) continue;
+            snprintf(msg, sizeof(msg), "conn$ %s", lg->clients[i].name);
+            lg_send(&lg->clients[i], msg);
+            if (++pending % 256 == 0) lg_poll(lg, 0);
+        }
+        if (pending == 0) break;
+        lg_poll_for(lg, LOADGEN_SETTLE_MS);
+    }
+    if (lg->coalesce_ms > 0) {
+        snprintf(msg, sizeof(msg), "coalesce$ %d", lg->coalesce_ms);
+        for (int i = 0; i < lg->nclients; ++i) {
+            if (!lg->clients[i].connected) continue;
+            lg_send(&lg->clients[i], msg);
+            if ((i + 1) % 256 == 0) lg_poll(lg, 0);
+        }
+        lg_poll_for(lg, LOADGEN_SETTLE_MS);
+    }
+    if (lg->nrooms == 0) return;
+    for (int round = 0; round < LOADGEN_SETUP_ROUNDS; ++round) {
+        int pending = 0;
+        for (int i = 0; i < lg->nrooms; ++i) {
+            if (lg->clients[i].joined || !lg->clients[i].connected) continue;
+            snprintf(msg, sizeof(msg), "createroom$ lg%x_room%d", lg->run_id, i);
+            lg_send(&lg->clients[i], msg);
+            pending++;
+        }
+        if (pending == 0) break;
+        lg_poll_for(lg, LOADGEN_SETTLE_MS);
+    }
+    for (int round = 0; round < LOADGEN_SETUP_ROUNDS; ++round) {
+        int pending = 0;
+        for (int i = lg->nrooms; i < lg->nclients; ++i) {
+            if (lg->clients[i].joined || !lg->clients[i].connected) continue;
+            snprintf(msg, sizeof(msg), "joinroom$ lg%x_room%d", lg->run_id, lg->clients[i].room);
+            lg_send(&lg->clients[i], msg);
+            if (++pending % 256 == 0) lg_poll(lg, 0);
+        }
+        if (pending == 0) break;
+        lg_poll_for(lg, LOADGEN_SETTLE_MS);
+    }
+}
+
+static enum lg_op pick_op(const struct lg_phase *ph) {
+    int total = 0;
+    for (int i = 0; i < LG_OPS; ++i) total += ph->mix[i];
+    int r = rand() % total;
+    for (int i = 0; i < LG_OPS; ++i) {
+        if (r < ph->mix[i]) return (enum lg_op)i;
+        r -= ph->mix[i];
+    }
+    return LG_SAY;
+}
+
+// Sends one workload message from a random connected client
+static void lg_send_one(struct loadgen *lg, const struct lg_phase *ph, int connected) {
+    struct lg_client *c = &lg->clients[rand() % lg->nclients];
+    if (!c->connected) return;
+    enum lg_op op = pick_op(ph);
+    if (op == LG_SAYROOM && !c->joined) op = LG_SAY;
+
+    char msg[BUFFER_SIZE];
+    char tag[64];
+    snprintf(tag, sizeof(tag), LOADGEN_TAG "%x:%llu", lg->run_id, (unsigned long long)now_ns());
+    switch (op) {
+    case LG_SAY:
+        snprintf(msg, sizeof(msg), "say$ %s", tag);
+        lg->phase.expected += (uint64_t)connected;
+        break;
+    case LG_SAYTO: {
+        struct lg_client *to = &lg->clients[rand() % lg->nclients];
+        snprintf(msg, sizeof(msg), "sayto$ %s %s", to->name, tag);
+        lg->phase.expected += to->connected ? 1 : 0;
+        break;
+    }
+    default:
+        snprintf(msg, sizeof(msg), "sayroom$ %s", tag);
+        lg->phase.expected += (uint64_t)lg->room_members[c->room];
+        break;
+    }
+    lg->phase.sent[op]++;
+    lg_send(c, msg);
+}
+
+static void hist_fold(struct metrics_hist *dst, const struct metrics_hist *src) {
+    for (int i = 0; i < HIST_BUCKETS; ++i) dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+static void lg_report(const char *label, const struct lg_stats *st, double seconds) {
+    uint64_t sent = 0;
+    for (int i = 0; i < LG_OPS; ++i) sent += st->sent[i];
+    printf("%s: sent=%llu (say=%llu sayto=%llu sayroom=%llu) %.0f msg/s\n", label,
+           (unsigned long long)sent, (unsigned long long)st->sent[LG_SAY],
+           (unsigned long long)st->sent[LG_SAYTO], (unsigned long long)st->sent[LG_SAYROOM],
+           seconds > 0 ? (double)sent / seconds : 0.0);
+    printf("%s: delivered=%llu/%llu (%.2f%%) %.0f deliveries/s, pings answered=%llu\n", label,
+           (unsigned long long)st->delivered, (unsigned long long)st->expected,
+           st->expected ? 100.0 * (double)st->delivered / (double)st->expected : 100.0,
+           seconds > 0 ? (double)st->delivered / seconds : 0.0, (unsigned long long)st->pings);
+    printf("%s: datagrams received=%llu (%.0f/s)\n", label, (unsigned long long)st->datagrams,
+           seconds > 0 ? (double)st->datagrams / seconds : 0.0);
+    const struct metrics_hist *h = &st->latency;
+    printf("%s: latency us p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f\n", label,
+           metrics_hist_percentile(h, 50.0) / 1e3, metrics_hist_percentile(h, 90.0) / 1e3,
+           metrics_hist_percentile(h, 99.0) / 1e3, metrics_hist_percentile(h, 99.9) / 1e3,
+           h->max / 1e3);
+}
+
+static void lg_fold_phase(struct loadgen *lg) {
+    for (int i = 0; i < LG_OPS; ++i) lg->total.sent[i] += lg->phase.sent[i];
+    lg->total.expected += lg->phase.expected;
+    lg->total.delivered += lg->phase.delivered;
+    lg->total.pings += lg->phase.pings;
+    lg->total.datagrams += lg->phase.datagrams;
+    hist_fold(&lg->total.latency, &lg->phase.latency);
+    memset(&lg->phase, 0, sizeof(lg->phase));
+}
+
+// Paces sends to the phase rate; deliveries that arrive after the phase ends
+// (during the next phase or the final drain) are credited to the later window
+static void lg_run_phase(struct loadgen *lg, int index) {
+    const struct lg_phase *ph = &lg->phases[index];
+    int connected = connected_count(lg);
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)ph->seconds * 1000000000ull;
+    uint64_t sent = 0;
+    uint64_t now;
+    while ((now = now_ns()) < end) {
+        uint64_t due = (uint64_t)((double)(now - start) * ph->rate / 1e9);
+        while (sent < due) {
+            lg_send_one(lg, ph, connected);
+            sent++;
+            if ((sent & 63) == 0) lg_poll(lg, 0);
+        }
+        lg_poll(lg, 1);
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "phase %d", index + 1);
+    lg_report(label, &lg->phase, (double)(now_ns() - start) / 1e9);
+    lg_fold_phase(lg);
+}
+
+static int parse_phase(const char *spec, struct lg_phase *ph) {
+    memset(ph, 0, sizeof(*ph));
+    int n = sscanf(spec, "%d,%d,%d/%d/%d", &ph->seconds, &ph->rate,
+                   &ph->mix[LG_SAY], &ph->mix[LG_SAYTO], &ph->mix[LG_SAYROOM]);
+    if (n == 2) {
+        ph->mix[LG_SAY] = 60;
+        ph->mix[LG_SAYTO] = 20;
+        ph->mix[LG_SAYROOM] = 20;
+    } else if (n != 5) {
+        return -1;
+    }
+    if (ph->seconds <= 0 || ph->rate <= 0) return -1;
+    for (int i = 0; i < LG_OPS; ++i)
+        if (ph->mix[i] < 0) return -1;
+    return ph->mix[LG_SAY] + ph->mix[LG_SAYTO] + ph->mix[LG_SAYROOM] > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--server ip] [--port N] [--clients N] [--rooms N] [--drain ms] [--coalesce ms] [--local]\n"
+            "          [--phase seconds,msgs_per_sec[,say/sayto/sayroom]]...\n"
+            "Example: %s --clients 2000 --rooms 50 --phase 5,500 --phase 10,5000,90/5/5\n",
+            prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+    struct loadgen lg;
+    memset(&lg, 0, sizeof(lg));
+    lg.server_ip = "127.0.0.1";
+    lg.server_port = SERVER_PORT;
+    lg.nclients = 100;
+    lg.nrooms = 10;
+    lg.drain_ms = 1000;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            lg.server_ip = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            lg.server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+            lg.nclients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rooms") == 0 && i + 1 < argc) {
+            lg.nrooms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--drain") == 0 && i + 1 < argc) {
+            lg.drain_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--local") == 0) {
+            lg.local = 1;
+        } else if (strcmp(argv[i], "--coalesce") == 0 && i + 1 < argc) {
+            lg.coalesce_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--phase") == 0 && i + 1 < argc && lg.nphases < LOADGEN_MAX_PHASES) {
+            if (parse_phase(argv[++i], &lg.phases[lg.nphases++]) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    struct sockaddr_in probe;
+    if (lg.nclients <= 0 || lg.nrooms < 0 || lg.drain_ms < 0 || lg.coalesce_ms < 0 ||
+        set_socket_addr(&probe, lg.server_ip, lg.server_port) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (lg.nphases == 0) parse_phase("10,1000", &lg.phases[lg.nphases++]);
+    if (lg.nrooms > lg.nclients) lg.nrooms = lg.nclients;
+
+    lg.run_id = (unsigned)getpid() ^ (unsigned)time(NULL);
+    srand(lg.run_id);
+    lg.clients = calloc((size_t)lg.nclients, sizeof(*lg.clients));
+    lg.room_members = calloc((size_t)lg.nrooms + 1, sizeof(*lg.room_members));
+    if (!lg.clients || !lg.room_members || lg_open_clients(&lg) != 0) {
+        fprintf(stderr, "loadgen: failed to open %d client %s\n", lg.nclients,
+                lg.local ? "sessions (is the server running with --shm?)" : "sockets");
+        return 1;
+    }
+
+    lg_setup(&lg);
+    int joined = 0;
+    for (int i = 0; i < lg.nclients; ++i) joined += lg.clients[i].joined;
+    printf("loadgen: %d/%d clients connected, %d in %d rooms\n",
+           connected_count(&lg), lg.nclients, joined, lg.nrooms);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < lg.nphases; ++i) lg_run_phase(&lg, i);
+    lg_poll_for(&lg, lg.drain_ms);
+    lg_fold_phase(&lg);
+    lg_report("total", &lg.total, (double)(now_ns() - start) / 1e9);
+
+    for (int i = 0; i < lg.nclients; ++i) {
+        lg_send(&lg.clients[i], "disconn$");
+        chat_close(&lg.clients[i].conn);
+    }
+    close(lg.epfd);
+    free(lg.clients);
+    free(lg.room_members);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include "mailbox.h"
+
+// Same slot protocol as the client's async_log ring (Vyukov's bounded
+// queue): a slot's sequence number says whether it is free for a producer's
+// ticket or holds a published datagram.
+
+int mailbox_init(struct mailbox *mb) {
+    memset(mb, 0, sizeof(*mb));
+    mb->slots = calloc(MAILBOX_SLOTS, sizeof(*mb->slots));
+    if (!mb->slots) return -1;
+    for (size_t i = 0; i < MAILBOX_SLOTS; ++i) atomic_init(&mb->slots[i].seq, i);
+    atomic_init(&mb->head, 0);
+    atomic_init(&mb->sleeping, 0);
+    mb->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (mb->wake_fd < 0) {
+        free(mb->slots);
+        return -1;
+    }
+    return 0;
+}
+
+void mailbox_destroy(struct mailbox *mb) {
+    close(mb->wake_fd);
+    free(mb->slots);
+    mb->slots = NULL;
+}
+
+int mailbox_push(struct mailbox *mb, const struct sockaddr_in *src, const char *buf, size_t len) {
+    size_t pos = atomic_load_explicit(&mb->head, memory_order_relaxed);
+    struct mailbox_slot *slot;
+    while (1) {
+        slot = &mb->slots[pos & (MAILBOX_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&mb->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&mb->head, memory_order_relaxed);
+        }
+    }
+    if (len > sizeof(slot->buf)) len = sizeof(slot->buf);
+    slot->src = *src;
+    slot->len = (int)len;
+    memcpy(slot->buf, buf, len);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    // Pairs with the fence in mailbox_sleep: either it sees this slot or we see it asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&mb->sleeping, 0)) {
+        uint64_t one = 1;
+        if (write(mb->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("mailbox wake");
+    }
+    return 0;
+}
+
+struct mailbox_slot *mailbox_peek(struct mailbox *mb) {
+    struct mailbox_slot *slot = &mb->slots[mb->tail & (MAILBOX_SLOTS - 1)];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    return seq == mb->tail + 1 ? slot : NULL;
+}
+
+void mailbox_pop(struct mailbox *mb) {
+    struct mailbox_slot *slot = &mb->slots[mb->tail & (MAILBOX_SLOTS - 1)];
+    atomic_store_explicit(&slot->seq, mb->tail + MAILBOX_SLOTS, memory_order_release);
+    mb->tail++;
+}
+
+int mailbox_sleep(struct mailbox *mb) {
+    atomic_store(&mb->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (mailbox_peek(mb)) {
+        atomic_store(&mb->sleeping, 0);
+        return -1;
+    }
+    return 0;
+}
+
+void mailbox_awake(struct mailbox *mb, int signaled) {
+    atomic_store(&mb->sleeping, 0);
+    if (!signaled) return;
+    uint64_t count;
+    if (read(mb->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("mailbox read");
+}
@@ -0,0 +1,47 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "udp.h"
+
+// Bounded lock-free multi-producer / single-consumer queue of datagrams
+// between reactor shards. Producers copy into a slot and only touch the
+// eventfd when the owning reactor is asleep, so a busy shard is fed without
+// syscalls.
+
+#define MAILBOX_SLOTS 1024           // power of two
+
+struct mailbox_slot {
+    atomic_size_t seq;
+    struct sockaddr_in src;
+    int len;
+    char buf[BUFFER_SIZE];
+};
+
+struct mailbox {
+    struct mailbox_slot *slots;
+    atomic_size_t head;              // next slot producers claim
+    size_t tail;                     // next slot the consumer reads
+    int wake_fd;                     // eventfd the consumer waits on
+    atomic_int sleeping;
+};
+
+int mailbox_init(struct mailbox *mb);
+void mailbox_destroy(struct mailbox *mb);
+
+// Copies one datagram in; returns -1 if the mailbox is full
+int mailbox_push(struct mailbox *mb, const struct sockaddr_in *src, const char *buf, size_t len);
+
+// Consumer side: returns the oldest slot or NULL; release it with mailbox_pop
+struct mailbox_slot *mailbox_peek(struct mailbox *mb);
+void mailbox_pop(struct mailbox *mb);
+
+// Call before blocking on wake_fd. Returns 0 if the mailbox is empty and
+// producers will wake us, -1 if something arrived meanwhile.
+int mailbox_sleep(struct mailbox *mb);
+// Call after waking; <signaled> says the eventfd fired and must be cleared
+void mailbox_awake(struct mailbox *mb, int signaled);
+
+#endif // MAILBOX_H
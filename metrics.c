@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+
+static const char *const command_names[METRIC_CMD_COUNT] = {
+    "conn", "say", "sayto", "sayroom", "createroom", "joinroom", "leaveroom",
+    "kickroom", "history", "disconn", "mute", "unmute", "rename", "kick",
+    "sub", "unsub", "pub", "coalesce", "re-ping", "stats", "fed", "other",
+};
+
+static const char *const hist_names[METRIC_HISTS] = {
+    "fanout", "lock_wait_ns", "lock_hold_ns", "control_wait_ns", "bulk_wait_ns",
+    "keepalive_rtt_ns",
+};
+
+// One block per live thread. A block is only ever written by the thread that
+// owns it, so updates are plain relaxed stores; readers sum every block.
+// Blocks are recycled (never freed) when their thread exits, which keeps
+// totals monotonic even with short-lived worker threads.
+struct metrics_block {
+    uint64_t counters[METRIC_COUNTERS];
+    uint64_t commands[METRIC_CMD_COUNT];
+    struct metrics_hist latency[METRIC_CMD_COUNT];
+    struct metrics_hist hists[METRIC_HISTS];
+    struct metrics_block *next_all;
+    struct metrics_block *next_free;
+};
+
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct metrics_block *all_blocks;
+static struct metrics_block *free_blocks;
+static pthread_key_t block_key;
+static __thread struct metrics_block *tls_block;
+static time_t started_at;
+
+static void metrics_release_block(void *arg) {
+    struct metrics_block *block = arg;
+    pthread_mutex_lock(&blocks_lock);
+    block->next_free = free_blocks;
+    free_blocks = block;
+    pthread_mutex_unlock(&blocks_lock);
+}
+
+void metrics_init(void) {
+    pthread_key_create(&block_key, metrics_release_block);
+    started_at = time(NULL);
+}
+
+static struct metrics_block *metrics_block(void) {
+    if (tls_block) return tls_block;
+    pthread_mutex_lock(&blocks_lock);
+    struct metrics_block *block = free_blocks;
+    if (block) {
+        free_blocks = block->next_free;
+    } else {
+        block = calloc(1, sizeof(*block));
+        if (block) {
+            block->next_all = all_blocks;
+            all_blocks = block;
+        }
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    if (block) pthread_setspecific(block_key, block);
+    tls_block = block;
+    return block;
+}
+
+static inline void bump(uint64_t *slot, uint64_t n) {
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t peek(const uint64_t *slot) {
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int mag = 63 - __builtin_clzll(v);
+    if (mag > HIST_MAX_MAGNITUDE) return HIST_BUCKETS - 1;
+    int sub = (int)((v >> (mag - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    return (mag - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// Lowest value that falls into bucket <idx>
+static uint64_t hist_value(int idx) {
+    if (idx < HIST_SUB) return (uint64_t)idx;
+    int mag = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(idx % HIST_SUB);
+    return (HIST_SUB + sub) << (mag - HIST_SUB_BITS);
+}
+
+void metrics_hist_add(struct metrics_hist *h, uint64_t value) {
+    bump(&h->buckets[hist_index(value)], 1);
+    bump(&h->count, 1);
+    bump(&h->sum, value);
+    if (value > peek(&h->max)) __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_hist_percentile(const struct metrics_hist *h, double pct) {
+    if (h->count == 0) return 0;
+    double rank = pct / 100.0 * (double)h->count;
+    uint64_t target = (uint64_t)rank;
+    if ((double)target < rank || target == 0) target++;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= target) return hist_value(i);
+    }
+    return h->max;
+}
+
+static void hist_merge(struct metrics_hist *dst, const struct metrics_hist *src) {
+    for (int i = 0; i < HIST_BUCKETS; ++i) dst->buckets[i] += peek(&src->buckets[i]);
+    dst->count += peek(&src->count);
+    dst->sum += peek(&src->sum);
+    uint64_t max = peek(&src->max);
+    if (max > dst->max) dst->max = max;
+}
+
+void metrics_count(enum metric_counter c, uint64_t n) {
+    struct metrics_block *block = metrics_block();
+    if (block) bump(&block->counters[c], n);
+}
+
+void metrics_record(enum metric_hist h, uint64_t value) {
+    struct metrics_block *block = metrics_block();
+    if (block) metrics_hist_add(&block->hists[h], value);
+}
+
+int metrics_command_index(const char *cmd) {
+    for (int i = 0; i < METRIC_CMD_OTHER; ++i) {
+        if (strcmp(cmd, command_names[i]) == 0) return i;
+    }
+    return METRIC_CMD_OTHER;
+}
+
+void metrics_command(int cmd, uint64_t latency_ns) {
+    struct metrics_block *block = metrics_block();
+    if (!block || cmd < 0 || cmd >= METRIC_CMD_COUNT) return;
+    bump(&block->commands[cmd], 1);
+    metrics_hist_add(&block->latency[cmd], latency_ns);
+}
+
+static void emit_hist(metrics_emit_fn emit, void *user, const char *label,
+                      const char *name, const struct metrics_hist *h) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "[Stats] %s %s n=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu",
+             label, name, (unsigned long long)h->count,
+             (unsigned long long)(h->count ? h->sum / h->count : 0),
+             (unsigned long long)metrics_hist_percentile(h, 50.0),
+             (unsigned long long)metrics_hist_percentile(h, 90.0),
+             (unsigned long long)metrics_hist_percentile(h, 99.0),
+             (unsigned long long)metrics_hist_percentile(h, 99.9),
+             (unsigned long long)h->max);
+    emit(line, user);
+}
+
+// Merges every thread's block and emits one line per metric
+void metrics_report(const struct metrics_gauges *g, metrics_emit_fn emit, void *user) {
+    struct metrics_block *total = calloc(1, sizeof(*total));
+    if (!total) return;
+    pthread_mutex_lock(&blocks_lock);
+    for (struct metrics_block *b = all_blocks; b; b = b->next_all) {
+        for (int i = 0; i < METRIC_COUNTERS; ++i) total->counters[i] += peek(&b->counters[i]);
+        for (int i = 0; i < METRIC_CMD_COUNT; ++i) {
+            total->commands[i] += peek(&b->commands[i]);
+            hist_merge(&total->latency[i], &b->latency[i]);
+        }
+        for (int i = 0; i < METRIC_HISTS; ++i) hist_merge(&total->hists[i], &b->hists[i]);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+
+    char line[256];
+    snprintf(line, sizeof(line), "[Stats] uptime=%lds clients=%zu heap=%zu rooms=%zu",
+             (long)(time(NULL) - started_at), g->clients, g->heap_size, g->rooms);
+    emit(line, user);
+    snprintf(line, sizeof(line), "[Stats] packets_in=%llu packets_out=%llu bytes_in=%llu bytes_out=%llu",
+             (unsigned long long)total->counters[METRIC_PACKETS_IN],
+             (unsigned long long)total->counters[METRIC_PACKETS_OUT],
+             (unsigned long long)total->counters[METRIC_BYTES_IN],
+             (unsigned long long)total->counters[METRIC_BYTES_OUT]);
+    emit(line, user);
+    snprintf(line, sizeof(line), "[Stats] throttled=%llu shed=%llu rejected=%llu queue_depth=%zu queue_wait_ewma_ns=%llu "
+             "control_depth=%zu control_wait_ewma_ns=%llu",
+             (unsigned long long)total->counters[METRIC_THROTTLED],
+             (unsigned long long)total->counters[METRIC_SHED],
+             (unsigned long long)total->counters[METRIC_REJECTED],
+             g->queue_depth, (unsigned long long)g->queue_wait_ewma_ns,
+             g->control_depth, (unsigned long long)g->control_wait_ewma_ns);
+    emit(line, user);
+    if (g->shards > 0) {
+        snprintf(line, sizeof(line), "[Stats] shards=%d forwarded=%llu", g->shards,
+                 (unsigned long long)total->counters[METRIC_FORWARDED]);
+        emit(line, user);
+    }
+    for (int i = 0; i < METRIC_HISTS; ++i)
+        emit_hist(emit, user, "hist", hist_names[i], &total->hists[i]);
+    for (int i = 0; i < METRIC_CMD_COUNT; ++i) {
+        if (total->commands[i] == 0) continue;
+        emit_hist(emit, user, "cmd_ns", command_names[i], &total->latency[i]);
+    }
+    free(total);
+}
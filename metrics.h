@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_DUMP_INTERVAL 10
+
+// Log-linear ("HDR-style") histogram: 8 sub-buckets per power of two,
+// values clamped to 2^40, so relative error stays under 12.5%.
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_MAGNITUDE 40
+#define HIST_BUCKETS ((HIST_MAX_MAGNITUDE - HIST_SUB_BITS + 2) * HIST_SUB)
+
+enum metric_counter {
+    METRIC_PACKETS_IN,
+    METRIC_PACKETS_OUT,
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_THROTTLED,   // requests dropped by the rate limiter
+    METRIC_SHED,        // requests dropped by admission control under load
+    METRIC_REJECTED,    // conn$ refused with a retry-after reply
+    METRIC_FORWARDED,   // datagrams a reactor shard passed to the owning shard
+    METRIC_COUNTERS
+};
+
+enum metric_hist {
+    METRIC_FANOUT,      // recipients per broadcast
+    METRIC_LOCK_WAIT,   // ns spent acquiring state->rwlock
+    METRIC_LOCK_HOLD,   // ns state->rwlock was held
+    METRIC_CONTROL_WAIT, // ns a control-lane request waited for a worker
+    METRIC_BULK_WAIT,   // ns a bulk-lane request waited for a worker
+    METRIC_KEEPALIVE,   // ns from ping$ to the client's next packet
+    METRIC_HISTS
+};
+
+enum metric_command {
+    METRIC_CMD_CONN,
+    METRIC_CMD_SAY,
+    METRIC_CMD_SAYTO,
+    METRIC_CMD_SAYROOM,
+    METRIC_CMD_CREATEROOM,
+    METRIC_CMD_JOINROOM,
+    METRIC_CMD_LEAVEROOM,
+    METRIC_CMD_KICKROOM,
+    METRIC_CMD_HISTORY,
+    METRIC_CMD_DISCONN,
+    METRIC_CMD_MUTE,
+    METRIC_CMD_UNMUTE,
+    METRIC_CMD_RENAME,
+    METRIC_CMD_KICK,
+    METRIC_CMD_SUB,
+    METRIC_CMD_UNSUB,
+    METRIC_CMD_PUB,
+    METRIC_CMD_COALESCE,
+    METRIC_CMD_REPING,
+    METRIC_CMD_STATS,
+    METRIC_CMD_FED,
+    METRIC_CMD_OTHER,
+    METRIC_CMD_COUNT
+};
+
+struct metrics_hist {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+// Point-in-time values sampled from server_state when a report is built
+struct metrics_gauges {
+    size_t clients;
+    size_t heap_size;
+    size_t rooms;
+    size_t queue_depth;          // bulk lane
+    uint64_t queue_wait_ewma_ns;
+    size_t control_depth;
+    uint64_t control_wait_ewma_ns;
+    int shards;                  // reactor shards, 0 in thread-pool mode
+};
+
+typedef void (*metrics_emit_fn)(const char *line, void *user);
+
+void metrics_init(void);
+uint64_t metrics_now_ns(void);
+
+void metrics_count(enum metric_counter c, uint64_t n);
+void metrics_record(enum metric_hist h, uint64_t value);
+int metrics_command_index(const char *cmd);
+void metrics_command(int cmd, uint64_t latency_ns);
+
+void metrics_hist_add(struct metrics_hist *h, uint64_t value);
+uint64_t metrics_hist_percentile(const struct metrics_hist *h, double pct);
+
+void metrics_report(const struct metrics_gauges *g, metrics_emit_fn emit, void *user);
+
+#endif // METRICS_H
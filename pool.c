@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+// A thread's cache for one pool. allocs/frees are only written by the
+// owning thread; pool_report reads them without a lock.
+struct pool_cache {
+    void *head;
+    unsigned count;
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+struct pool_thread {
+    struct pool_cache caches[POOL_MAX];
+    struct pool_thread *next;
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pool *pools[POOL_MAX];
+static int pool_count;
+static struct pool_thread *threads;
+static uint64_t retired_allocs[POOL_MAX];   // counts of exited threads
+static uint64_t retired_frees[POOL_MAX];
+
+static pthread_key_t thread_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static __thread struct pool_thread *self;
+
+static void *next_of(void *obj) {
+    return *(void **)obj;
+}
+
+static void set_next(void *obj, void *next) {
+    *(void **)obj = next;
+}
+
+// Moves up to <n> objects from the cache to the depot
+static void spill(struct pool *p, struct pool_cache *c, unsigned n) {
+    pthread_mutex_lock(&p->lock);
+    while (n-- > 0 && c->head) {
+        void *obj = c->head;
+        c->head = next_of(obj);
+        c->count--;
+        set_next(obj, p->depot);
+        p->depot = obj;
+        p->depot_count++;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Gives an exiting thread's cached objects back and folds in its counters
+static void detach_thread(void *arg) {
+    struct pool_thread *t = arg;
+    pthread_mutex_lock(&registry_lock);
+    for (struct pool_thread **ind = &threads; *ind; ind = &(*ind)->next) {
+        if (*ind == t) {
+            *ind = t->next;
+            break;
+        }
+    }
+    for (int i = 0; i < pool_count; ++i) {
+        retired_allocs[i] += t->caches[i].allocs;
+        retired_frees[i] += t->caches[i].frees;
+    }
+    int count = pool_count;
+    pthread_mutex_unlock(&registry_lock);
+    for (int i = 0; i < count; ++i) spill(pools[i], &t->caches[i], t->caches[i].count);
+    free(t);
+    self = NULL;
+}
+
+static void make_key(void) {
+    pthread_key_create(&thread_key, detach_thread);
+}
+
+static struct pool_thread *attach_thread(void) {
+    pthread_once(&key_once, make_key);
+    struct pool_thread *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    pthread_mutex_lock(&registry_lock);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&registry_lock);
+    pthread_setspecific(thread_key, t);
+    self = t;
+    return t;
+}
+
+static int register_pool(struct pool *p) {
+    pthread_mutex_lock(&registry_lock);
+    if (p->id == 0 && pool_count < POOL_MAX) {
+        pools[pool_count++] = p;
+        __atomic_store_n(&p->id, pool_count, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return p->id;
+}
+
+static struct pool_cache *cache_of(struct pool *p) {
+    int id = __atomic_load_n(&p->id, __ATOMIC_ACQUIRE);
+    if (id == 0 && (id = register_pool(p)) == 0) return NULL;
+    if (!self && !attach_thread()) return NULL;
+    return &self->caches[id - 1];
+}
+
+// Carves a new slab into the depot; caller holds p->lock
+static int carve_slab(struct pool *p) {
+    size_t header = POOL_ALIGN(sizeof(void *));
+    size_t bytes = POOL_SLAB_BYTES;
+    if (bytes < header + p->obj_size * 8) bytes = header + p->obj_size * 8;
+    char *slab = malloc(bytes);
+    if (!slab) return -1;
+    set_next(slab, p->slabs);
+    p->slabs = slab;
+    p->slab_count++;
+    p->slab_bytes += bytes;
+    size_t n = (bytes - header) / p->obj_size;
+    for (size_t i = 0; i < n; ++i) {
+        void *obj = slab + header + i * p->obj_size;
+        set_next(obj, p->depot);
+        p->depot = obj;
+    }
+    p->depot_count += n;
+    p->capacity += n;
+    return 0;
+}
+
+// Takes a magazine from the depot, carving a slab if it is empty
+static int refill(struct pool *p, struct pool_cache *c) {
+    pthread_mutex_lock(&p->lock);
+    if (!p->depot && carve_slab(p) != 0) {
+        pthread_mutex_unlock(&p->lock);
+        return -1;
+    }
+    while (p->depot && c->count < POOL_MAGAZINE) {
+        void *obj = p->depot;
+        p->depot = next_of(obj);
+        p->depot_count--;
+        set_next(obj, c->head);
+        c->head = obj;
+        c->count++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void *pool_alloc(struct pool *p) {
+    struct pool_cache *c = cache_of(p);
+    if (!c || (!c->head && refill(p, c) != 0)) return NULL;
+    void *obj = c->head;
+    c->head = next_of(obj);
+    c->count--;
+    __atomic_store_n(&c->allocs, c->allocs + 1, __ATOMIC_RELAXED);
+    return obj;
+}
+
+void *pool_zalloc(struct pool *p) {
+    void *obj = pool_alloc(p);
+    if (obj) memset(obj, 0, p->obj_size);
+    return obj;
+}
+
+void pool_free(struct pool *p, void *obj) {
+    if (!obj) return;
+    struct pool_cache *c = cache_of(p);
+    if (!c) {
+        // No thread cache (out of memory): hand the object straight back
+        pthread_mutex_lock(&p->lock);
+        set_next(obj, p->depot);
+        p->depot = obj;
+        p->depot_count++;
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+    set_next(obj, c->head);
+    c->head = obj;
+    c->count++;
+    __atomic_store_n(&c->frees, c->frees + 1, __ATOMIC_RELAXED);
+    // Producer/consumer pairs (listener allocates, worker frees) meet in the depot
+    if (c->count > 2 * POOL_MAGAZINE) spill(p, c, POOL_MAGAZINE);
+}
+
+void pool_report(metrics_emit_fn emit, void *user) {
+    char line[256];
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < pool_count; ++i) {
+        struct pool *p = pools[i];
+        uint64_t allocs = retired_allocs[i], frees = retired_frees[i];
+        for (struct pool_thread *t = threads; t; t = t->next) {
+            allocs += __atomic_load_n(&t->caches[i].allocs, __ATOMIC_RELAXED);
+            frees += __atomic_load_n(&t->caches[i].frees, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_lock(&p->lock);
+        size_t capacity = p->capacity, depot = p->depot_count;
+        size_t slabs = p->slab_count, bytes = p->slab_bytes;
+        pthread_mutex_unlock(&p->lock);
+        uint64_t live = allocs > frees ? allocs - frees : 0;
+        snprintf(line, sizeof(line),
+                 "[Stats] pool %s size=%zu in_use=%llu free=%llu depot=%zu slabs=%zu bytes=%zu",
+                 p->name, p->obj_size, (unsigned long long)live,
+                 (unsigned long long)(capacity > live ? capacity - live : 0),
+                 depot, slabs, bytes);
+        emit(line, user);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,43 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "metrics.h"
+
+// Fixed-size object pools for the server's hot-path types. Each thread keeps
+// a small cache ("magazine") of free objects per pool and only takes the
+// pool lock to trade a whole magazine with the shared depot, which is
+// refilled by carving slabs. Objects are recycled, never returned to libc,
+// so steady-state traffic does no general-purpose heap allocation.
+
+#define POOL_MAX 8
+#define POOL_MAGAZINE 32             // objects moved between a thread and the depot at once
+#define POOL_SLAB_BYTES (64 * 1024)
+
+struct pool {
+    const char *name;
+    size_t obj_size;
+    int id;                          // registry index + 1, 0 until first use
+    pthread_mutex_t lock;            // guards the depot and slab list
+    void *depot;                     // free objects, linked through their first word
+    size_t depot_count;
+    void *slabs;
+    size_t slab_count;
+    size_t slab_bytes;
+    size_t capacity;                 // objects carved so far
+};
+
+#define POOL_ALIGN(n) (((n) + 15) & ~(size_t)15)
+#define POOL_INITIALIZER(label, type) \
+    { (label), POOL_ALIGN(sizeof(type)), 0, PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL, 0, 0, 0 }
+
+void *pool_alloc(struct pool *p);
+void *pool_zalloc(struct pool *p);
+void pool_free(struct pool *p, void *obj);
+
+// One "[Stats] pool ..." line per pool: live objects, free objects, slabs
+void pool_report(metrics_emit_fn emit, void *user);
+
+#endif // POOL_H
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ratelimit.h"
+
+#define RL_IP_KEY (1ull << 48)   // per-IP keys never collide with ip:port keys
+
+static const int64_t class_rate[RL_CLASSES] = { RL_CHAT_RATE, RL_ROOM_RATE, RL_CONN_RATE };
+static const int64_t class_burst[RL_CLASSES] = { RL_CHAT_BURST, RL_ROOM_BURST, RL_CONN_BURST };
+
+void ratelimit_init(struct ratelimit *rl) {
+    memset(rl, 0, sizeof(*rl));
+    for (int i = 0; i < RL_STRIPES; ++i) pthread_mutex_init(&rl->stripes[i].lock, NULL);
+}
+
+void ratelimit_destroy(struct ratelimit *rl) {
+    for (int i = 0; i < RL_STRIPES; ++i) {
+        struct rl_stripe *stripe = &rl->stripes[i];
+        for (int h = 0; h < RL_STRIPE_HEADS; ++h) {
+            struct rl_bucket *b = stripe->heads[h];
+            while (b) {
+                struct rl_bucket *next = b->next;
+                free(b);
+                b = next;
+            }
+        }
+        pthread_mutex_destroy(&stripe->lock);
+    }
+}
+
+enum rl_class ratelimit_class(const char *cmd) {
+    if (strcmp(cmd, "say") == 0 || strcmp(cmd, "sayto") == 0 || strcmp(cmd, "sayroom") == 0 ||
+        strcmp(cmd, "pub") == 0)
+        return RL_CLASS_CHAT;
+    if (strcmp(cmd, "conn") == 0 || strcmp(cmd, "rename") == 0)
+        return RL_CLASS_CONN;
+    if (strcmp(cmd, "re-ping") == 0 || strcmp(cmd, "disconn") == 0)
+        return RL_CLASS_EXEMPT;
+    return RL_CLASS_ROOM;
+}
+
+static uint64_t mix_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+static int idle(const struct rl_bucket *b, uint64_t now_ns) {
+    return now_ns - b->last_ns > (uint64_t)RL_IDLE_SEC * 1000000000ull;
+}
+
+// Frees the idle buckets on one chain
+static void sweep_chain(struct rl_stripe *stripe, unsigned head, uint64_t now_ns) {
+    struct rl_bucket **link = &stripe->heads[head];
+    while (*link) {
+        struct rl_bucket *b = *link;
+        if (idle(b, now_ns)) {
+            *link = b->next;
+            free(b);
+            stripe->count--;
+            continue;
+        }
+        link = &b->next;
+    }
+}
+
+// Unlinks the least recently used bucket of the first non-empty chain from
+// <head> on
+static struct rl_bucket *evict_stalest(struct rl_stripe *stripe, unsigned head) {
+    for (unsigned i = 0; i < RL_STRIPE_HEADS; ++i) {
+        struct rl_bucket **stalest = NULL;
+        for (struct rl_bucket **link = &stripe->heads[(head + i) % RL_STRIPE_HEADS]; *link;
+             link = &(*link)->next) {
+            if (!stalest || (*link)->last_ns < (*stalest)->last_ns) stalest = link;
+        }
+        if (!stalest) continue;
+        struct rl_bucket *b = *stalest;
+        *stalest = b->next;
+        stripe->count--;
+        return b;
+    }
+    return NULL;
+}
+
+// Finds or creates the bucket for <key>, reclaiming idle buckets on its chain.
+// Every new bucket also sweeps one other chain, so a burst of one-off sources
+// is reclaimed without a timer, and past RL_STRIPE_MAX_BUCKETS a new source
+// reuses the stalest bucket, preferably from its own chain.
+// Caller holds the stripe lock.
+static struct rl_bucket *lookup(struct rl_stripe *stripe, uint64_t hash, uint64_t key,
+                                int factor, uint64_t now_ns) {
+    unsigned head = (unsigned)((hash >> 8) % RL_STRIPE_HEADS);
+    struct rl_bucket **link = &stripe->heads[head];
+    while (*link) {
+        struct rl_bucket *b = *link;
+        if (b->key == key) return b;
+        if (idle(b, now_ns)) {
+            *link = b->next;
+            free(b);
+            stripe->count--;
+            continue;
+        }
+        link = &b->next;
+    }
+    sweep_chain(stripe, stripe->sweep++ % RL_STRIPE_HEADS, now_ns);
+    struct rl_bucket *b = stripe->count >= RL_STRIPE_MAX_BUCKETS ? evict_stalest(stripe, head) : NULL;
+    if (!b) b = malloc(sizeof(*b));
+    if (!b) return NULL;
+    stripe->count++;
+    link = &stripe->heads[head];
+    b->key = key;
+    b->last_ns = now_ns;
+    for (int c = 0; c < RL_CLASSES; ++c) {
+        b->tokens[c] = class_burst[c] * factor * 1000;
+        b->warned[c] = 0;
+    }
+    b->next = *link;
+    *link = b;
+    return b;
+}
+
+// Refills every class for the time elapsed, then takes one token from <cls>
+static enum rl_verdict take(struct rl_bucket *b, enum rl_class cls, int factor, uint64_t now_ns) {
+    uint64_t elapsed_us = (now_ns - b->last_ns) / 1000;
+    b->last_ns = now_ns;
+    for (int c = 0; c < RL_CLASSES; ++c) {
+        int64_t cap = class_burst[c] * factor * 1000;
+        int64_t refill = (int64_t)(elapsed_us * (uint64_t)(class_rate[c] * factor) / 1000);
+        b->tokens[c] = b->tokens[c] + refill > cap ? cap : b->tokens[c] + refill;
+    }
+    if (b->tokens[cls] >= 1000) {
+        b->tokens[cls] -= 1000;
+        b->warned[cls] = 0;
+        return RL_PASS;
+    }
+    if (b->warned[cls]) return RL_THROTTLED;
+    b->warned[cls] = 1;
+    return RL_THROTTLED_FIRST;
+}
+
+static enum rl_verdict check_key(struct ratelimit *rl, uint64_t key, int factor,
+                                 enum rl_class cls, uint64_t now_ns) {
+    uint64_t hash = mix_key(key);
+    struct rl_stripe *stripe = &rl->stripes[hash % RL_STRIPES];
+    pthread_mutex_lock(&stripe->lock);
+    struct rl_bucket *b = lookup(stripe, hash, key, factor, now_ns);
+    enum rl_verdict v = b ? take(b, cls, factor, now_ns) : RL_PASS;
+    pthread_mutex_unlock(&stripe->lock);
+    return v;
+}
+
+enum rl_verdict ratelimit_check(struct ratelimit *rl, const struct sockaddr_in *addr,
+                                enum rl_class cls, uint64_t now_ns) {
+    if (cls >= RL_CLASSES) return RL_PASS;
+    uint64_t ip = ntohl(addr->sin_addr.s_addr);
+    uint64_t client_key = (ip << 16) | ntohs(addr->sin_port);
+    enum rl_verdict v = check_key(rl, client_key, 1, cls, now_ns);
+    // Loopback and local (shm) addresses stand for many simulated clients on
+    // one host (loadgen, bots); only per-client limits apply
+    if (v != RL_PASS || (ip >> 24) == 127 || ip == INADDR_ANY) return v;
+    return check_key(rl, RL_IP_KEY | ip, RL_IP_FACTOR, cls, now_ns);
+}
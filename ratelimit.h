@@ -0,0 +1,68 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+// Token buckets per client (ip:port) and per IP, one bucket per command
+// class. Checked before handle_request touches server_state, so a flooding
+// client only costs a hash lookup on one lock stripe.
+
+#define RL_STRIPES 64
+#define RL_STRIPE_HEADS 256
+#define RL_IDLE_SEC 120          // buckets untouched this long are reclaimed
+#define RL_STRIPE_MAX_BUCKETS 4096   // beyond this a new source evicts the stalest bucket
+
+// Sustained rate (per second) and burst per client; IPs get RL_IP_FACTOR
+// times as much so clients behind one NAT do not starve each other.
+// Loopback addresses and shared-memory clients (0.0.0.0, shm.h) are exempt
+// from the per-IP bucket.
+#define RL_CHAT_RATE 10
+#define RL_CHAT_BURST 20
+#define RL_ROOM_RATE 2
+#define RL_ROOM_BURST 5
+#define RL_CONN_RATE 1
+#define RL_CONN_BURST 3
+#define RL_IP_FACTOR 16
+
+enum rl_class {
+    RL_CLASS_CHAT,               // say$, sayto$, sayroom$, pub$
+    RL_CLASS_ROOM,               // createroom$, joinroom$, leaveroom$, history$, mute$, ...
+    RL_CLASS_CONN,               // conn$, rename$
+    RL_CLASSES,
+    RL_CLASS_EXEMPT = RL_CLASSES // re-ping$, disconn$: never limited
+};
+
+enum rl_verdict {
+    RL_PASS,
+    RL_THROTTLED,
+    RL_THROTTLED_FIRST           // first drop since the bucket last had tokens
+};
+
+struct rl_bucket {
+    uint64_t key;
+    uint64_t last_ns;
+    int64_t tokens[RL_CLASSES];  // in millitokens
+    uint8_t warned[RL_CLASSES];
+    struct rl_bucket *next;
+};
+
+struct rl_stripe {
+    pthread_mutex_t lock;
+    size_t count;
+    unsigned sweep;              // next chain to scan for idle buckets
+    struct rl_bucket *heads[RL_STRIPE_HEADS];
+};
+
+struct ratelimit {
+    struct rl_stripe stripes[RL_STRIPES];
+};
+
+void ratelimit_init(struct ratelimit *rl);
+void ratelimit_destroy(struct ratelimit *rl);
+enum rl_class ratelimit_class(const char *cmd);
+enum rl_verdict ratelimit_check(struct ratelimit *rl, const struct sockaddr_in *addr,
+                                enum rl_class cls, uint64_t now_ns);
+
+#endif // RATELIMIT_H
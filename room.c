@@ -1,28 +1,109 @@
 #include <stdlib.h>
 #include <string.h>
 #include "room.h"
+#include "pool.h"
+#include "client_table.h"
 
-// Basic djb2 hash to map room names into fixed buckets
+static struct pool room_pool = POOL_INITIALIZER("chat_room", struct chat_room);
+static struct pool member_pool = POOL_INITIALIZER("room_member", struct room_member);
+
+// Buckets come from the hash computed once when the name was interned
 static unsigned room_hash_name(const char *name) {
-    unsigned long hash = 5381;
-    if (!name) return 0;
-    int c;
-    while ((c = *name++)) {
-        hash = ((hash << 5) + hash) + (unsigned char)c;
-    }
-    return (unsigned)(hash % ROOM_BUCKETS);
+    return intern_hash(name) % ROOM_BUCKETS;
 }
 
-// Releases a room plus all membership links
+// Releases a room plus all membership links. Only used once the room is
+// empty or the whole state is being torn down.
 static void free_room(struct chat_room *room) {
     if (!room) return;
-    struct room_member *member = room->members;
-    while (member) {
-        struct room_member *next = member->next;
-        free(member);
-        member = next;
+    for (uint32_t i = 0; i < room->member_count; ++i) pool_free(&member_pool, room->links[i]);
+    free(room->members);
+    free(room->links);
+    history_destroy(&room->log);
+    intern_release(room->name);
+    pool_free(&room_pool, room);
+}
+
+static int reserve_members(struct chat_room *room) {
+    if (room->member_count < room->member_cap) return 0;
+    uint32_t cap = room->member_cap ? room->member_cap * 2 : ROOM_MEMBERS_MIN;
+    struct client_node **members = realloc(room->members, cap * sizeof(*members));
+    if (!members) return -1;
+    room->members = members;
+    struct room_member **links = realloc(room->links, cap * sizeof(*links));
+    if (!links) return -1;
+    room->links = links;
+    room->member_cap = cap;
+    return 0;
+}
+
+// Client lists hold at most MAX_CLIENT_ROOMS (or MAX_CLIENT_TOPICS) links
+static struct room_member *find_link(struct room_member *list, const struct chat_room *room) {
+    for (struct room_member *m = list; m; m = m->next)
+        if (m->room == room) return m;
+    return NULL;
+}
+
+struct room_member *room_membership(const struct chat_room *room, const struct client_node *client) {
+    return find_link(client->rooms, room);
+}
+
+// Links <client> into <room> and onto the front of <list>
+static int link_member(struct chat_room *room, struct client_node *client,
+                       struct room_member **list, uint8_t *count, int max) {
+    if (!room || !client) return -1;
+    if (find_link(*list, room)) return 1;
+    if (*count >= max || reserve_members(room) != 0) return -1;
+    struct room_member *m = pool_alloc(&member_pool);
+    if (!m) return -1;
+    m->room = room;
+    m->client = client;
+    m->pos = room->member_count++;
+    room->members[m->pos] = client;
+    room->links[m->pos] = m;
+    m->next = *list;
+    *list = m;
+    (*count)++;
+    return 0;
+}
+
+static int unlink_member(struct chat_room *room, struct room_member **list, uint8_t *count) {
+    if (!room) return -1;
+    struct room_member **ind = list;
+    while (*ind && (*ind)->room != room) ind = &(*ind)->next;
+    struct room_member *m = *ind;
+    if (!m) return -1;
+    *ind = m->next;
+    (*count)--;
+    uint32_t last = --room->member_count;
+    if (m->pos != last) {
+        room->members[m->pos] = room->members[last];
+        room->links[m->pos] = room->links[last];
+        room->links[m->pos]->pos = m->pos;
     }
-    free(room);
+    pool_free(&member_pool, m);
+    return 0;
+}
+
+int room_join(struct chat_room *room, struct client_node *client) {
+    if (!client) return -1;
+    return link_member(room, client, &client->rooms, &client->room_count, MAX_CLIENT_ROOMS);
+}
+
+int room_leave(struct chat_room *room, struct client_node *client) {
+    if (!client) return -1;
+    return unlink_member(room, &client->rooms, &client->room_count);
+}
+
+int room_subscribe(struct chat_room *room, struct client_node *client) {
+    if (!client) return -1;
+    struct client_cold *cold = client->cold;
+    return link_member(room, client, &cold->topics, &cold->topic_count, MAX_CLIENT_TOPICS);
+}
+
+int room_unsubscribe(struct chat_room *room, struct client_node *client) {
+    if (!client) return -1;
+    return unlink_member(room, &client->cold->topics, &client->cold->topic_count);
 }
 
 // Initialize every bucket to NULL and set up the mutex.
@@ -60,7 +141,7 @@ struct chat_room *room_table_find(struct room_table *table, const char *name) {
     pthread_mutex_lock(&table->lock);
     struct chat_room *room = table->buckets[idx];
     while (room) {
-        if (strncmp(room->name, name, MAX_NAME_LEN) == 0) {
+        if (room->name == name) {
             pthread_mutex_unlock(&table->lock);
             return room;
         }
@@ -72,25 +153,25 @@ struct chat_room *room_table_find(struct room_table *table, const char *name) {
 
 // Create and insert a new room: fails if name already exists
 struct chat_room *room_table_insert(struct room_table *table, const char *name) {
-    if (!table || !name || name[0] == '\0') return NULL;
+    if (!table || !name) return NULL;
     pthread_mutex_lock(&table->lock);
     unsigned idx = room_hash_name(name);
     struct chat_room *cursor = table->buckets[idx];
     while (cursor) {
-        if (strncmp(cursor->name, name, MAX_NAME_LEN) == 0) {
+        if (cursor->name == name) {
             pthread_mutex_unlock(&table->lock);
             return NULL;
         }
         cursor = cursor->next;
     }
-    struct chat_room *room = calloc(1, sizeof(*room));
+    struct chat_room *room = pool_zalloc(&room_pool);
     if (!room) {
         pthread_mutex_unlock(&table->lock);
         return NULL;
     }
-    strncpy(room->name, name, MAX_NAME_LEN - 1);
-    room->name[MAX_NAME_LEN - 1] = '\0';
+    room->name = intern_ref(name);
     queue_init(&room->history);
+    history_init(&room->log);
     room->next = table->buckets[idx]; // get head of bucket
     table->buckets[idx] = room;
     pthread_mutex_unlock(&table->lock);
@@ -104,7 +185,7 @@ int room_table_remove(struct room_table *table, const char *name) {
     pthread_mutex_lock(&table->lock);
     struct chat_room **ind = &table->buckets[idx];
     while (*ind) {
-        if (strncmp((*ind)->name, name, MAX_NAME_LEN) == 0) {
+        if ((*ind)->name == name) {
             struct chat_room *del = *ind;
             *ind = del->next;
             free_room(del);
@@ -2,7 +2,10 @@
 #define ROOM_H
 
 #include "circular_queue.h"
+#include "history.h"
 #include <pthread.h>
+#include <stdint.h>
+#include "intern.h"
 
 #ifndef MAX_NAME_LEN
 #define MAX_NAME_LEN 64
@@ -12,17 +15,31 @@
 #define ROOM_BUCKETS 32
 #endif
 
+#define MAX_CLIENT_ROOMS 16
+#define MAX_CLIENT_TOPICS 16
+#define ROOM_MEMBERS_MIN 4
+
 struct client_node;
 
+// One client's membership in one room, indexed both ways. The room keeps
+// its members in a dense array for fan-out and the link remembers its
+// position there, so leaving is a swap-remove. The client keeps a list of
+// its links, most recent join first (client_node.rooms).
 struct room_member {
+    struct chat_room *room;
     struct client_node *client;
-    struct room_member *next;
+    struct room_member *next;    // the client's next membership
+    uint32_t pos;                // index in room->members
 };
 
 struct chat_room {
-    char name[MAX_NAME_LEN];
+    const char *name;            // interned handle, referenced by the room
     message_queue history;
-    struct room_member *members;
+    struct history_log log;
+    struct client_node **members;   // dense: what deliver_room walks
+    struct room_member **links;     // links[i] is members[i]'s membership
+    uint32_t member_count;
+    uint32_t member_cap;
     struct chat_room *next;
 };
 
@@ -33,8 +50,23 @@ struct room_table {
 
 void room_table_init(struct room_table *table);
 void room_table_destroy(struct room_table *table);
+
+// <name> is an interned handle: rooms are matched by pointer
 struct chat_room *room_table_find(struct room_table *table, const char *name);
 struct chat_room *room_table_insert(struct room_table *table, const char *name);
 int room_table_remove(struct room_table *table, const char *name);
 
+// Membership; callers hold the server_state write lock. room_join returns
+// 0, 1 when <client> is already a member, -1 when the client is in
+// MAX_CLIENT_ROOMS rooms or memory runs out. room_leave returns -1 when
+// <client> is not a member.
+int room_join(struct chat_room *room, struct client_node *client);
+int room_leave(struct chat_room *room, struct client_node *client);
+struct room_member *room_membership(const struct chat_room *room, const struct client_node *client);
+
+// The same membership for topic subscriptions (topic.h): links go on the
+// client's cold->topics list, capped at MAX_CLIENT_TOPICS
+int room_subscribe(struct chat_room *room, struct client_node *client);
+int room_unsubscribe(struct chat_room *room, struct client_node *client);
+
 #endif // ROOM_H
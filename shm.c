@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "shm.h"
+
+#define SHM_HANDSHAKE_FDS 3          // memfd, up eventfd, down eventfd
+
+void shm_socket_path(char *out, size_t cap, int port) {
+    if (port == SERVER_PORT) snprintf(out, cap, "%s", SHM_SOCKET_PATH);
+    else snprintf(out, cap, SHM_SOCKET_PATH_FMT, port);
+}
+
+// ---------------- rings ----------------
+
+// The head store and the waiting load are both seq_cst, pairing with the
+// store-then-load in shm_chan_arm: either the consumer sees the new head or
+// the producer sees the flag, never neither
+static int ring_push(struct shm_ring *r, int wake_fd, const void *buf, size_t len) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail >= SHM_RING_SLOTS) {
+        errno = EAGAIN;
+        return -1;
+    }
+    struct shm_slot *slot = &r->slots[head & (SHM_RING_SLOTS - 1)];
+    if (len > BUFFER_SIZE) len = BUFFER_SIZE;
+    memcpy(slot->data, buf, len);
+    slot->len = (uint32_t)len;
+    atomic_store(&r->head, head + 1);
+    if (atomic_load(&r->waiting) && atomic_exchange(&r->waiting, 0)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) return -1;
+    }
+    return 0;
+}
+
+// The other end can write anything into the shared region, so the length
+// is clamped before it is trusted
+static int ring_pop(struct shm_ring *r, char out[BUFFER_SIZE]) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail == head) return -1;
+    const struct shm_slot *slot = &r->slots[tail & (SHM_RING_SLOTS - 1)];
+    uint32_t len = slot->len < BUFFER_SIZE ? slot->len : BUFFER_SIZE;
+    memcpy(out, slot->data, len);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return (int)len;
+}
+
+int shm_chan_send(struct shm_chan *ch, const void *buf, size_t len) {
+    pthread_mutex_lock(&ch->send_lock);
+    int rc = ring_push(ch->tx, ch->tx_fd, buf, len);
+    pthread_mutex_unlock(&ch->send_lock);
+    return rc;
+}
+
+int shm_chan_recv(struct shm_chan *ch, char out[BUFFER_SIZE]) {
+    return ring_pop(ch->rx, out);
+}
+
+int shm_chan_arm(struct shm_chan *ch) {
+    atomic_store(&ch->rx->waiting, 1);
+    return atomic_load(&ch->rx->head) == atomic_load_explicit(&ch->rx->tail, memory_order_relaxed);
+}
+
+void shm_chan_ack(struct shm_chan *ch) {
+    uint64_t count;
+    while (read(ch->rx_fd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+}
+
+static void chan_init(struct shm_chan *ch) {
+    memset(ch, 0, sizeof(*ch));
+    ch->region = MAP_FAILED;
+    ch->tx_fd = ch->rx_fd = ch->sock = -1;
+    pthread_mutex_init(&ch->send_lock, NULL);
+}
+
+void shm_chan_close(struct shm_chan *ch) {
+    if (!ch) return;
+    if (ch->region != MAP_FAILED) munmap(ch->region, sizeof(*ch->region));
+    if (ch->tx_fd >= 0) close(ch->tx_fd);
+    if (ch->rx_fd >= 0) close(ch->rx_fd);
+    if (ch->sock >= 0) close(ch->sock);
+    pthread_mutex_destroy(&ch->send_lock);
+    ch->region = MAP_FAILED;
+    ch->tx_fd = ch->rx_fd = ch->sock = -1;
+}
+
+// ---------------- handshake ----------------
+
+static int send_fds(int sock, const int fds[SHM_HANDSHAKE_FDS]) {
+    char byte = 0;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(SHM_HANDSHAKE_FDS * sizeof(int))];
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf) };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(SHM_HANDSHAKE_FDS * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, SHM_HANDSHAKE_FDS * sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static int recv_fds(int sock, int fds[SHM_HANDSHAKE_FDS]) {
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(SHM_HANDSHAKE_FDS * sizeof(int))];
+    } ctrl;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf) };
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(SHM_HANDSHAKE_FDS * sizeof(int))) {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), SHM_HANDSHAKE_FDS * sizeof(int));
+    return 0;
+}
+
+int shm_chan_attach(struct shm_chan *ch, const char *path) {
+    chan_init(ch);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fds[SHM_HANDSHAKE_FDS];
+    ch->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ch->sock < 0 || connect(ch->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        recv_fds(ch->sock, fds) != 0) {
+        shm_chan_close(ch);
+        return -1;
+    }
+    ch->region = mmap(NULL, sizeof(*ch->region), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    ch->tx_fd = fds[1];
+    ch->rx_fd = fds[2];
+    if (ch->region == MAP_FAILED) {
+        shm_chan_close(ch);
+        return -1;
+    }
+    ch->tx = &ch->region->up;
+    ch->rx = &ch->region->down;
+    return 0;
+}
+
+// Server end of a new session: maps a fresh region and passes it, with
+// both eventfds, to the client on <sock>
+static struct shm_chan *chan_create(int sock) {
+    struct shm_chan *ch = malloc(sizeof(*ch));
+    if (!ch) return NULL;
+    chan_init(ch);
+    ch->sock = sock;
+    int memfd = memfd_create("chat_shm", MFD_CLOEXEC);
+    ch->rx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ch->tx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (memfd >= 0 && ftruncate(memfd, sizeof(*ch->region)) == 0)
+        ch->region = mmap(NULL, sizeof(*ch->region), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    int fds[SHM_HANDSHAKE_FDS] = { memfd, ch->rx_fd, ch->tx_fd };
+    if (memfd < 0 || ch->rx_fd < 0 || ch->tx_fd < 0 || ch->region == MAP_FAILED ||
+        send_fds(sock, fds) != 0) {
+        if (memfd >= 0) close(memfd);
+        shm_chan_close(ch);
+        free(ch);
+        return NULL;
+    }
+    close(memfd);
+    ch->tx = &ch->region->down;
+    ch->rx = &ch->region->up;
+    return ch;
+}
+
+// ---------------- server ----------------
+
+// epoll tags: the listening socket is 0, a session's eventfd is its id
+// shifted left, and its Unix connection has the low bit set
+#define SHM_TAG_SOCK 1u
+
+static struct sockaddr_in chan_addr(uint16_t id) {
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(id);
+    return addr;
+}
+
+static void server_accept(struct shm_server *s) {
+    int sock = accept4(s->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) return;
+    uint16_t id = 0;
+    for (int i = 0; i < SHM_MAX_CHANNELS; ++i) {
+        uint16_t candidate = (uint16_t)((s->next_id + i) % SHM_MAX_CHANNELS + 1);
+        if (!s->chans[candidate]) {
+            id = candidate;
+            break;
+        }
+    }
+    struct shm_chan *ch = id ? chan_create(sock) : NULL;
+    if (!ch) {
+        close(sock);
+        return;
+    }
+    struct epoll_event wake = { .events = EPOLLIN, .data.u64 = (uint64_t)id << 1 };
+    struct epoll_event hup = { .events = EPOLLIN | EPOLLRDHUP, .data.u64 = ((uint64_t)id << 1) | SHM_TAG_SOCK };
+    if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, ch->rx_fd, &wake) != 0 ||
+        epoll_ctl(s->epfd, EPOLL_CTL_ADD, ch->sock, &hup) != 0) {
+        shm_chan_close(ch);
+        free(ch);
+        return;
+    }
+    pthread_rwlock_wrlock(&s->lock);
+    s->chans[id] = ch;
+    pthread_rwlock_unlock(&s->lock);
+    s->active[s->active_count++] = id;
+    s->next_id = id;
+}
+
+// The client hung up: unpublish the session before telling the server, so
+// nothing sends into a ring that is about to be unmapped
+static void server_drop(struct shm_server *s, uint16_t id) {
+    struct shm_chan *ch = s->chans[id];
+    if (!ch) return;
+    pthread_rwlock_wrlock(&s->lock);
+    s->chans[id] = NULL;
+    pthread_rwlock_unlock(&s->lock);
+    for (size_t i = 0; i < s->active_count; ++i) {
+        if (s->active[i] == id) {
+            s->active[i] = s->active[--s->active_count];
+            break;
+        }
+    }
+    struct sockaddr_in addr = chan_addr(id);
+    if (s->on_close) s->on_close(&addr, s->user);
+    shm_chan_close(ch);
+    free(ch);
+}
+
+// Drains every ring in turn, at most SHM_DRAIN_BATCH datagrams at a time so
+// one busy client cannot starve the rest, and only blocks in epoll once all
+// of them are empty and armed
+static void *shm_server_thread(void *arg) {
+    struct shm_server *s = arg;
+    char buf[BUFFER_SIZE];
+    struct epoll_event events[64];
+    for (;;) {
+        int busy = 0;
+        for (size_t i = 0; i < s->active_count; ++i) {
+            uint16_t id = s->active[i];
+            struct sockaddr_in addr = chan_addr(id);
+            for (int n = 0; n < SHM_DRAIN_BATCH; ++n) {
+                int len = shm_chan_recv(s->chans[id], buf);
+                if (len < 0) break;
+                busy = 1;
+                s->on_recv(&addr, buf, (size_t)len, s->user);
+            }
+        }
+        int timeout = busy ? 0 : -1;
+        for (size_t i = 0; timeout < 0 && i < s->active_count; ++i)
+            if (!shm_chan_arm(s->chans[s->active[i]])) timeout = 0;
+
+        int n = epoll_wait(s->epfd, events, 64, timeout);
+        for (int i = 0; i < n; ++i) {
+            uint64_t tag = events[i].data.u64;
+            uint16_t id = (uint16_t)(tag >> 1);
+            if (tag == 0) {
+                server_accept(s);
+            } else if (!s->chans[id]) {
+                continue;
+            } else if (tag & SHM_TAG_SOCK) {
+                // Clients never write here; anything readable is EOF or junk
+                char junk[64];
+                ssize_t got = recv(s->chans[id]->sock, junk, sizeof(junk), MSG_DONTWAIT);
+                if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR) ||
+                    (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    server_drop(s, id);
+            } else {
+                shm_chan_ack(s->chans[id]);
+            }
+        }
+    }
+    return NULL;
+}
+
+int shm_server_start(struct shm_server *s, const char *path,
+                     shm_recv_fn on_recv, shm_close_fn on_close, void *user) {
+    memset(s, 0, sizeof(*s));
+    s->on_recv = on_recv;
+    s->on_close = on_close;
+    s->user = user;
+    pthread_rwlock_init(&s->lock, NULL);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = 0 };
+    pthread_t thread;
+    if (s->listen_fd < 0 || s->epfd < 0 ||
+        bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(s->listen_fd, 64) != 0 ||
+        epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->listen_fd, &ev) != 0 ||
+        pthread_create(&thread, NULL, shm_server_thread, s) != 0) {
+        if (s->listen_fd >= 0) close(s->listen_fd);
+        if (s->epfd >= 0) close(s->epfd);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+int shm_server_send(struct shm_server *s, const struct sockaddr_in *addr, const void *buf, size_t len) {
+    unsigned id = ntohs(addr->sin_port);
+    if (id == 0 || id > SHM_MAX_CHANNELS) return -1;
+    pthread_rwlock_rdlock(&s->lock);
+    struct shm_chan *ch = s->chans[id];
+    int rc = ch ? shm_chan_send(ch, buf, len) : -1;
+    pthread_rwlock_unlock(&s->lock);
+    return rc;
+}
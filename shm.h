@@ -0,0 +1,103 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "udp.h"
+
+// Shared-memory transport for clients on the server's host. A client
+// connects to the server's Unix socket and gets back, as SCM_RIGHTS, a
+// memfd holding one ring per direction plus an eventfd for each. Datagrams
+// then move through the rings without a system call. A consumer that finds
+// its ring empty sets a flag and sleeps on its eventfd, and the producer
+// only writes the eventfd while that flag is set. The Unix connection stays
+// open for the session: either side closing it ends it.
+//
+// On the server a local client is addressed as 0.0.0.0:<channel id>, an
+// address no UDP datagram can come from, so the rest of the server keeps
+// identifying clients by sockaddr_in.
+
+#define SHM_SOCKET_PATH "/tmp/chat_server.shm"
+#define SHM_SOCKET_PATH_FMT "/tmp/chat_server.%d.shm"   // servers on non-default ports
+#define SHM_RING_SLOTS 128           // datagrams per direction (power of two)
+#define SHM_MAX_CHANNELS 1024        // local clients per server; ids stay clear of the admin port
+#define SHM_DRAIN_BATCH 32           // datagrams taken from one client before the next
+
+struct shm_slot {
+    uint32_t len;
+    char data[BUFFER_SIZE];
+};
+
+// Producer and consumer counters sit on separate cache lines
+struct shm_ring {
+    _Alignas(64) atomic_uint head;   // next slot to fill, written by the producer
+    _Alignas(64) atomic_uint tail;   // next slot to read, written by the consumer
+    atomic_uint waiting;             // consumer is asleep, or about to be
+    _Alignas(64) struct shm_slot slots[SHM_RING_SLOTS];
+};
+
+struct shm_region {
+    struct shm_ring up;              // client -> server
+    struct shm_ring down;            // server -> client
+};
+
+// One end of a session; tx/rx point at the rings this end writes and reads
+struct shm_chan {
+    struct shm_region *region;
+    struct shm_ring *tx, *rx;
+    int tx_fd;                       // eventfd the other end sleeps on
+    int rx_fd;                       // eventfd this end sleeps on
+    int sock;                        // the Unix connection
+    pthread_mutex_t send_lock;       // several threads may send on one end
+};
+
+// Fills <out> (108 bytes, as sockaddr_un.sun_path) with the socket path
+// of the server on <port>
+void shm_socket_path(char *out, size_t cap, int port);
+
+// Client side. Returns 0 or -1 (errno set).
+int shm_chan_attach(struct shm_chan *ch, const char *path);
+void shm_chan_close(struct shm_chan *ch);
+
+// Returns -1 with errno EAGAIN when the ring is full
+int shm_chan_send(struct shm_chan *ch, const void *buf, size_t len);
+// Copies the next datagram into <out>; returns its length, or -1 when empty
+int shm_chan_recv(struct shm_chan *ch, char out[BUFFER_SIZE]);
+// Asks for a wakeup on rx_fd; returns 1 when the ring is still empty after
+// that, so the caller may sleep, and 0 when it should drain again
+int shm_chan_arm(struct shm_chan *ch);
+// Clears a wakeup that has been delivered on rx_fd
+void shm_chan_ack(struct shm_chan *ch);
+
+typedef void (*shm_recv_fn)(const struct sockaddr_in *src, const char *data, size_t len, void *user);
+typedef void (*shm_close_fn)(const struct sockaddr_in *src, void *user);
+
+// Server side: one thread accepts sessions and drains every client ring,
+// handing each datagram to on_recv; on_close runs when a client hangs up
+struct shm_server {
+    int listen_fd;
+    int epfd;
+    shm_recv_fn on_recv;
+    shm_close_fn on_close;
+    void *user;
+    pthread_rwlock_t lock;           // chans[] against senders
+    struct shm_chan *chans[SHM_MAX_CHANNELS + 1];   // by id; 0 is unused
+    uint16_t active[SHM_MAX_CHANNELS];              // live ids, only touched by the thread
+    size_t active_count;
+    uint16_t next_id;                // ids are handed out round-robin
+};
+
+int shm_server_start(struct shm_server *s, const char *path,
+                     shm_recv_fn on_recv, shm_close_fn on_close, void *user);
+
+static inline int shm_addr_is_local(const struct sockaddr_in *addr) {
+    return addr->sin_addr.s_addr == htonl(INADDR_ANY);
+}
+
+// Sends to the local client at <addr>; -1 when it has gone or its ring is full
+int shm_server_send(struct shm_server *s, const struct sockaddr_in *addr, const void *buf, size_t len);
+
+#endif // SHM_H
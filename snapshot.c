@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "chat_server.h"
+#include "snapshot.h"
+#include "coalesce.h"
+#include "shm.h"
+
+// Everything is written in host byte order; snapshots are not portable
+// between architectures, only between restarts on the same box.
+
+static int put_u8(FILE *fp, uint8_t v)   { return fwrite(&v, sizeof(v), 1, fp) == 1 ? 0 : -1; }
+static int put_u16(FILE *fp, uint16_t v) { return fwrite(&v, sizeof(v), 1, fp) == 1 ? 0 : -1; }
+static int put_u32(FILE *fp, uint32_t v) { return fwrite(&v, sizeof(v), 1, fp) == 1 ? 0 : -1; }
+static int put_u64(FILE *fp, uint64_t v) { return fwrite(&v, sizeof(v), 1, fp) == 1 ? 0 : -1; }
+
+static int get_u8(FILE *fp, uint8_t *v)   { return fread(v, sizeof(*v), 1, fp) == 1 ? 0 : -1; }
+static int get_u16(FILE *fp, uint16_t *v) { return fread(v, sizeof(*v), 1, fp) == 1 ? 0 : -1; }
+static int get_u32(FILE *fp, uint32_t *v) { return fread(v, sizeof(*v), 1, fp) == 1 ? 0 : -1; }
+static int get_u64(FILE *fp, uint64_t *v) { return fread(v, sizeof(*v), 1, fp) == 1 ? 0 : -1; }
+
+// Length-prefixed string (no terminator on disk)
+static int put_str(FILE *fp, const char *str) {
+    size_t len = strnlen(str, BUFFER - 1);
+    if (put_u16(fp, (uint16_t)len) != 0) return -1;
+    return len == 0 || fwrite(str, 1, len, fp) == len ? 0 : -1;
+}
+
+// Reads a length-prefixed string into <out> (size <cap>), truncating if needed
+static int get_str(FILE *fp, char *out, size_t cap) {
+    uint16_t len;
+    if (get_u16(fp, &len) != 0) return -1;
+    char tmp[BUFFER];
+    if (len >= sizeof(tmp)) return -1;
+    if (len && fread(tmp, 1, len, fp) != len) return -1;
+    size_t n = len < cap - 1 ? len : cap - 1;
+    memcpy(out, tmp, n);
+    out[n] = '\0';
+    return 0;
+}
+
+static int put_queue(FILE *fp, const message_queue *q) {
+    if (put_u32(fp, (uint32_t)q->size) != 0) return -1;
+    int idx = q->head;
+    for (int i = 0; i < q->size; ++i) {
+        if (put_str(fp, q->messages[idx]) != 0) return -1;
+        idx = (idx + 1) % max_messages;
+    }
+    return 0;
+}
+
+static int get_queue(FILE *fp, message_queue *q) {
+    uint32_t size;
+    char msg[BUFFER];
+    if (get_u32(fp, &size) != 0) return -1;
+    for (uint32_t i = 0; i < size; ++i) {
+        if (get_str(fp, msg, sizeof(msg)) != 0) return -1;
+        enqueue(q, msg);
+    }
+    return 0;
+}
+
+struct log_writer {
+    FILE *fp;
+    int failed;
+};
+
+static void put_log_entry(uint64_t seq, const char *msg, void *user) {
+    (void)seq;
+    struct log_writer *w = user;
+    if (!w->failed && put_str(w->fp, msg) != 0) w->failed = 1;
+}
+
+// Logs are stored as <oldest seq> <count> <messages...>; seqs are contiguous
+static int put_log(FILE *fp, const struct history_log *log) {
+    uint64_t oldest = history_oldest_seq(log);
+    uint32_t count = (uint32_t)(log->next_seq - oldest);
+    if (put_u64(fp, oldest) != 0 || put_u32(fp, count) != 0) return -1;
+    struct log_writer w = { fp, 0 };
+    history_page(log, 0, (int)count, put_log_entry, &w);
+    return w.failed ? -1 : 0;
+}
+
+static int get_log(FILE *fp, struct history_log *log) {
+    uint64_t oldest;
+    uint32_t count;
+    char msg[BUFFER];
+    if (get_u64(fp, &oldest) != 0 || get_u32(fp, &count) != 0) return -1;
+    history_seek(log, oldest);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (get_str(fp, msg, sizeof(msg)) != 0) return -1;
+        history_append(log, msg);
+    }
+    return 0;
+}
+
+static int put_client(FILE *fp, const struct client_node *c) {
+    if (put_str(fp, c->cold->name) != 0) return -1;
+    if (put_u32(fp, c->addr.sin_addr.s_addr) != 0 || put_u16(fp, c->addr.sin_port) != 0) return -1;
+    if (put_u64(fp, (uint64_t)c->last_active) != 0) return -1;
+    if (put_u8(fp, (uint8_t)c->muted_count) != 0) return -1;
+    for (int i = 0; i < c->muted_count; ++i) {
+        if (put_str(fp, c->cold->muted[i]) != 0) return -1;
+    }
+    // Rooms oldest join first, so restoring in file order rebuilds the list
+    const char *rooms[MAX_CLIENT_ROOMS];
+    int n = 0;
+    for (struct room_member *m = c->rooms; m && n < MAX_CLIENT_ROOMS; m = m->next) rooms[n++] = m->room->name;
+    if (put_u8(fp, (uint8_t)n) != 0) return -1;
+    while (n > 0) {
+        if (put_str(fp, rooms[--n]) != 0) return -1;
+    }
+    const char *topics[MAX_CLIENT_TOPICS];
+    n = 0;
+    for (struct room_member *m = c->cold->topics; m && n < MAX_CLIENT_TOPICS; m = m->next)
+        topics[n++] = m->room->name;
+    if (put_u8(fp, (uint8_t)n) != 0) return -1;
+    while (n > 0) {
+        if (put_str(fp, topics[--n]) != 0) return -1;
+    }
+    return put_u8(fp, c->coalescing ? (uint8_t)c->cold->coalesce->window_ms : 0);
+}
+
+// Walks the room table without taking its mutex: the caller already
+// excludes writers, and in a forked child the mutex may be a stale copy.
+// Local clients are left out: their sessions end with this process.
+int snapshot_write(struct server_state *s, FILE *fp) {
+    uint32_t client_count = 0, room_count = 0;
+    for (size_t i = 0; i < s->clients.high; ++i) {
+        struct client_node *c = client_table_at(&s->clients, i);
+        if (c->live && !shm_addr_is_local(&c->addr)) client_count++;
+    }
+    for (int i = 0; i < ROOM_BUCKETS; ++i)
+        for (struct chat_room *r = s->rooms.buckets[i]; r; r = r->next) room_count++;
+
+    if (put_u32(fp, SNAPSHOT_MAGIC) != 0 || put_u32(fp, SNAPSHOT_VERSION) != 0) return -1;
+    if (put_u32(fp, client_count) != 0 || put_u32(fp, room_count) != 0) return -1;
+    if (put_queue(fp, &s->msg_queue) != 0 || put_log(fp, &s->global_log) != 0) return -1;
+
+    for (int i = 0; i < ROOM_BUCKETS; ++i) {
+        for (struct chat_room *r = s->rooms.buckets[i]; r; r = r->next) {
+            if (put_str(fp, r->name) != 0) return -1;
+            if (put_queue(fp, &r->history) != 0 || put_log(fp, &r->log) != 0) return -1;
+        }
+    }
+    for (size_t i = 0; i < s->clients.high; ++i) {
+        struct client_node *c = client_table_at(&s->clients, i);
+        if (c->live && !shm_addr_is_local(&c->addr) && put_client(fp, c) != 0) return -1;
+    }
+    return 0;
+}
+
+static int snapshot_join_room(struct server_state *s, struct client_node *c, const char *room_name) {
+    const char *handle = intern_find(room_name);
+    struct chat_room *room = room_table_find(&s->rooms, handle);
+    intern_release(handle);
+    if (!room) return 0;
+    return room_join(room, c) < 0 ? -1 : 0;
+}
+
+static int set_name(struct server_state *s, struct client_node *c, const char *name) {
+    const char *handle = intern(name);
+    int rc = client_table_set_name(&s->clients, c, handle);
+    intern_release(handle);
+    return rc;
+}
+
+static int version_readable(uint32_t version) {
+    return version >= 1 && version <= SNAPSHOT_VERSION;
+}
+
+int snapshot_read(struct server_state *s, FILE *fp) {
+    uint32_t magic, version, client_count, room_count;
+    if (get_u32(fp, &magic) != 0 || magic != SNAPSHOT_MAGIC) return -1;
+    if (get_u32(fp, &version) != 0 || !version_readable(version)) return -1;
+    if (get_u32(fp, &client_count) != 0 || get_u32(fp, &room_count) != 0) return -1;
+    if (get_queue(fp, &s->msg_queue) != 0 || get_log(fp, &s->global_log) != 0) return -1;
+
+    char name[MAX_NAME_LEN];
+    for (uint32_t i = 0; i < room_count; ++i) {
+        if (get_str(fp, name, sizeof(name)) != 0) return -1;
+        const char *handle = intern(name);
+        struct chat_room *room = room_table_insert(&s->rooms, handle);
+        intern_release(handle);
+        if (!room) return -1;
+        if (get_queue(fp, &room->history) != 0 || get_log(fp, &room->log) != 0) return -1;
+    }
+
+    // Allocate in file order so the client table keeps its pre-restart order
+    for (uint32_t i = 0; i < client_count; ++i) {
+        struct client_node *c = client_table_alloc(&s->clients);
+        if (!c) return -1;
+        uint32_t ip;
+        uint16_t port;
+        uint64_t last_active;
+        uint8_t muted;
+        if (get_str(fp, name, sizeof(name)) != 0 || set_name(s, c, name) != 0 ||
+            get_u32(fp, &ip) != 0 || get_u16(fp, &port) != 0 ||
+            get_u64(fp, &last_active) != 0 || get_u8(fp, &muted) != 0 ||
+            muted > MAX_MUTED) {
+            client_table_free(&s->clients, c);
+            return -1;
+        }
+        c->addr.sin_family = AF_INET;
+        c->addr.sin_addr.s_addr = ip;
+        c->addr.sin_port = port;
+        c->last_active = (time_t)last_active;
+        for (int m = 0; m < muted; ++m) {
+            const char *handle;
+            if (get_str(fp, name, sizeof(name)) != 0 || !(handle = intern(name))) {
+                client_table_free(&s->clients, c);
+                return -1;
+            }
+            c->cold->muted[c->muted_count++] = handle;
+        }
+        // Version 1 stored a single room name, empty when not in one
+        uint8_t rooms = 1;
+        if ((version >= 2 && get_u8(fp, &rooms) != 0) || rooms > MAX_CLIENT_ROOMS ||
+            activity_heap_push(&s->activity, c) != 0) {
+            client_table_free(&s->clients, c);
+            return -1;
+        }
+        for (int r = 0; r < rooms; ++r) {
+            if (get_str(fp, name, sizeof(name)) != 0) return -1;
+            if (name[0] != '\0' && snapshot_join_room(s, c, name) != 0) return -1;
+        }
+        if (version < 3) continue;
+        uint8_t topics;
+        if (get_u8(fp, &topics) != 0 || topics > MAX_CLIENT_TOPICS) return -1;
+        for (int p = 0; p < topics; ++p) {
+            if (get_str(fp, name, sizeof(name)) != 0) return -1;
+            const char *handle = intern(name);
+            int rc = topic_subscribe(&s->topics, c, handle);
+            intern_release(handle);
+            if (rc < 0) return -1;
+        }
+        if (version < 4) continue;
+        // Buffered records are not saved; the window is
+        uint8_t window_ms;
+        if (get_u8(fp, &window_ms) != 0 || window_ms > COALESCE_MAX_MS) return -1;
+        if (window_ms > 0 && (c->cold->coalesce = coalesce_open(&c->addr, window_ms))) c->coalescing = 1;
+    }
+    return 0;
+}
+
+// Forks while holding the read lock so the child inherits a consistent,
+// copy-on-write view of the state; workers only block for the fork itself.
+int snapshot_save(struct server_state *s, const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    pthread_rwlock_rdlock(&s->rwlock);
+    pid_t pid = fork();
+    if (pid == 0) {
+        FILE *fp = fopen(tmp, "wb");
+        if (!fp) _exit(1);
+        int rc = snapshot_write(s, fp);
+        if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) rc = -1;
+        if (fclose(fp) != 0) rc = -1;
+        if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+        _exit(rc == 0 ? 0 : 1);
+    }
+    pthread_rwlock_unlock(&s->rwlock);
+    if (pid < 0) {
+        perror("snapshot fork");
+        return -1;
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0) return -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Loads <path> into an empty state. Returns 1 when no snapshot exists.
+int snapshot_load(struct server_state *s, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 1;
+    char iobuf[1 << 16];
+    setvbuf(fp, iobuf, _IOFBF, sizeof(iobuf));
+    pthread_rwlock_wrlock(&s->rwlock);
+    int rc = snapshot_read(s, fp);
+    pthread_rwlock_unlock(&s->rwlock);
+    fclose(fp);
+    return rc;
+}
+
+// Periodically writes the snapshot in the background
+void *snapshot_thread(void *arg) {
+    struct snapshot_args *args = arg;
+    while (1) {
+        sleep(SNAPSHOT_INTERVAL);
+        if (snapshot_save(args->state, args->path) != 0) {
+            fprintf(stderr, "snapshot: failed to write %s\n", args->path);
+        }
+    }
+    return NULL;
+}
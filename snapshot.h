@@ -0,0 +1,35 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+
+#define SNAPSHOT_PATH "server_state.snap"
+#define SNAPSHOT_PATH_FMT "server_state.%d.snap"   // servers on non-default ports
+#define SNAPSHOT_SHARD_PATH_FMT "server_state.%d.shard%dof%d.snap"   // port, shard, shard count
+#define SNAPSHOT_INTERVAL 60
+#define SNAPSHOT_MAGIC 0x5343544du // "MTCS"
+#define SNAPSHOT_VERSION 4           // 4: clients keep their coalescing window
+// Older versions still load, so an upgrade or a --takeover from the previous
+// binary keeps every client: 1 had one room per client, 2 no topics, 3 no
+// coalescing window
+
+struct server_state;
+
+struct snapshot_args {
+    struct server_state *state;
+    const char *path;
+};
+
+// Serializes the full state. Caller must guarantee nothing mutates <s>
+// (either the rwlock is held or we are a forked copy-on-write child).
+int snapshot_write(struct server_state *s, FILE *fp);
+
+// Rebuilds clients, rooms, subscriptions, mutes and message logs into a freshly
+// initialised (empty) server_state.
+int snapshot_read(struct server_state *s, FILE *fp);
+
+int snapshot_save(struct server_state *s, const char *path);
+int snapshot_load(struct server_state *s, const char *path);
+void *snapshot_thread(void *arg);
+
+#endif // SNAPSHOT_H
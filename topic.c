@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <string.h>
+#include "topic.h"
+#include "pool.h"
+#include "client_table.h"
+
+static struct pool node_pool = POOL_INITIALIZER("topic_node", struct topic_node);
+
+// Start and length of each segment of <s>; -1 when there are too many
+static int split(const char *s, const char *start[], size_t len[]) {
+    int n = 0;
+    for (;;) {
+        if (n == TOPIC_MAX_DEPTH) return -1;
+        size_t l = strcspn(s, ".");
+        start[n] = s;
+        len[n++] = l;
+        if (s[l] == '\0') return n;
+        s += l + 1;
+    }
+}
+
+static int is_wildcard(const char *s, size_t len) {
+    return len == 1 && s[0] == '*';
+}
+
+int topic_valid(const char *s, int pattern) {
+    if (!s) return 0;
+    const char *start[TOPIC_MAX_DEPTH];
+    size_t len[TOPIC_MAX_DEPTH];
+    int n = split(s, start, len);
+    if (n < 0) return 0;
+    for (int i = 0; i < n; ++i) {
+        if (len[i] == 0) return 0;
+        if (pattern && is_wildcard(start[i], len[i])) continue;
+        for (size_t j = 0; j < len[i]; ++j)
+            if (start[i][j] == '*' || start[i][j] == ' ') return 0;
+    }
+    return 1;
+}
+
+void topic_tree_init(struct topic_tree *t) {
+    memset(t, 0, sizeof(*t));
+    room_table_init(&t->patterns);
+    t->generation = 1;
+}
+
+void topic_tree_destroy(struct topic_tree *t) {
+    for (int i = 0; i < TOPIC_CACHE_SETS; ++i) {
+        for (int w = 0; w < TOPIC_CACHE_WAYS; ++w) {
+            intern_release(t->cache[i][w].topic);
+            free(t->cache[i][w].clients);
+        }
+    }
+    for (int i = 0; i < TOPIC_EDGE_BUCKETS; ++i) {
+        struct topic_node *n = t->edges[i];
+        while (n) {
+            struct topic_node *next = n->next_edge;
+            intern_release(n->segment);
+            pool_free(&node_pool, n);
+            n = next;
+        }
+    }
+    room_table_destroy(&t->patterns);
+    memset(t, 0, sizeof(*t));
+}
+
+// ---------------- trie ----------------
+
+// Every non-root node, wildcards included (segment NULL), is chained here
+static struct topic_node **edge_bucket(struct topic_tree *t, const struct topic_node *parent,
+                                       const char *segment) {
+    uint32_t h = segment ? intern_hash(segment) : 0;
+    h ^= (uint32_t)((uintptr_t)parent >> 4) * 2654435761u;
+    return &t->edges[h % TOPIC_EDGE_BUCKETS];
+}
+
+static struct topic_node *exact_child(struct topic_tree *t, const struct topic_node *parent,
+                                      const char *segment) {
+    for (struct topic_node *n = *edge_bucket(t, parent, segment); n; n = n->next_edge)
+        if (n->parent == parent && n->segment == segment) return n;
+    return NULL;
+}
+
+// <segment> is NULL for the wildcard; the new node takes the reference
+static struct topic_node *add_child(struct topic_tree *t, struct topic_node *parent,
+                                    const char *segment) {
+    struct topic_node *n = pool_zalloc(&node_pool);
+    if (!n) return NULL;
+    n->segment = segment;
+    n->parent = parent;
+    struct topic_node **bucket = edge_bucket(t, parent, segment);
+    n->next_edge = *bucket;
+    *bucket = n;
+    if (!segment) parent->wildcard = n;
+    parent->children++;
+    return n;
+}
+
+// Frees <n> and its ancestors for as long as nothing hangs off them
+static void prune(struct topic_tree *t, struct topic_node *n) {
+    while (n && n != &t->root && !n->subs && n->children == 0) {
+        struct topic_node *parent = n->parent;
+        struct topic_node **ind = edge_bucket(t, parent, n->segment);
+        while (*ind != n) ind = &(*ind)->next_edge;
+        *ind = n->next_edge;
+        if (!n->segment) parent->wildcard = NULL;
+        parent->children--;
+        intern_release(n->segment);
+        pool_free(&node_pool, n);
+        n = parent;
+    }
+}
+
+// Node spelling <pattern>, created along the way when <create> is set
+static struct topic_node *walk(struct topic_tree *t, const char *pattern, int create) {
+    const char *start[TOPIC_MAX_DEPTH];
+    size_t len[TOPIC_MAX_DEPTH];
+    int n = split(pattern, start, len);
+    struct topic_node *node = &t->root;
+    for (int i = 0; i < n && node; ++i) {
+        struct topic_node *child;
+        if (is_wildcard(start[i], len[i])) {
+            child = node->wildcard;
+            if (!child && create) child = add_child(t, node, NULL);
+        } else {
+            const char *seg = create ? intern_n(start[i], len[i]) : intern_find_n(start[i], len[i]);
+            child = seg ? exact_child(t, node, seg) : NULL;
+            if (!child && seg && create) {
+                child = add_child(t, node, seg);
+                if (child) seg = NULL;   // the node keeps our reference
+            }
+            intern_release(seg);         // child, if any, holds its own
+        }
+        if (!child && create) prune(t, node);
+        node = child;
+    }
+    return node;
+}
+
+// Unhooks a pattern whose last subscriber left
+static void drop_pattern(struct topic_tree *t, struct chat_room *room) {
+    struct topic_node *node = walk(t, room->name, 0);
+    if (node) node->subs = NULL;
+    room_table_remove(&t->patterns, room->name);
+    prune(t, node);
+}
+
+// ---------------- subscriptions ----------------
+
+int topic_subscribe(struct topic_tree *t, struct client_node *client, const char *pattern) {
+    if (!client || !topic_valid(pattern, 1)) return -1;
+    struct chat_room *room = room_table_find(&t->patterns, pattern);
+    if (!room) {
+        struct topic_node *node = walk(t, pattern, 1);
+        if (!node) return -1;
+        room = room_table_insert(&t->patterns, pattern);
+        if (!room) {
+            prune(t, node);
+            return -1;
+        }
+        node->subs = room;
+    }
+    int rc = room_subscribe(room, client);
+    if (rc == 0) t->generation++;
+    else if (room->member_count == 0) drop_pattern(t, room);
+    return rc;
+}
+
+static void unsubscribe_room(struct topic_tree *t, struct client_node *client, struct chat_room *room) {
+    room_unsubscribe(room, client);
+    t->generation++;
+    if (room->member_count == 0) drop_pattern(t, room);
+}
+
+int topic_unsubscribe(struct topic_tree *t, struct client_node *client, const char *pattern) {
+    if (!client || !pattern) return -1;
+    struct chat_room *room = room_table_find(&t->patterns, pattern);
+    struct room_member *m = client->cold->topics;
+    while (m && m->room != room) m = m->next;
+    if (!room || !m) return -1;
+    unsubscribe_room(t, client, room);
+    return 0;
+}
+
+void topic_unsubscribe_all(struct topic_tree *t, struct client_node *client) {
+    while (client->cold->topics) unsubscribe_room(t, client, client->cold->topics->room);
+}
+
+// ---------------- publish ----------------
+
+static int append_members(struct topic_fanout *f, const struct chat_room *room) {
+    uint32_t need = f->count + room->member_count;
+    if (need > f->cap) {
+        uint32_t cap = f->cap ? f->cap : ROOM_MEMBERS_MIN;
+        while (cap < need) cap *= 2;
+        struct client_node **clients = realloc(f->clients, cap * sizeof(*clients));
+        if (!clients) return -1;
+        f->clients = clients;
+        f->cap = cap;
+    }
+    memcpy(f->clients + f->count, room->members, room->member_count * sizeof(*f->clients));
+    f->count = need;
+    return 0;
+}
+
+// Follows the exact segment and the wildcard at every level; <segs>
+// entries are NULL for segments nobody has interned (only "*" matches)
+static int collect(struct topic_tree *t, const struct topic_node *node, const char **segs,
+                   int n, struct topic_fanout *f, int *matched) {
+    if (n == 0) {
+        if (!node->subs) return 0;
+        (*matched)++;
+        return append_members(f, node->subs);
+    }
+    const struct topic_node *exact = segs[0] ? exact_child(t, node, segs[0]) : NULL;
+    if (exact && collect(t, exact, segs + 1, n - 1, f, matched) != 0) return -1;
+    if (node->wildcard && collect(t, node->wildcard, segs + 1, n - 1, f, matched) != 0) return -1;
+    return 0;
+}
+
+static int compare_clients(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(struct client_node *const *)a;
+    uintptr_t y = (uintptr_t)*(struct client_node *const *)b;
+    return x < y ? -1 : x > y;
+}
+
+// The entry caching <topic>, else one to recompute it in: an empty or
+// stale entry if the set has one, otherwise a victim picked by hash
+static struct topic_fanout *cache_entry(struct topic_tree *t, const char *topic) {
+    uint32_t h = intern_hash(topic);
+    struct topic_fanout *set = t->cache[h % TOPIC_CACHE_SETS];
+    struct topic_fanout *spare = NULL;
+    for (int w = 0; w < TOPIC_CACHE_WAYS; ++w) {
+        if (set[w].topic == topic) return &set[w];
+        if (!spare && (!set[w].topic || set[w].generation != t->generation)) spare = &set[w];
+    }
+    return spare ? spare : &set[(h / TOPIC_CACHE_SETS) % TOPIC_CACHE_WAYS];
+}
+
+struct client_node **topic_resolve(struct topic_tree *t, const char *topic, uint32_t *count) {
+    *count = 0;
+    if (!topic) return NULL;
+    struct topic_fanout *f = cache_entry(t, topic);
+    if (f->topic == topic && f->generation == t->generation) {
+        *count = f->count;
+        return f->clients;
+    }
+
+    const char *start[TOPIC_MAX_DEPTH], *segs[TOPIC_MAX_DEPTH];
+    size_t len[TOPIC_MAX_DEPTH];
+    int n = split(topic, start, len);
+    if (n < 0) return NULL;
+    for (int i = 0; i < n; ++i) segs[i] = intern_find_n(start[i], len[i]);
+    int matched = 0;
+    f->count = 0;
+    int rc = collect(t, &t->root, segs, n, f, &matched);
+    for (int i = 0; i < n; ++i) intern_release(segs[i]);
+    if (rc != 0) {
+        intern_release(f->topic);
+        f->topic = NULL;
+        return NULL;
+    }
+
+    // A client subscribed through several matching patterns gets one copy
+    if (matched > 1) {
+        qsort(f->clients, f->count, sizeof(*f->clients), compare_clients);
+        uint32_t unique = 0;
+        for (uint32_t i = 0; i < f->count; ++i)
+            if (unique == 0 || f->clients[unique - 1] != f->clients[i]) f->clients[unique++] = f->clients[i];
+        f->count = unique;
+    }
+    if (f->topic != topic) {
+        intern_release(f->topic);
+        f->topic = intern_ref(topic);
+    }
+    f->generation = t->generation;
+    *count = f->count;
+    return f->clients;
+}
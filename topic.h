@@ -0,0 +1,67 @@
+#ifndef TOPIC_H
+#define TOPIC_H
+
+#include <stdint.h>
+#include "room.h"
+
+// Hierarchical pub/sub. Topics are dot-separated (alerts.db.primary);
+// subscription patterns may use "*" for exactly one segment
+// (alerts.db.*, alerts.*.primary). Every subscribed pattern is a
+// chat_room in the tree's own room table, so subscribers use the room
+// membership machinery (room_subscribe). A trie over interned segments
+// maps a published topic to the patterns it matches, and the merged,
+// de-duplicated subscriber list is cached per topic until any
+// subscription changes.
+
+#define TOPIC_MAX_DEPTH 16           // segments per topic or pattern
+#define TOPIC_EDGE_BUCKETS 1024      // trie edges, hashed on (parent, segment)
+#define TOPIC_CACHE_SETS 64          // resolved fan-out lists, hashed by topic...
+#define TOPIC_CACHE_WAYS 4           // ...into sets of this many entries
+
+struct client_node;
+
+struct topic_node {
+    const char *segment;             // interned; NULL at the root and for "*"
+    struct topic_node *parent;
+    struct topic_node *wildcard;     // the "*" child
+    struct topic_node *next_edge;    // chain in topic_tree.edges
+    struct chat_room *subs;          // the pattern ending here, when subscribed
+    uint32_t children;               // exact children plus the wildcard
+};
+
+struct topic_fanout {
+    const char *topic;               // interned, referenced; NULL = empty slot
+    uint64_t generation;
+    struct client_node **clients;
+    uint32_t count;
+    uint32_t cap;
+};
+
+struct topic_tree {
+    struct topic_node root;
+    struct topic_node *edges[TOPIC_EDGE_BUCKETS];
+    struct room_table patterns;      // one room per subscribed pattern
+    uint64_t generation;             // bumped by every (un)subscribe
+    struct topic_fanout cache[TOPIC_CACHE_SETS][TOPIC_CACHE_WAYS];
+};
+
+void topic_tree_init(struct topic_tree *t);
+void topic_tree_destroy(struct topic_tree *t);
+
+// 1 when <s> is a well-formed topic: non-empty segments, at most
+// TOPIC_MAX_DEPTH of them, and "*" segments only if <pattern> is set
+int topic_valid(const char *s, int pattern);
+
+// Callers hold the server_state write lock. <pattern> is an interned
+// handle. topic_subscribe returns 0, 1 when already subscribed, -1 for a
+// bad pattern, MAX_CLIENT_TOPICS reached or no memory; topic_unsubscribe
+// returns -1 when <client> is not subscribed to <pattern>.
+int topic_subscribe(struct topic_tree *t, struct client_node *client, const char *pattern);
+int topic_unsubscribe(struct topic_tree *t, struct client_node *client, const char *pattern);
+void topic_unsubscribe_all(struct topic_tree *t, struct client_node *client);
+
+// Subscribers of the interned topic <topic>, each listed once. The array
+// belongs to the cache and is valid until the lock is released.
+struct client_node **topic_resolve(struct topic_tree *t, const char *topic, uint32_t *count);
+
+#endif // TOPIC_H
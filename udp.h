@@ -52,6 +52,34 @@ static inline int udp_socket_open(int port)
     return sd;
 }
 
+// Like udp_socket_open but with SO_REUSEPORT, so several sockets (one per
+// reactor shard) can share <port>
+static inline int udp_socket_open_shared(int port)
+{
+    int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int one = 1;
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        close(sd);
+        return -1;
+    }
+
+    struct sockaddr_in this_addr;
+    set_socket_addr(&this_addr, NULL, port);
+
+    if (bind(sd, (struct sockaddr *)&this_addr, sizeof(this_addr)) < 0) {
+        perror("bind");
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
 static inline int udp_socket_read(int sd,
                                   struct sockaddr_in *addr,
                                   char *buffer,
@@ -62,6 +90,18 @@ static inline int udp_socket_read(int sd,
                     (struct sockaddr *)addr, &len);
 }
 
+// Like udp_socket_read but never blocks, leaving the (possibly shared)
+// socket's O_NONBLOCK flag untouched.
+static inline int udp_socket_try_read(int sd,
+                                      struct sockaddr_in *addr,
+                                      char *buffer,
+                                      int n)
+{
+    socklen_t len = sizeof(struct sockaddr_in);
+    return recvfrom(sd, buffer, n, MSG_DONTWAIT,
+                    (struct sockaddr *)addr, &len);
+}
+
 static inline int udp_socket_write(int sd,
                                    struct sockaddr_in *addr,
                                    char *buffer,
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring_io.h"
+
+// user_data tags on the receive ring
+#define TAG_RECV 1
+#define TAG_WAKE 2
+#define TAG_CANCEL 3
+
+#define RECV_BGID 0
+
+int uring_init(struct uring *r, unsigned entries, unsigned cq_entries) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (cq_entries) {
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        errno = ENOSYS;
+        return -1;
+    }
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    r->ring_map = mmap(NULL, r->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    if (r->ring_map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring_map, r->ring_len);
+        close(fd);
+        return -1;
+    }
+    char *base = r->ring_map;
+    r->fd = fd;
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned *)(base + p.sq_off.head);
+    r->sq_tail = (unsigned *)(base + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(base + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(base + p.sq_off.array);
+    r->cq_head = (unsigned *)(base + p.cq_off.head);
+    r->cq_tail = (unsigned *)(base + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(base + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+    return 0;
+}
+
+void uring_exit(struct uring *r) {
+    munmap(r->sqes, r->sqes_len);
+    munmap(r->ring_map, r->ring_len);
+    close(r->fd);
+}
+
+// Returns a zeroed SQE, or NULL if the submission queue is full
+static struct io_uring_sqe *get_sqe(struct uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head >= r->sq_entries) return NULL;
+    unsigned idx = r->sq_local_tail & *r->sq_mask;
+    r->sq_array[idx] = idx;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_local_tail++;
+    r->sq_unsubmitted++;
+    return sqe;
+}
+
+// Publishes prepared SQEs and waits for <wait_nr> completions, in one syscall
+static int enter(struct uring *r, unsigned wait_nr) {
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    int ret = (int)syscall(__NR_io_uring_enter, r->fd, r->sq_unsubmitted, wait_nr,
+                           wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret > 0) r->sq_unsubmitted -= (unsigned)ret;
+    return ret;
+}
+
+static struct io_uring_cqe *peek_cqe(struct uring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static void cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_probe(void) {
+    struct uring r;
+    if (uring_init(&r, 4, 0) != 0) return -1;
+    const unsigned nops = 256;
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + nops * sizeof(struct io_uring_probe_op));
+    int ok = probe && syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_PROBE, probe, nops) == 0;
+    static const int needed[] = { IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_POLL_ADD,
+                                  IORING_OP_ASYNC_CANCEL };
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); ++i)
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    uring_exit(&r);
+    return ok ? 0 : -1;
+}
+
+// ---------------- Receive ----------------
+
+// Hands buffer <bid> back to the kernel
+static void recycle_buffer(struct uring_recv *rx, unsigned bid) {
+    struct io_uring_buf_ring *br = rx->br;
+    unsigned short tail = br->tail;
+    struct io_uring_buf *b = &br->bufs[tail & (URING_RECV_BUFFERS - 1)];
+    b->addr = (uint64_t)(uintptr_t)(rx->bufs + (size_t)bid * rx->buf_size);
+    b->len = (uint32_t)rx->buf_size;
+    b->bid = (uint16_t)bid;
+    __atomic_store_n(&br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+int uring_recv_open(struct uring_recv *rx, int sd) {
+    memset(rx, 0, sizeof(*rx));
+    // Every recv CQE holds a buffer, so the CQ only needs room for all of them
+    if (uring_init(&rx->ring, 8, URING_RECV_BUFFERS * 2) != 0) return -1;
+    rx->sd = sd;
+    rx->buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + BUFFER_SIZE;
+    rx->bufs = malloc(rx->buf_size * URING_RECV_BUFFERS);
+    rx->br_len = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    rx->br = mmap(NULL, rx->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!rx->bufs || rx->br == MAP_FAILED) goto fail;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)rx->br;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = RECV_BGID;
+    if (syscall(__NR_io_uring_register, rx->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) goto fail;
+    for (unsigned i = 0; i < URING_RECV_BUFFERS; ++i) recycle_buffer(rx, i);
+
+    rx->msg.msg_namelen = sizeof(struct sockaddr_in);
+    return 0;
+
+fail:
+    if (rx->br != MAP_FAILED && rx->br) munmap(rx->br, rx->br_len);
+    free(rx->bufs);
+    uring_exit(&rx->ring);
+    return -1;
+}
+
+static int arm_recv(struct uring_recv *rx) {
+    struct io_uring_sqe *sqe = get_sqe(&rx->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = rx->sd;
+    sqe->addr = (uint64_t)(uintptr_t)&rx->msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BGID;
+    sqe->user_data = TAG_RECV;
+    rx->recv_armed = 1;
+    return 0;
+}
+
+static int arm_wake(struct uring_recv *rx, int wake_fd) {
+    struct io_uring_sqe *sqe = get_sqe(&rx->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = TAG_WAKE;
+    rx->wake_armed = 1;
+    return 0;
+}
+
+// Delivers the datagram in one completed buffer and recycles the buffer
+static void deliver_buffer(struct uring_recv *rx, const struct io_uring_cqe *cqe,
+                           uring_datagram_fn cb, void *user) {
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *buf = rx->bufs + (size_t)bid * rx->buf_size;
+    const struct io_uring_recvmsg_out *out = (const void *)buf;
+    size_t header = sizeof(*out) + rx->msg.msg_namelen + rx->msg.msg_controllen;
+    if ((size_t)cqe->res >= header && out->namelen >= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in src;
+        memcpy(&src, buf + sizeof(*out), sizeof(src));
+        size_t len = out->payloadlen;
+        if (len > (size_t)cqe->res - header) len = (size_t)cqe->res - header;
+        cb(&src, buf + header, len, user);
+    }
+    recycle_buffer(rx, bid);
+}
+
+// Drains the CQ; returns 1 if the wake poll fired, -1 on a receive error
+static int reap_recv(struct uring_recv *rx, uring_datagram_fn cb, void *user) {
+    int result = 0;
+    struct io_uring_cqe *cqe;
+    while ((cqe = peek_cqe(&rx->ring)) != NULL) {
+        if (cqe->user_data == TAG_RECV) {
+            if (cqe->flags & IORING_CQE_F_BUFFER) deliver_buffer(rx, cqe, cb, user);
+            // -ENOBUFS only means we were slow to recycle; re-arm and go on
+            if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED && result == 0)
+                result = -1;
+            if (!(cqe->flags & IORING_CQE_F_MORE)) rx->recv_armed = 0;
+        } else if (cqe->user_data == TAG_WAKE) {
+            rx->wake_armed = 0;
+            result = 1;
+        }
+        cqe_seen(&rx->ring);
+    }
+    return result;
+}
+
+int uring_recv_wait(struct uring_recv *rx, int wake_fd, uring_datagram_fn cb, void *user) {
+    if (!rx->recv_armed && arm_recv(rx) != 0) return -1;
+    if (!rx->wake_armed && arm_wake(rx, wake_fd) != 0) return -1;
+    if (enter(&rx->ring, 1) < 0 && errno != EINTR) return -1;
+    return reap_recv(rx, cb, user);
+}
+
+void uring_recv_close(struct uring_recv *rx, uring_datagram_fn cb, void *user) {
+    if (rx->recv_armed) {
+        struct io_uring_sqe *sqe = get_sqe(&rx->ring);
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = TAG_RECV;
+            sqe->user_data = TAG_CANCEL;
+        }
+        // The final recv CQE (without F_MORE) follows every datagram it consumed
+        while (rx->recv_armed) {
+            if (enter(&rx->ring, 1) < 0 && errno != EINTR) break;
+            reap_recv(rx, cb, user);
+        }
+    }
+    syscall(__NR_io_uring_register, rx->ring.fd, IORING_UNREGISTER_PBUF_RING,
+            &(struct io_uring_buf_reg){ .bgid = RECV_BGID }, 1);
+    munmap(rx->br, rx->br_len);
+    free(rx->bufs);
+    uring_exit(&rx->ring);
+}
+
+// ---------------- Send ----------------
+
+int uring_send_init(struct uring_send *tx) {
+    tx->pending = 0;
+    return uring_init(&tx->ring, URING_SEND_BATCH, 0);
+}
+
+void uring_send_close(struct uring_send *tx) {
+    uring_exit(&tx->ring);
+}
+
+int uring_send_queue(struct uring_send *tx, int sd, const struct sockaddr_in *addr,
+                     const char *buf, size_t len) {
+    if (tx->pending == URING_SEND_BATCH) return -1;
+    struct uring_send_slot *slot = &tx->slots[tx->pending++];
+    if (len > sizeof(slot->buf)) len = sizeof(slot->buf);
+    memcpy(slot->buf, buf, len);
+    slot->sd = sd;
+    slot->addr = *addr;
+    slot->iov.iov_base = slot->buf;
+    slot->iov.iov_len = len;
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->addr;
+    slot->msg.msg_namelen = sizeof(slot->addr);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+    return 0;
+}
+
+int uring_send_flush(struct uring_send *tx, uint64_t *bytes) {
+    unsigned n = tx->pending;
+    *bytes = 0;
+    if (n == 0) return 0;
+    for (unsigned i = 0; i < n; ++i) {
+        struct io_uring_sqe *sqe = get_sqe(&tx->ring);
+        if (!sqe) return -1;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = tx->slots[i].sd;
+        sqe->addr = (uint64_t)(uintptr_t)&tx->slots[i].msg;
+        sqe->user_data = i;
+    }
+    // The slots stay in use until every send has completed
+    int sent = 0;
+    unsigned done = 0;
+    unsigned wait_nr = n;
+    while (done < n) {
+        if (enter(&tx->ring, wait_nr) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+        struct io_uring_cqe *cqe;
+        while ((cqe = peek_cqe(&tx->ring)) != NULL) {
+            if (cqe->res >= 0) {
+                sent++;
+                *bytes += (uint64_t)cqe->res;
+            }
+            cqe_seen(&tx->ring);
+            done++;
+        }
+        wait_nr = n - done;
+    }
+    tx->pending = 0;
+    return sent;
+}
@@ -0,0 +1,90 @@
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "udp.h"
+
+// Minimal io_uring engine on raw syscalls (no liburing). The receive side
+// keeps one multishot recvmsg armed over a ring of provided buffers, so a
+// burst of datagrams costs one io_uring_enter instead of one recvfrom each.
+// The send side queues datagrams as SENDMSG SQEs and submits a whole
+// broadcast with one io_uring_enter.
+
+#define URING_RECV_BUFFERS 256      // power of two
+#define URING_SEND_BATCH 64
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring_map;
+    size_t ring_len;
+    size_t sqes_len;
+    unsigned sq_local_tail;         // SQEs prepared but not yet published
+    unsigned sq_unsubmitted;
+};
+
+// <cq_entries> of 0 keeps the kernel default (twice <entries>)
+int uring_init(struct uring *r, unsigned entries, unsigned cq_entries);
+void uring_exit(struct uring *r);
+
+// Returns 0 if this kernel can run the engine (ring setup + required opcodes)
+int uring_probe(void);
+
+typedef void (*uring_datagram_fn)(const struct sockaddr_in *src, const char *data,
+                                  size_t len, void *user);
+
+struct uring_recv {
+    struct uring ring;
+    int sd;
+    struct io_uring_buf_ring *br;
+    size_t br_len;
+    char *bufs;
+    size_t buf_size;
+    struct msghdr msg;              // template for the multishot recvmsg
+    int recv_armed;
+    int wake_armed;
+};
+
+int uring_recv_open(struct uring_recv *rx, int sd);
+
+// Waits for traffic and hands every received datagram to <cb>. Returns 1
+// once <wake_fd> becomes readable, 0 after delivering datagrams, -1 on error.
+int uring_recv_wait(struct uring_recv *rx, int wake_fd, uring_datagram_fn cb, void *user);
+
+// Cancels the receive and delivers anything already taken off the socket,
+// so datagrams left in the socket stay there for the next reader
+void uring_recv_close(struct uring_recv *rx, uring_datagram_fn cb, void *user);
+
+struct uring_send_slot {
+    int sd;
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in addr;
+    char buf[BUFFER_SIZE];
+};
+
+struct uring_send {
+    struct uring ring;
+    unsigned pending;
+    struct uring_send_slot slots[URING_SEND_BATCH];
+};
+
+int uring_send_init(struct uring_send *tx);
+void uring_send_close(struct uring_send *tx);
+
+// Copies one datagram into the batch; returns -1 when the batch is full
+int uring_send_queue(struct uring_send *tx, int sd, const struct sockaddr_in *addr,
+                     const char *buf, size_t len);
+
+// Submits the batch and waits for it; returns datagrams sent, <bytes> their
+// total size. On -1 the ring is broken and the batch must not be reused.
+int uring_send_flush(struct uring_send *tx, uint64_t *bytes);
+
+#endif // URING_IO_H
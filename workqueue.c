@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "workqueue.h"
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int work_queue_init(struct work_queue *q, size_t capacity) {
+    memset(q, 0, sizeof(*q));
+    for (int i = 0; i < WORK_LANES; ++i) {
+        struct work_ring *r = &q->lanes[i];
+        r->items = calloc(capacity, sizeof(*r->items));
+        r->queued_ns = calloc(capacity, sizeof(*r->queued_ns));
+        if (!r->items || !r->queued_ns) {
+            for (int j = 0; j <= i; ++j) {
+                free(q->lanes[j].items);
+                free(q->lanes[j].queued_ns);
+            }
+            return -1;
+        }
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+    q->capacity = capacity;
+    return 0;
+}
+
+void work_queue_destroy(struct work_queue *q) {
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->lock);
+    for (int i = 0; i < WORK_LANES; ++i) {
+        free(q->lanes[i].items);
+        free(q->lanes[i].queued_ns);
+    }
+}
+
+int work_queue_push(struct work_queue *q, enum work_lane lane, void *item) {
+    uint64_t now = monotonic_ns();
+    struct work_ring *r = &q->lanes[lane];
+    pthread_mutex_lock(&q->lock);
+    if (r->count == q->capacity) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    size_t slot = (r->head + r->count) % q->capacity;
+    r->items[slot] = item;
+    r->queued_ns[slot] = now;
+    __atomic_store_n(&r->count, r->count + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+// Caller holds q->lock; returns -1 when every lane is empty
+static int first_ready_lane(const struct work_queue *q) {
+    for (int i = 0; i < WORK_LANES; ++i)
+        if (q->lanes[i].count > 0) return i;
+    return -1;
+}
+
+void *work_queue_pop(struct work_queue *q, enum work_lane *lane, uint64_t *wait_ns) {
+    pthread_mutex_lock(&q->lock);
+    int i;
+    while ((i = first_ready_lane(q)) < 0) pthread_cond_wait(&q->ready, &q->lock);
+    struct work_ring *r = &q->lanes[i];
+    void *item = r->items[r->head];
+    uint64_t queued = r->queued_ns[r->head];
+    r->head = (r->head + 1) % q->capacity;
+    __atomic_store_n(&r->count, r->count - 1, __ATOMIC_RELAXED);
+    uint64_t wait = monotonic_ns() - queued;
+    int64_t ewma = (int64_t)r->wait_ewma_ns;
+    ewma += ((int64_t)wait - ewma) >> WORK_QUEUE_EWMA_SHIFT;
+    __atomic_store_n(&r->wait_ewma_ns, (uint64_t)ewma, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->lock);
+    if (lane) *lane = (enum work_lane)i;
+    if (wait_ns) *wait_ns = wait;
+    return item;
+}
+
+size_t work_queue_depth(struct work_queue *q, enum work_lane lane) {
+    return __atomic_load_n(&q->lanes[lane].count, __ATOMIC_RELAXED);
+}
+
+uint64_t work_queue_wait_ewma(const struct work_queue *q, enum work_lane lane) {
+    return __atomic_load_n(&q->lanes[lane].wait_ewma_ns, __ATOMIC_RELAXED);
+}
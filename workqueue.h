@@ -0,0 +1,51 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Bounded FIFO lanes between the listener and the worker pool. Workers
+// always drain the control lane before the bulk lane (strict priority), so
+// keepalives never wait behind a burst of chat. Each lane tracks its depth
+// and an EWMA of how long items wait before a worker picks them up, which
+// is the server's overload signal.
+
+#define WORK_QUEUE_CAPACITY 4096     // per lane
+#define WORK_QUEUE_EWMA_SHIFT 3      // new sample weighs 1/8
+
+enum work_lane {
+    WORK_LANE_CONTROL,               // re-ping$, disconn$, conn$, fed$, admin
+    WORK_LANE_BULK,                  // chat and everything else
+    WORK_LANES
+};
+
+struct work_ring {
+    void **items;
+    uint64_t *queued_ns;
+    size_t head;
+    size_t count;
+    uint64_t wait_ewma_ns;           // read without the lock for admission
+};
+
+struct work_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    size_t capacity;
+    struct work_ring lanes[WORK_LANES];
+};
+
+int work_queue_init(struct work_queue *q, size_t capacity);
+void work_queue_destroy(struct work_queue *q);
+
+// Returns 0, or -1 when <lane> is full
+int work_queue_push(struct work_queue *q, enum work_lane lane, void *item);
+
+// Blocks until an item is available, taking the highest-priority lane
+// first; <lane> and <wait_ns> receive where it came from and its queueing delay
+void *work_queue_pop(struct work_queue *q, enum work_lane *lane, uint64_t *wait_ns);
+
+size_t work_queue_depth(struct work_queue *q, enum work_lane lane);
+uint64_t work_queue_wait_ewma(const struct work_queue *q, enum work_lane lane);
+
+#endif // WORKQUEUE_H